@@ -0,0 +1,234 @@
+#include "adaptive.h"
+#include "plan.h"
+#include <math.h>
+#include <string.h>
+
+#define ADAPTIVE_MAX_DEPTH 14
+
+AdaptiveSettings adaptive_default_settings(float extent) {
+  AdaptiveSettings settings = {extent, 1e-3f, 3, 10};
+  return settings;
+}
+
+void adaptive_free(AdaptiveSurface *surface) {
+  free(surface->nodes);
+  free(surface->values);
+  free(surface->keys);
+  free(surface->hash);
+  memset(surface, 0, sizeof(*surface));
+}
+
+// finest samples per side, minus one
+static int lattice_size(const AdaptiveSurface *surface) { return 2 << surface->settings.maxDepth; }
+
+static unsigned int hash_key(long long key) {
+  unsigned long long h = (unsigned long long)key * 0x9E3779B97F4A7C15ull;
+  return (unsigned int)(h >> 32);
+}
+
+static int grow_hash(AdaptiveSurface *surface) {
+  int capacity = surface->hashCapacity > 0 ? 2 * surface->hashCapacity : 1024;
+  int *hash = (int *)malloc(capacity * sizeof(int));
+  if (!hash)
+    return 0;
+  memset(hash, -1, capacity * sizeof(int));
+  for (int s = 0; s < surface->sampleCount; s++) {
+    unsigned int slot = hash_key(surface->keys[s]) & (capacity - 1);
+    while (hash[slot] >= 0)
+      slot = (slot + 1) & (capacity - 1);
+    hash[slot] = s;
+  }
+  free(surface->hash);
+  surface->hash = hash;
+  surface->hashCapacity = capacity;
+  return 1;
+}
+
+// index of the sample at lattice point (i, j), added unevaluated when new;
+// -1 when out of memory
+static int find_sample(AdaptiveSurface *surface, int i, int j) {
+  if (surface->symmetric && i > j) {
+    int swap = i;
+    i = j;
+    j = swap;
+  }
+  long long key = (long long)i * (lattice_size(surface) + 1) + j;
+  // keep the table at most half full
+  if (2 * (surface->sampleCount + 1) > surface->hashCapacity && !grow_hash(surface))
+    return -1;
+  unsigned int mask = surface->hashCapacity - 1;
+  unsigned int slot = hash_key(key) & mask;
+  for (; surface->hash[slot] >= 0; slot = (slot + 1) & mask)
+    if (surface->keys[surface->hash[slot]] == key)
+      return surface->hash[slot];
+
+  if (surface->sampleCount == surface->sampleCapacity) {
+    int capacity = surface->sampleCapacity > 0 ? 2 * surface->sampleCapacity : 1024;
+    float *values = (float *)realloc(surface->values, capacity * sizeof(float));
+    if (!values)
+      return -1;
+    surface->values = values;
+    long long *keys = (long long *)realloc(surface->keys, capacity * sizeof(long long));
+    if (!keys)
+      return -1;
+    surface->keys = keys;
+    surface->sampleCapacity = capacity;
+  }
+  int index = surface->sampleCount++;
+  surface->keys[index] = key;
+  surface->hash[slot] = index;
+  return index;
+}
+
+// parent: NULL for the root, else the node split into quadrant (qx, qz),
+// whose block already holds the new node's corners
+static int add_node(AdaptiveSurface *surface, int i, int j, int size, const QuadNode *parent, int qx, int qz) {
+  if (surface->nodeCount == surface->nodeCapacity) {
+    int capacity = surface->nodeCapacity > 0 ? 2 * surface->nodeCapacity : 1024;
+    QuadNode *nodes = (QuadNode *)realloc(surface->nodes, capacity * sizeof(QuadNode));
+    if (!nodes)
+      return -1;
+    surface->nodes = nodes;
+    surface->nodeCapacity = capacity;
+  }
+  QuadNode *node = &surface->nodes[surface->nodeCount];
+  node->i = i;
+  node->j = j;
+  node->size = size;
+  node->child = -1;
+  int h = size / 2;
+  for (int s = 0; s < 9; s++) {
+    int a = s % 3, b = s / 3;
+    if (parent && a != 1 && b != 1) {
+      node->samples[s] = parent->samples[3 * (qz + b / 2) + qx + a / 2];
+      continue;
+    }
+    node->samples[s] = find_sample(surface, i + a * h, j + b * h);
+    if (node->samples[s] < 0)
+      return -1;
+  }
+  return surface->nodeCount++;
+}
+
+typedef struct {
+  AdaptiveSurface *surface;
+  const DissonancePlan *plan;
+  int first; // samples [first, sampleCount) are new
+} SampleJob;
+
+static void evaluate_sample(void *ctx, int index, int thread) {
+  SampleJob *job = (SampleJob *)ctx;
+  AdaptiveSurface *surface = job->surface;
+  int s = job->first + index;
+  long long stride = lattice_size(surface) + 1;
+  float scale = surface->settings.extent / lattice_size(surface);
+  float x = (float)(surface->keys[s] / stride) * scale;
+  float z = (float)(surface->keys[s] % stride) * scale;
+  surface->values[s] = dissonance_plan_xz(job->plan, x, z);
+}
+
+static void evaluate_new(ThreadPool *pool, SampleJob *job) {
+  threadpool_parallel_for(pool, job->surface->sampleCount - job->first, evaluate_sample, job);
+  job->first = job->surface->sampleCount;
+}
+
+// error of the corner-only bilinear interpolation at the other five samples
+static float node_error(const AdaptiveSurface *surface, const QuadNode *node) {
+  float v[9];
+  for (int s = 0; s < 9; s++)
+    v[s] = surface->values[node->samples[s]];
+  float error = fabsf(0.5f * (v[0] + v[2]) - v[1]);
+  error = fmaxf(error, fabsf(0.5f * (v[0] + v[6]) - v[3]));
+  error = fmaxf(error, fabsf(0.5f * (v[2] + v[8]) - v[5]));
+  error = fmaxf(error, fabsf(0.5f * (v[6] + v[8]) - v[7]));
+  return fmaxf(error, fabsf(0.25f * (v[0] + v[2] + v[6] + v[8]) - v[4]));
+}
+
+int adaptive_build(ThreadPool *pool, const AdaptiveSettings *settings, Voices *voices, AdaptiveSurface *surface) {
+  memset(surface, 0, sizeof(*surface));
+  if (settings->extent <= 0.0f || settings->maxDepth < 0 || settings->maxDepth > ADAPTIVE_MAX_DEPTH ||
+      settings->minDepth > settings->maxDepth)
+    return 0;
+  surface->settings = *settings;
+  surface->symmetric = voices_axis_symmetric(voices);
+  double start = threadpool_now_ms();
+
+  DissonancePlan plan;
+  dissonance_plan_init(&plan, DISS_AMP_MIN, 0.0f);
+  SampleJob job = {surface, &plan, 0};
+  int ok = dissonance_plan_compile(&plan, voices) && add_node(surface, 0, 0, lattice_size(surface), NULL, 0, 0) == 0;
+
+  // one level per pass: the new samples of the level are evaluated together,
+  // then every node decides whether it splits
+  int levelStart = 0;
+  for (int depth = 0; ok && levelStart < surface->nodeCount; depth++) {
+    int levelEnd = surface->nodeCount;
+    evaluate_new(pool, &job);
+    surface->depth = depth;
+    for (int k = levelStart; ok && k < levelEnd; k++) {
+      QuadNode node = surface->nodes[k];
+      float error = node_error(surface, &node);
+      if (depth >= settings->maxDepth || (depth >= settings->minDepth && error <= settings->tolerance)) {
+        surface->leaves++;
+        surface->maxError = fmaxf(surface->maxError, error);
+        continue;
+      }
+      int h = node.size / 2;
+      int first = add_node(surface, node.i, node.j, h, &node, 0, 0);
+      ok = first >= 0 && add_node(surface, node.i + h, node.j, h, &node, 1, 0) >= 0 &&
+           add_node(surface, node.i, node.j + h, h, &node, 0, 1) >= 0 &&
+           add_node(surface, node.i + h, node.j + h, h, &node, 1, 1) >= 0;
+      surface->nodes[k].child = first;
+    }
+    levelStart = levelEnd;
+  }
+  dissonance_plan_free(&plan);
+  surface->ms = threadpool_now_ms() - start;
+  if (!ok)
+    adaptive_free(surface);
+  return ok;
+}
+
+float adaptive_value(const AdaptiveSurface *surface, float x, float z) {
+  int n = lattice_size(surface);
+  float u = x / surface->settings.extent * n;
+  float v = z / surface->settings.extent * n;
+  const QuadNode *node = &surface->nodes[0];
+  while (node->child >= 0) {
+    int h = node->size / 2;
+    node = &surface->nodes[node->child + (u >= node->i + h) + 2 * (v >= node->j + h)];
+  }
+  // quadrant of the 3x3 block, then bilinear inside it
+  float h = 0.5f * node->size;
+  float tx = fminf(fmaxf((u - node->i) / h, 0.0f), 2.0f);
+  float tz = fminf(fmaxf((v - node->j) / h, 0.0f), 2.0f);
+  int qx = tx >= 1.0f, qz = tz >= 1.0f;
+  tx -= qx;
+  tz -= qz;
+  const int *s = node->samples + 3 * qz + qx;
+  const float *values = surface->values;
+  float bottom = values[s[0]] * (1.0f - tx) + values[s[1]] * tx;
+  float top = values[s[3]] * (1.0f - tx) + values[s[4]] * tx;
+  return bottom * (1.0f - tz) + top * tz;
+}
+
+typedef struct {
+  const AdaptiveSurface *surface;
+  int resolution;
+  float maxHeight;
+  float *out;
+} ResampleJob;
+
+static void resample_row(void *ctx, int j, int thread) {
+  ResampleJob *job = (ResampleJob *)ctx;
+  float extent = job->surface->settings.extent;
+  float z = (j + 0.5f) / job->resolution * extent;
+  float *row = job->out + (size_t)j * job->resolution;
+  for (int i = 0; i < job->resolution; i++)
+    row[i] = adaptive_value(job->surface, (i + 0.5f) / job->resolution * extent, z) / job->maxHeight;
+}
+
+void adaptive_resample(ThreadPool *pool, const AdaptiveSurface *surface, int resolution, float maxHeight, float *out) {
+  ResampleJob job = {surface, resolution, maxHeight, out};
+  threadpool_parallel_for(pool, resolution, resample_row, &job);
+}
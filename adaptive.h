@@ -0,0 +1,63 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include "dissonance.h"
+#include "threadpool.h"
+
+// Adaptive sampling of the XZ field on a quadtree over [0, extent]^2.
+// Every node holds a 3x3 block of samples: its corners, edge midpoints and
+// centre. The error of interpolating the node from its corners alone is
+// measured at the other five, which are exactly the corners of its children:
+// a node above tolerance splits without wasting an evaluation, a node below
+// it is a leaf and interpolates its four quadrants bilinearly from all nine.
+// The smooth parts stop at coarse nodes while the creases of the narrow
+// valleys at simple ratios refine down to maxDepth. Samples are shared
+// between neighbours and evaluated once, through a compiled DissonancePlan;
+// every level is evaluated in parallel on the pool. When the x and z voices
+// are alike the field is symmetric about x = z and a sample is shared with
+// its mirror image too, like the baker only evaluates one triangle.
+
+typedef struct {
+  float extent;
+  float tolerance; // in field units
+  int minDepth;    // always split down to this level (2^minDepth nodes per side)
+  int maxDepth;    // never split below it, at most 14; the finest sample
+                   // spacing is extent / 2^(maxDepth + 1)
+} AdaptiveSettings;
+
+typedef struct {
+  int i, j, size; // corner and side on the lattice of the finest samples
+  int child;      // first of four children (i, j), (i + h, j), (i, j + h), (i + h, j + h); -1 for a leaf
+  int samples[9]; // 3x3 block, x fastest
+} QuadNode;
+
+typedef struct {
+  AdaptiveSettings settings;
+  int nodeCount, nodeCapacity;
+  QuadNode *nodes; // nodes[0] is the root
+  int sampleCount, sampleCapacity;
+  float *values;
+  long long *keys; // lattice point of every sample
+  int hashCapacity;
+  int *hash; // open addressing into samples, -1 empty
+  int symmetric; // (i, j) and (j, i) are one sample
+  int leaves;
+  int depth;      // deepest level reached
+  float maxError; // largest error measured at a leaf
+  double ms;
+} AdaptiveSurface;
+
+AdaptiveSettings adaptive_default_settings(float extent);
+
+// Returns 0 when out of memory or on bad settings.
+int adaptive_build(ThreadPool *pool, const AdaptiveSettings *settings, Voices *voices, AdaptiveSurface *surface);
+void adaptive_free(AdaptiveSurface *surface);
+
+// interpolated field value at (x, z)
+float adaptive_value(const AdaptiveSurface *surface, float x, float z);
+
+// Writes value / maxHeight at the texel centres of a resolution^2 grid, the
+// layout of the baked heightmap.
+void adaptive_resample(ThreadPool *pool, const AdaptiveSurface *surface, int resolution, float maxHeight, float *out);
+
+#endif
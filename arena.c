@@ -0,0 +1,67 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+
+struct ArenaBlock {
+  ArenaBlock *next;
+  size_t size;
+  size_t used;
+  // data follows, ARENA_ALIGN aligned
+};
+
+static size_t header_size(void) { return (sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1); }
+
+void arena_init(Arena *arena, size_t blockSize) {
+  arena->head = NULL;
+  arena->blockSize = blockSize > 0 ? blockSize : ARENA_DEFAULT_BLOCK;
+  arena->bytesUsed = 0;
+}
+
+void *arena_alloc(Arena *arena, size_t bytes) {
+  bytes = (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  ArenaBlock *block = arena->head;
+  if (!block || block->size - block->used < bytes) {
+    size_t size = bytes > arena->blockSize ? bytes : arena->blockSize;
+    block = (ArenaBlock *)malloc(header_size() + size);
+    if (!block)
+      return NULL;
+    block->size = size;
+    block->used = 0;
+    block->next = arena->head;
+    arena->head = block;
+  }
+  void *p = (char *)block + header_size() + block->used;
+  block->used += bytes;
+  arena->bytesUsed += bytes;
+  memset(p, 0, bytes);
+  return p;
+}
+
+void arena_reset(Arena *arena) {
+  // keep the newest block for reuse
+  ArenaBlock *keep = arena->head;
+  if (!keep)
+    return;
+  ArenaBlock *block = keep->next;
+  while (block) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  keep->next = NULL;
+  keep->used = 0;
+  arena->bytesUsed = 0;
+}
+
+void arena_free(Arena *arena) {
+  ArenaBlock *block = arena->head;
+  while (block) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->head = NULL;
+  arena->bytesUsed = 0;
+}
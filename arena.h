@@ -0,0 +1,25 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator over a list of blocks. Allocations are never freed one by
+// one, arena_reset invalidates all of them at once (keeping one block for
+// reuse), arena_free also returns the memory.
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+  ArenaBlock *head;
+  size_t blockSize;
+  size_t bytesUsed; // live allocations, for reporting
+} Arena;
+
+#define ARENA_DEFAULT_BLOCK (64 * 1024)
+
+void arena_init(Arena *arena, size_t blockSize);
+void *arena_alloc(Arena *arena, size_t bytes); // 16-byte aligned, zeroed, NULL when out of memory
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,297 @@
+// Headless heightmap baker: same voices and layout as the interactive tool,
+// no window or GPU needed. Writes a PFM (bottom row first, like the texture).
+//
+//   ./atlas-bake [-r resolution] [-t threads] [-s tile] [-4 ratio] [-5 ratio]
+//                [-m maxHeight] [-e exact|poly|cbw|kernel] [-a ampThreshold] [-c cutoff] [-n partials]
+//                [--direct | --reference] [--adaptive [-q tolerance]] [--minima] [--chord]
+//                [-v] out.pfm
+//
+// By default samples go through a compiled DissonancePlan; --direct uses
+// get_xz_dissonance_simd and --reference get_xz_dissonance. -c has the plan
+// skip pairs more than cutoff critical bandwidths apart (pruned.h), -n sets
+// the partials per voice to try it on large spectra. --adaptive samples
+// a quadtree down to the texel spacing instead of every texel and resamples
+// it to the grid (-q is the interpolation tolerance). --minima also
+// lists the local minima of the field, --chord runs the global search over
+// x, z, voice 4 and voice 5.
+
+#include "adaptive.h"
+#include "baker.h"
+#include "dissonance_simd.h"
+#include "chord.h"
+#include "minima.h"
+#include "paircache.h"
+#include <stdio.h>
+#include <string.h>
+
+static int write_pfm(const char *path, const float *data, int width, int height) {
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return 0;
+  // negative scale: little-endian floats
+  fprintf(f, "Pf\n%d %d\n-1.0\n", width, height);
+  size_t written = fwrite(data, sizeof(float), (size_t)width * height, f);
+  fclose(f);
+  return written == (size_t)width * height;
+}
+
+static int parse_eval_mode(const char *name) {
+  const char *names[DISS_EVAL_COUNT] = {"exact", "poly", "cbw", "kernel"};
+  for (int i = 0; i < DISS_EVAL_COUNT; i++)
+    if (!strcmp(name, names[i]))
+      return i;
+  return -1;
+}
+
+typedef struct {
+  const float *heightmap;
+  int resolution;
+} HeightmapRows;
+
+static double row_sum(void *ctx, int j) {
+  HeightmapRows *rows = (HeightmapRows *)ctx;
+  const float *row = rows->heightmap + (size_t)j * rows->resolution;
+  double sum = 0.0;
+  for (int i = 0; i < rows->resolution; i++)
+    sum += row[i];
+  return sum;
+}
+
+static void usage(void) {
+  printf("usage: atlas-bake [-r resolution] [-t threads] [--pin] [-s tile] [-4 ratio] [-5 ratio] [-m maxHeight]"
+         " [-e exact|poly|cbw|kernel] [-a ampThreshold] [-c cutoff] [-n partials] [--direct | --reference] [--no-symmetry]"
+         " [--adaptive [-q tolerance]]"
+         " [--minima] [--chord] [-v] out.pfm\n");
+}
+
+int main(int argc, char **argv) {
+  int resolution = 1200;
+  int threads = 0;
+  int pin = 0;
+  int tileSize = BAKER_DEFAULT_TILE;
+  float voice4 = 1.0f;
+  float voice5 = 1.0f;
+  float maxHeight = 1.0f;
+  int reference = 0;
+  int direct = 0;
+  float ampThreshold = 0.0f;
+  float cutoff = 0.0f;
+  int partials = DEFAULT_PARTIALS;
+  int evalMode = DISS_EVAL_POLY;
+  int symmetry = 1;
+  int adaptive = 0;
+  float tolerance = adaptive_default_settings(4.0f).tolerance;
+  int listMinima = 0;
+  int searchChord = 0;
+  int verbose = 0;
+  const char *outPath = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    int hasValue = i + 1 < argc;
+    if (!strcmp(argv[i], "-r") && hasValue)
+      resolution = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-t") && hasValue)
+      threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--pin"))
+      pin = 1;
+    else if (!strcmp(argv[i], "-s") && hasValue)
+      tileSize = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-4") && hasValue)
+      voice4 = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-5") && hasValue)
+      voice5 = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-m") && hasValue)
+      maxHeight = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-e") && hasValue)
+      evalMode = parse_eval_mode(argv[++i]);
+    else if (!strcmp(argv[i], "-a") && hasValue)
+      ampThreshold = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-c") && hasValue)
+      cutoff = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-n") && hasValue)
+      partials = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--direct"))
+      direct = 1;
+    else if (!strcmp(argv[i], "--reference"))
+      reference = 1;
+    else if (!strcmp(argv[i], "--no-symmetry"))
+      symmetry = 0;
+    else if (!strcmp(argv[i], "--adaptive"))
+      adaptive = 1;
+    else if (!strcmp(argv[i], "-q") && hasValue)
+      tolerance = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--minima"))
+      listMinima = 1;
+    else if (!strcmp(argv[i], "--chord"))
+      searchChord = 1;
+    else if (!strcmp(argv[i], "-v"))
+      verbose = 1;
+    else if (argv[i][0] != '-' && !outPath)
+      outPath = argv[i];
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (!outPath || resolution <= 0 || tileSize <= 0 || evalMode < 0 || partials <= 0 || cutoff < 0.0f) {
+    usage();
+    return 1;
+  }
+
+  dissonance_set_eval_mode(evalMode);
+
+  // same configuration as main.c
+  Arena voiceArena;
+  arena_init(&voiceArena, ARENA_DEFAULT_BLOCK);
+  Voices voices;
+  voices_init(&voices, &voiceArena, DEFAULT_VOICES, DEFAULT_VOICES * partials);
+  float base_freq = 220.0f;
+  generate_harmonic_series(&voices, base_freq, 1.0f, partials);
+  generate_harmonic_series(&voices, base_freq, 1.0f, partials);
+  generate_harmonic_series(&voices, base_freq, 1.0f, partials);
+  generate_harmonic_series(&voices, base_freq * voice4, 1.0f, partials);
+  generate_harmonic_series(&voices, base_freq * voice5, 1.0f, partials);
+  PairCache pairCache;
+  pair_cache_init(&pairCache, DISS_AMP_MIN);
+  int cached = pair_cache_sync(&pairCache, &voices) >= 0;
+  float otherVoicesDissonance = pair_cache_sum(&pairCache, 2);
+
+  float *heightmap = (float *)malloc((size_t)resolution * resolution * sizeof(float));
+  ThreadPoolSettings poolSettings = threadpool_default_settings();
+  poolSettings.threads = threads;
+  poolSettings.pin = pin;
+  threadpool_configure_shared(&poolSettings);
+  ThreadPool *pool = threadpool_shared();
+  if (!heightmap || !pool || !cached) {
+    printf("Failed to allocate baker\n");
+    return 1;
+  }
+
+  BakeSettings settings = bake_default_settings(resolution, 4.0f, maxHeight);
+  settings.tileSize = tileSize;
+  settings.kernel = reference ? BAKE_KERNEL_REFERENCE : direct ? BAKE_KERNEL_SIMD : BAKE_KERNEL_PLAN;
+  settings.ampThreshold = ampThreshold;
+  settings.cutoff = cutoff;
+  settings.symmetry = symmetry;
+
+  BakeReport report;
+  memset(&report, 0, sizeof(report));
+  if (adaptive) {
+    // the finest lattice no finer than the texels: up to twice their spacing
+    // (the last power of two that fits), never more samples per side
+    AdaptiveSettings adaptiveSettings = adaptive_default_settings(settings.extent);
+    adaptiveSettings.tolerance = tolerance;
+    adaptiveSettings.maxDepth = 0;
+    while ((4 << adaptiveSettings.maxDepth) <= resolution && adaptiveSettings.maxDepth < 14)
+      adaptiveSettings.maxDepth++;
+    if (adaptiveSettings.minDepth > adaptiveSettings.maxDepth)
+      adaptiveSettings.minDepth = adaptiveSettings.maxDepth;
+    AdaptiveSurface surface;
+    if (!adaptive_build(pool, &adaptiveSettings, &voices, &surface)) {
+      printf("Failed to build the adaptive surface\n");
+      return 1;
+    }
+    double start = threadpool_now_ms();
+    adaptive_resample(pool, &surface, resolution, maxHeight, heightmap);
+    printf("Adaptive %dx%d on %d threads: %d samples (%.1f%% of the grid), %d leaves, depth %d, tolerance %g\n",
+           resolution, resolution, threadpool_size(pool), surface.sampleCount,
+           100.0 * surface.sampleCount / ((double)resolution * resolution), surface.leaves, surface.depth, tolerance);
+    printf("Build %.1f ms, resample %.1f ms\n", surface.ms, threadpool_now_ms() - start);
+    adaptive_free(&surface);
+  } else {
+    if (!bake_heightmap_cpu(pool, &settings, &voices, otherVoicesDissonance, heightmap, &report)) {
+      printf("Failed to bake the heightmap\n");
+      return 1;
+    }
+    double minMs = report.tiles[0].ms, maxMs = report.tiles[0].ms, sumMs = 0.0;
+    for (int i = 0; i < report.tileCount; i++) {
+      BakeTileStat *tile = &report.tiles[i];
+      if (verbose)
+        printf("tile %4d  (%4d, %4d) %3dx%-3d  thread %2d  %8.3f ms\n", i, tile->x0, tile->y0, tile->width,
+               tile->height, tile->thread, tile->ms);
+      minMs = tile->ms < minMs ? tile->ms : minMs;
+      maxMs = tile->ms > maxMs ? tile->ms : maxMs;
+      sumMs += tile->ms;
+    }
+    // the sample path, then what evaluates its pair rows
+    const char *kernelNames[] = {"direct", "reference", "plan"};
+    printf("Baked %dx%d with %s kernel", resolution, resolution, kernelNames[settings.kernel]);
+    if (!reference)
+      printf(" (%s rows)", evalMode == DISS_EVAL_POLY ? dissonance_simd_isa_name(dissonance_simd_isa())
+                                                      : dissonance_eval_mode_name(evalMode));
+    printf(" on %d threads: %d tiles of %d, %.1f ms total\n", report.threads, report.tileCount, tileSize,
+           report.totalMs);
+    if (!reference)
+      printf("Eval mode: %s, max error per pair %g\n", dissonance_eval_mode_name(evalMode),
+             dissonance_eval_max_error(evalMode));
+    printf("Pairs per sample: %lld", report.pairsPerSample);
+    if (settings.kernel == BAKE_KERNEL_PLAN) {
+      printf(" (plan");
+      if (cutoff > 0.0f)
+        printf(", at most: rows visit %g critical bandwidths", cutoff);
+      printf("), dropped-partial and cutoff error bound %g", report.errorBound);
+    }
+    printf("\n");
+    printf("Tile time: min %.3f ms, mean %.3f ms, max %.3f ms\n", minMs, sumMs / report.tileCount, maxMs);
+    if (report.symmetric)
+      printf("x and z share a spectrum: baked z >= x, mirrored the rest\n");
+  }
+
+  if (listMinima) {
+    // seeded from the basins of the heightmap just baked
+    MinimaSettings minimaSettings = minima_default_settings(settings.extent);
+    MinimaResult minima;
+    MinimaBasins basins;
+    minima_basins_init(&basins);
+    DissonancePlan minimaPlan;
+    dissonance_plan_init(&minimaPlan, DISS_AMP_MIN, 0.0f);
+    double start = threadpool_now_ms();
+    if (minima_basins_build(&basins, heightmap, resolution, settings.extent, maxHeight) &&
+        dissonance_plan_compile(&minimaPlan, &voices) &&
+        find_minima(pool, &minimaSettings, &voices, &minimaPlan, &basins, &minima)) {
+      printf("Minima: %d from %d seeds of %d basins, %lld evaluations, %.1f ms (%.1f ms with the basins)\n",
+             minima.count, minima.seeds, minima.basins, minima.evaluations, minima.ms,
+             threadpool_now_ms() - start);
+      for (int i = 0; i < minima.count; i++) {
+        DissonanceMinimum *m = &minima.minima[i];
+        printf("  x %.4f z %.4f  f_x %8.2f Hz f_z %8.2f Hz  value %.5f  depth %.5f  basin %d\n", m->x, m->z, m->freqX,
+               m->freqZ, m->value, m->depth, m->basinSize);
+      }
+      minima_result_free(&minima);
+    }
+    dissonance_plan_free(&minimaPlan);
+    minima_basins_free(&basins);
+  }
+
+  if (searchChord) {
+    // the search scales voices 3 and 4 itself, start from the unscaled spectra
+    Voices unscaled;
+    voices_init(&unscaled, &voiceArena, DEFAULT_VOICES, DEFAULT_VOICES * DEFAULT_PARTIALS);
+    for (int v = 0; v < 5; v++)
+      generate_harmonic_series(&unscaled, base_freq, 1.0f, DEFAULT_PARTIALS);
+    ChordSearchSettings chordSettings = chord_default_settings();
+    ChordSearchResult chord;
+    TaskGroup chordGroup;
+    threadpool_group_init(pool, &chordGroup);
+    if (chord_search(&chordGroup, &chordSettings, &unscaled, &chord))
+      printf("Chord: x %.4f z %.4f voice4 %.4f voice5 %.4f  dissonance %.5f, bound %.5f%s\n"
+             "       %lld boxes (%lld pruned), %d hand-offs, %.1f ms\n",
+             chord.point[0], chord.point[1], chord.point[2], chord.point[3], chord.value, chord.lowerBound,
+             chord.complete ? "" : " (incomplete)", chord.boxes, chord.pruned, chord.handOffs, chord.ms);
+  }
+
+  // summed in a fixed order, the same digits for every -t
+  HeightmapRows rows = {heightmap, resolution};
+  printf("Mean height: %.17g\n", threadpool_reduce_sum(pool, resolution, row_sum, &rows) / resolution / resolution);
+
+  int ok = write_pfm(outPath, heightmap, resolution, resolution);
+  if (!ok)
+    printf("Failed to write %s\n", outPath);
+
+  bake_report_free(&report);
+  pair_cache_free(&pairCache);
+  arena_free(&voiceArena);
+  threadpool_destroy(pool);
+  free(heightmap);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+#include "baker.h"
+#include "dissonance_simd.h"
+#include <string.h>
+
+typedef struct {
+  const BakeSettings *settings;
+  Voices *voices;
+  const DissonancePlan *plan;
+  float otherVoicesDissonance;
+  float *out;
+  int tilesPerRow;
+  int symmetric;
+  int *tileOrder; // tile grid index of every job index
+  BakeTileStat *tiles;
+} BakeJob;
+
+BakeSettings bake_default_settings(int resolution, float extent, float maxHeight) {
+  BakeSettings settings = {resolution, extent, maxHeight, BAKER_DEFAULT_TILE, BAKE_KERNEL_PLAN, 0.0f, 0.0f, 1};
+  return settings;
+}
+
+static void bake_tile(void *ctx, int index, int thread) {
+  BakeJob *job = (BakeJob *)ctx;
+  const BakeSettings *s = job->settings;
+  double start = threadpool_now_ms();
+
+  int tile = job->tileOrder[index];
+  int x0 = (tile % job->tilesPerRow) * s->tileSize;
+  int y0 = (tile / job->tilesPerRow) * s->tileSize;
+  int x1 = x0 + s->tileSize < s->resolution ? x0 + s->tileSize : s->resolution;
+  int y1 = y0 + s->tileSize < s->resolution ? y0 + s->tileSize : s->resolution;
+  float scale = s->extent / s->resolution;
+
+  float xs[x1 - x0];
+  for (int i = x0; i < x1; i++)
+    xs[i - x0] = (i + 0.5f) * scale;
+
+  for (int j = y0; j < y1; j++) {
+    float z = (j + 0.5f) * scale;
+    float *row = job->out + (size_t)j * s->resolution;
+    // a diagonal tile stops at the diagonal when mirroring
+    int end = job->symmetric && j + 1 < x1 ? j + 1 : x1;
+    if (s->kernel == BAKE_KERNEL_SIMD) {
+      // one batch per tile row, z held fixed
+      if (end > x0)
+        get_xz_dissonance_batch(job->voices, xs, 1, &z, 0, end - x0, job->otherVoicesDissonance, row + x0, 1);
+      for (int i = x0; i < end; i++)
+        row[i] /= s->maxHeight;
+      continue;
+    }
+    for (int i = x0; i < end; i++) {
+      float height = job->plan ? dissonance_plan_xz(job->plan, xs[i - x0], z)
+                               : get_xz_dissonance(job->voices, xs[i - x0], z, job->otherVoicesDissonance);
+      row[i] = height / s->maxHeight;
+    }
+  }
+
+  if (job->tiles) {
+    BakeTileStat *stat = &job->tiles[index];
+    stat->x0 = x0;
+    stat->y0 = y0;
+    stat->width = x1 - x0;
+    stat->height = y1 - y0;
+    stat->thread = thread;
+    stat->ms = threadpool_now_ms() - start;
+  }
+}
+
+// texels above the diagonal of one tile row (tiles on and above it) from
+// their mirror image below
+static void mirror_row(void *ctx, int ty, int thread) {
+  BakeJob *job = (BakeJob *)ctx;
+  int n = job->settings->resolution;
+  int y0 = ty * job->settings->tileSize;
+  int y1 = y0 + job->settings->tileSize < n ? y0 + job->settings->tileSize : n;
+  for (int j = y0; j < y1; j++)
+    for (int i = j + 1; i < n; i++)
+      job->out[(size_t)j * n + i] = job->out[(size_t)i * n + j];
+}
+
+int bake_heightmap_cpu(ThreadPool *pool, const BakeSettings *settings, Voices *voices, float otherVoicesDissonance,
+                       float *out, BakeReport *report) {
+  if (settings->resolution <= 0 || settings->tileSize <= 0)
+    return 0;
+  int tilesPerRow = (settings->resolution + settings->tileSize - 1) / settings->tileSize;
+  int symmetric = settings->symmetry && voices_axis_symmetric(voices);
+  int *tileOrder = (int *)malloc(tilesPerRow * tilesPerRow * sizeof(int));
+  if (!tileOrder)
+    return 0;
+  int tileCount = 0;
+  for (int ty = 0; ty < tilesPerRow; ty++)
+    for (int tx = 0; tx < tilesPerRow; tx++)
+      if (!symmetric || tx <= ty)
+        tileOrder[tileCount++] = ty * tilesPerRow + tx;
+
+  DissonancePlan plan;
+  dissonance_plan_init(&plan, DISS_AMP_MIN, settings->ampThreshold);
+  plan.cutoff = settings->cutoff;
+  if (settings->kernel == BAKE_KERNEL_PLAN && !dissonance_plan_compile(&plan, voices)) {
+    free(tileOrder);
+    return 0;
+  }
+
+  BakeJob job = {settings, voices, NULL, otherVoicesDissonance, out, tilesPerRow, symmetric, tileOrder, NULL};
+  if (settings->kernel == BAKE_KERNEL_PLAN)
+    job.plan = &plan;
+  if (report) {
+    memset(report, 0, sizeof(*report));
+    job.tiles = (BakeTileStat *)calloc(tileCount, sizeof(BakeTileStat));
+    if (!job.tiles) {
+      dissonance_plan_free(&plan);
+      free(tileOrder);
+      return 0;
+    }
+  }
+
+  double start = threadpool_now_ms();
+  threadpool_parallel_for(pool, tileCount, bake_tile, &job);
+  if (symmetric)
+    threadpool_parallel_for(pool, tilesPerRow, mirror_row, &job);
+
+  if (report) {
+    report->tileCount = tileCount;
+    report->tiles = job.tiles;
+    report->threads = threadpool_size(pool);
+    report->symmetric = symmetric;
+    report->totalMs = threadpool_now_ms() - start;
+    if (job.plan) {
+      report->pairsPerSample = plan.pairsPlan;
+      report->errorBound = plan.errorBound;
+    } else {
+      int total = voices_partial_total(voices);
+      for (int i = 0; i < voices_axis_end(voices); i++)
+        report->pairsPerSample += total - i - 1;
+    }
+  }
+  dissonance_plan_free(&plan);
+  free(tileOrder);
+  return 1;
+}
+
+void bake_report_free(BakeReport *report) {
+  free(report->tiles);
+  report->tiles = NULL;
+  report->tileCount = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef BAKER_H
+#define BAKER_H
+
+#include "dissonance.h"
+#include "plan.h"
+#include "threadpool.h"
+
+// CPU heightmap baker. The output matches the float texture written by
+// baking.fs: row j holds z = (j + 0.5) / resolution * extent (row 0 is the
+// bottom row of the framebuffer, the first row in memory), column i holds x
+// the same way, and every value is divided by maxHeight.
+//
+// When the x and z voices share a spectrum the field is symmetric about
+// x = z and the texel grid with it: only the tiles on and below the diagonal
+// (row >= column) are evaluated, the texels above it are copied from their
+// mirror image afterwards.
+
+#define BAKER_DEFAULT_TILE 64 // 64 x 64 floats = 16 KiB, stays in L1
+
+typedef enum {
+  BAKE_KERNEL_SIMD = 0,  // get_xz_dissonance_simd
+  BAKE_KERNEL_REFERENCE, // get_xz_dissonance, for comparisons
+  BAKE_KERNEL_PLAN       // dissonance_plan_xz, compiled once per bake
+} BakeKernel;
+
+typedef struct {
+  int x0, y0, width, height;
+  int thread;
+  double ms;
+} BakeTileStat;
+
+typedef struct {
+  int resolution;
+  float extent;
+  float maxHeight;
+  int tileSize;
+  BakeKernel kernel;
+  float ampThreshold; // BAKE_KERNEL_PLAN drops partials below this
+  float cutoff;       // BAKE_KERNEL_PLAN skips pairs past this many critical bandwidths, 0 keeps all
+  int symmetry;       // mirror about x = z when the x and z voices share a spectrum
+} BakeSettings;
+
+typedef struct {
+  int tileCount;
+  BakeTileStat *tiles; // tileCount entries, the tiles that were evaluated
+  int symmetric;       // only the triangle z >= x was evaluated, the rest mirrored
+  int threads;
+  double totalMs;
+  long long pairsPerSample;
+  float errorBound; // from dropped partials and skipped pairs, BAKE_KERNEL_PLAN only
+} BakeReport;
+
+BakeSettings bake_default_settings(int resolution, float extent, float maxHeight);
+
+// Bakes resolution * resolution floats into out. pool may be NULL to run on
+// the calling thread. report may be NULL, otherwise free it with
+// bake_report_free.
+int bake_heightmap_cpu(ThreadPool *pool, const BakeSettings *settings, Voices *voices, float otherVoicesDissonance,
+                       float *out, BakeReport *report);
+void bake_report_free(BakeReport *report);
+
+#endif
@@ -3,13 +3,32 @@
 out vec4 finalColor;
 
 // Uniforms for the dissonance calculation
-uniform int numVoices;
-uniform int numPartials;
+// Voices.offsets[1], offsets[2] and offsets[count]: the x voice owns partials
+// [0, .x), the z voice [.x, .y), the fixed voices [.y, .z).
+uniform ivec3 partialOffsets;
 uniform float otherVoicesDissonance;
-uniform float voiceFreqs[32];
-uniform float voiceAmplitudes[32];
+// The packed partials in SPECTRUM_WIDTH texels per row: .r frequency, .g
+// amplitude. A texture instead of a uniform array, so any count fits.
+uniform sampler2D spectrum;
 uniform vec4 viewInts; // We get screen width/height from this
 uniform float maxHeight;
+uniform int bakeTerm; // BAKE_FULL or BAKE_CROSS
+uniform int evalMode; // DissEvalMode in dissonance_simd.h
+uniform int lowerTriangle; // BAKE_CROSS with one spectrum on both axes: only x <= z, compose mirrors the rest
+uniform sampler2D cbwLut;    // CBW_LUT_SIZE x 1
+uniform sampler2D kernelLut; // KERNEL_LUT_DIFFS x KERNEL_LUT_FREQS
+
+const int BAKE_FULL = 0;
+const int BAKE_CROSS = 1;
+const int SPECTRUM_WIDTH = 256; // SPECTRUM_TEXTURE_WIDTH in main.c
+
+// Must match dissonance_lut.h
+const int EVAL_CBW_LUT = 2;
+const int EVAL_KERNEL_LUT = 3;
+const float LUT_FREQ_MAX = 8192.0;
+const float KERNEL_LUT_DIFF_MAX = 9.0;
+const float KERNEL_LUT_NORM_BASE = 100.0;
+const float KERNEL_LUT_NORM_SLOPE = 0.14;
 
 // The size of the surface in world coordinates
 const float SURFACE_WIDTH = 4.0;
@@ -19,38 +38,118 @@ const float SURFACE_HEIGHT = 4.0;
 /*                  Dissonance Calculation Functions                            */
 /* ============================================================================ */
 
-float pairwiseDissonance(float f1, float a1, float f2, float a2) {
-    if (a1 == 0.0 || a2 == 0.0) return 0.0;
+// Table entries sit on the grid points 0..size-1, texel centers are at +0.5
+vec2 lutCoord(vec2 t, sampler2D lut) {
+    vec2 size = vec2(textureSize(lut, 0));
+    return (t * (size - 1.0) + 0.5) / size;
+}
+
+// Exact pair term and its derivatives with respect to f1 and f2 in one go:
+// (value, d/df1, d/df2); the chain rule to x and z is left to the caller.
+// Same algebra as pair_derivs_scalar in dissonance_simd.c.
+vec3 pairwiseDissonanceGrad(float f1, float a1, float f2, float a2) {
     float s1 = 3.5;
     float s2 = 5.75;
-    float f_min = min(f1, f2);
-    float f_max = max(f1, f2);
-    float cbw = 25.0 + 75.0 * pow(1.0 + 1.4 * pow(f_min / 1000.0, 2.0), 0.69);
-    if (cbw == 0.0) return 0.0;
-    float f_diff_norm = (f_max - f_min) / cbw;
-    return min(a1, a2) * (exp(-s1 * f_diff_norm) - exp(-s2 * f_diff_norm));
+    float lo = min(f1, f2);
+    float hi = max(f1, f2);
+    float q = 1.0 + 1.4e-6 * lo * lo;
+    float qp = pow(q, 0.69);
+    float cbw = 25.0 + 75.0 * qp;
+    float dcbw = 75.0 * 0.69 * 2.8e-6 * qp / q * lo;
+    float d = (hi - lo) / cbw;
+    float ea = exp(-s1 * d);
+    float eb = exp(-s2 * d);
+    float w = min(a1, a2);
+    float slope = w * (-s1 * ea + s2 * eb);
+    float dLo = -slope * (1.0 + d * dcbw) / cbw;
+    float dHi = slope / cbw;
+    return f1 < f2 ? vec3(w * (ea - eb), dLo, dHi) : vec3(w * (ea - eb), dHi, dLo);
 }
 
-float getDissonanceAt(float x, float z) {
-    float totalDissonance = 0.0;
-    float coeff1;
-    float coeff2;
-
-    for (int i = 0; i < 2 * numPartials; i++) {
-      if (i / numPartials == 0) {coeff1 = x;}
-      else if (i / numPartials == 1) {coeff1 = z;}
-      else {coeff1 = 1.0;}
-      for (int j = i + 1; j < numVoices * numPartials;j++) {
-        if (j / numPartials == 0) {coeff2 = x;}
-        else if (j / numPartials == 1) {coeff2 = z;}
-        else {coeff2 = 1.0;}
-        totalDissonance += pairwiseDissonance(
-            voiceFreqs[i] * coeff1, voiceAmplitudes[i],
-            voiceFreqs[j] * coeff2, voiceAmplitudes[j]
-      );
+// The pair term in the current eval mode, same layout. The tables carry no
+// derivatives, the LUT modes take them as forward differences over one table
+// step: an extra fetch for the cbw table, two for the kernel table, and never
+// the pow of the exact term.
+vec3 pairwiseDissonanceEval(float f1, float a1, float f2, float a2) {
+    float lo = min(f1, f2);
+    float hi = max(f1, f2);
+    if (evalMode < EVAL_CBW_LUT || lo >= LUT_FREQ_MAX)
+        return pairwiseDissonanceGrad(f1, a1, f2, a2);
+    float w = min(a1, a2);
+    float value, dLo, dHi;
+    if (evalMode == EVAL_KERNEL_LUT) {
+        float norm = KERNEL_LUT_NORM_BASE + KERNEL_LUT_NORM_SLOPE * lo;
+        float y = (hi - lo) / norm;
+        if (y >= KERNEL_LUT_DIFF_MAX) return vec3(0.0);
+        vec2 t = vec2(y / KERNEL_LUT_DIFF_MAX, lo / LUT_FREQ_MAX);
+        vec2 step = 1.0 / (vec2(textureSize(kernelLut, 0)) - 1.0);
+        float k = texture(kernelLut, lutCoord(t, kernelLut)).r;
+        float dy = (texture(kernelLut, lutCoord(t + vec2(step.x, 0.0), kernelLut)).r - k) / (step.x * KERNEL_LUT_DIFF_MAX);
+        float df = (texture(kernelLut, lutCoord(t + vec2(0.0, step.y), kernelLut)).r - k) / (step.y * LUT_FREQ_MAX);
+        // y = (hi - lo) / norm, and norm grows with lo
+        value = w * k;
+        dHi = w * dy / norm;
+        dLo = w * (df - dy * (1.0 + KERNEL_LUT_NORM_SLOPE * y) / norm);
+    } else {
+        float s1 = 3.5;
+        float s2 = 5.75;
+        float step = 1.0 / (float(textureSize(cbwLut, 0).x) - 1.0);
+        float t = lo / LUT_FREQ_MAX;
+        float cbw = texture(cbwLut, lutCoord(vec2(t, 0.0), cbwLut)).r;
+        float dcbw = (texture(cbwLut, lutCoord(vec2(t + step, 0.0), cbwLut)).r - cbw) / (step * LUT_FREQ_MAX);
+        float d = (hi - lo) / cbw;
+        float ea = exp(-s1 * d);
+        float eb = exp(-s2 * d);
+        float slope = w * (-s1 * ea + s2 * eb);
+        value = w * (ea - eb);
+        dLo = -slope * (1.0 + d * dcbw) / cbw;
+        dHi = slope / cbw;
+    }
+    return f1 < f2 ? vec3(value, dLo, dHi) : vec3(value, dHi, dLo);
+}
+
+vec2 getPartial(int index) {
+    return texelFetch(spectrum, ivec2(index % SPECTRUM_WIDTH, index / SPECTRUM_WIDTH), 0).rg;
+}
+
+// (height, d/dx, d/dz) of the full field
+vec3 getDissonanceAt(float x, float z) {
+    vec3 total = vec3(0.0);
+    for (int i = 0; i < partialOffsets.y; i++) {
+      bool iOnX = i < partialOffsets.x;
+      vec2 p1 = getPartial(i);
+      float f1 = p1.x * (iOnX ? x : z);
+      for (int j = i + 1; j < partialOffsets.z; j++) {
+        vec2 p2 = getPartial(j);
+        float coeff2 = 1.0;
+        if (j < partialOffsets.x) {coeff2 = x;}
+        else if (j < partialOffsets.y) {coeff2 = z;}
+        float f2 = p2.x * coeff2;
+        vec3 g = pairwiseDissonanceEval(f1, p1.y, f2, p2.y);
+        total.x += g.x;
+        // d f / d coeff is the base frequency, for the axis the partial is on
+        if (iOnX) total.y += g.y * p1.x; else total.z += g.y * p1.x;
+        if (j < partialOffsets.x) total.y += g.z * p2.x;
+        else if (j < partialOffsets.y) total.z += g.z * p2.x;
       }
     }
-    return totalDissonance + otherVoicesDissonance;
+    return total + vec3(otherVoicesDissonance, 0.0, 0.0);
+}
+
+// Only the x voice vs z voice pairs, the 2D part of the separable field, with
+// its derivatives. The 1D curves and the constant offset are added in
+// compose.fs.
+vec3 getCrossDissonanceAt(float x, float z) {
+    vec3 total = vec3(0.0);
+    for (int i = 0; i < partialOffsets.x; i++) {
+      vec2 p1 = getPartial(i);
+      for (int j = partialOffsets.x; j < partialOffsets.y; j++) {
+        vec2 p2 = getPartial(j);
+        vec3 g = pairwiseDissonanceEval(p1.x * x, p1.y, p2.x * z, p2.y);
+        total += vec3(g.x, g.y * p1.x, g.z * p2.x);
+      }
+    }
+    return total;
 }
 
 /* ============================================================================ */
@@ -60,9 +159,17 @@ void main() {
     // Convert fragment coordinate to world coordinate (x, z)
     vec2 worldCoord = gl_FragCoord.xy / vec2(viewInts.z, viewInts.w) * vec2(SURFACE_WIDTH, SURFACE_HEIGHT);
 
-    // Calculate the dissonance (height) at this point
-    float height = getDissonanceAt(worldCoord.x, worldCoord.y);
+    if (bakeTerm == BAKE_CROSS) {
+        if (lowerTriangle != 0 && gl_FragCoord.x > gl_FragCoord.y)
+            discard;
+        // Raw, unnormalized cross term and its gradient
+        finalColor = vec4(getCrossDissonanceAt(worldCoord.x, worldCoord.y), 1.0);
+        return;
+    }
+
+    // Calculate the dissonance (height) and its gradient at this point
+    vec3 height = getDissonanceAt(worldCoord.x, worldCoord.y);
 
-    // Output the normalized height to the red channel.
-    finalColor = vec4(height / maxHeight, 0.0, 0.0, 1.0);
+    // Normalized height in red, its x / z derivatives in green / blue
+    finalColor = vec4(height / maxHeight, 1.0);
 }
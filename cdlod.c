@@ -0,0 +1,199 @@
+#include "cdlod.h"
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+int cdlod_init(Cdlod *lod, float worldSize, int patchQuads, int heightmapResolution) {
+  memset(lod, 0, sizeof(*lod));
+  lod->worldSize = worldSize;
+  lod->patchQuads = patchQuads;
+  int levels = 1;
+  while ((1 << (levels - 1)) * patchQuads < heightmapResolution && levels <= CDLOD_MAX_LEVELS)
+    levels++;
+  if (patchQuads < 1 || levels > CDLOD_MAX_LEVELS)
+    return 0;
+  lod->levels = levels;
+  int ok = 1;
+  for (int level = 0; level < levels; level++) {
+    int side = 1 << (levels - 1 - level);
+    lod->sides[level] = side;
+    lod->bounds[level] = (float *)calloc(2 * (size_t)side * side, sizeof(float));
+    ok = ok && lod->bounds[level];
+  }
+  // the finest nodes tile the plane, no selection has more
+  lod->capacity = lod->sides[0] * lod->sides[0];
+  lod->nodes = (CdlodNode *)malloc(lod->capacity * sizeof(CdlodNode));
+  ok = ok && lod->nodes;
+  if (!ok)
+    cdlod_free(lod);
+  return ok;
+}
+
+void cdlod_free(Cdlod *lod) {
+  for (int level = 0; level < lod->levels; level++)
+    free(lod->bounds[level]);
+  free(lod->nodes);
+  memset(lod, 0, sizeof(*lod));
+}
+
+// Texels GL_LINEAR reads anywhere in texture coordinates [s0, s1] along one
+// axis, clamped to the edge
+static void texel_span(float s0, float s1, int resolution, int *lo, int *hi) {
+  int first = (int)floorf(s0 * resolution - 0.5f);
+  int last = (int)ceilf(s1 * resolution - 0.5f);
+  *lo = first < 0 ? 0 : first >= resolution ? resolution - 1 : first;
+  *hi = last < 0 ? 0 : last >= resolution ? resolution - 1 : last;
+}
+
+void cdlod_build_bounds(Cdlod *lod, const float *texels, int resolution) {
+  // level 0 from the texels under each node: the filtered surface never
+  // leaves their range
+  int side = lod->sides[0];
+  float *bounds = lod->bounds[0];
+  for (int j = 0; j < side; j++) {
+    int z0, z1;
+    texel_span((float)j / side, (float)(j + 1) / side, resolution, &z0, &z1);
+    for (int i = 0; i < side; i++) {
+      int x0, x1;
+      texel_span((float)i / side, (float)(i + 1) / side, resolution, &x0, &x1);
+      float low = texels[(size_t)z0 * resolution + x0], high = low;
+      for (int z = z0; z <= z1; z++) {
+        const float *row = texels + (size_t)z * resolution;
+        for (int x = x0; x <= x1; x++) {
+          low = row[x] < low ? row[x] : low;
+          high = row[x] > high ? row[x] : high;
+        }
+      }
+      bounds[2 * (j * side + i)] = low;
+      bounds[2 * (j * side + i) + 1] = high;
+    }
+  }
+  // every level above from its four children
+  for (int level = 1; level < lod->levels; level++) {
+    int parentSide = lod->sides[level], childSide = lod->sides[level - 1];
+    const float *children = lod->bounds[level - 1];
+    float *parents = lod->bounds[level];
+    for (int j = 0; j < parentSide; j++) {
+      for (int i = 0; i < parentSide; i++) {
+        const float *a = children + 2 * (2 * j * childSide + 2 * i);
+        const float *b = a + 2 * childSide;
+        float low = a[0] < a[2] ? a[0] : a[2];
+        low = b[0] < low ? b[0] : low;
+        low = b[2] < low ? b[2] : low;
+        float high = a[1] > a[3] ? a[1] : a[3];
+        high = b[1] > high ? b[1] : high;
+        high = b[3] > high ? b[3] : high;
+        parents[2 * (j * parentSide + i)] = low;
+        parents[2 * (j * parentSide + i) + 1] = high;
+      }
+    }
+  }
+  lod->valid = 1;
+}
+
+typedef struct {
+  Cdlod *lod;
+  float planes[6][4];
+  float camera[3];
+  float ranges[CDLOD_MAX_LEVELS];
+} Selection;
+
+// Node (i, j) of a level as a box, heights from the bounds once built
+static void node_box(const Cdlod *lod, int level, int i, int j, float min[3], float max[3]) {
+  float size = lod->worldSize / lod->sides[level];
+  min[0] = -0.5f * lod->worldSize + i * size;
+  min[2] = -0.5f * lod->worldSize + j * size;
+  max[0] = min[0] + size;
+  max[2] = min[2] + size;
+  const float *bounds = lod->bounds[level] + 2 * (j * lod->sides[level] + i);
+  min[1] = lod->valid ? bounds[0] : 0.0f;
+  max[1] = lod->valid ? bounds[1] : 0.0f;
+}
+
+static float box_distance2(const float point[3], const float min[3], const float max[3]) {
+  float distance2 = 0.0f;
+  for (int axis = 0; axis < 3; axis++) {
+    float d = point[axis] < min[axis] ? min[axis] - point[axis] : point[axis] > max[axis] ? point[axis] - max[axis] : 0.0f;
+    distance2 += d * d;
+  }
+  return distance2;
+}
+
+// True when the box is wholly behind one of the planes. Until the bounds are
+// built the heights are unknown and nothing is culled.
+static int box_culled(const Selection *selection, const float min[3], const float max[3]) {
+  if (!selection->lod->valid)
+    return 0;
+  for (int p = 0; p < 6; p++) {
+    const float *plane = selection->planes[p];
+    // the corner furthest along the plane's normal
+    float x = plane[0] > 0.0f ? max[0] : min[0];
+    float y = plane[1] > 0.0f ? max[1] : min[1];
+    float z = plane[2] > 0.0f ? max[2] : min[2];
+    if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0.0f)
+      return 1;
+  }
+  return 0;
+}
+
+static void add_node(Cdlod *lod, int level, int i, int j) {
+  float size = lod->worldSize / lod->sides[level];
+  CdlodNode *node = &lod->nodes[lod->count++];
+  node->x = -0.5f * lod->worldSize + i * size;
+  node->z = -0.5f * lod->worldSize + j * size;
+  node->size = size;
+  node->level = (float)level;
+}
+
+// Returns 0 when the node is beyond its level's range: the parent then draws
+// the area at the coarser level. Culled nodes count as handled.
+static int select_node(Selection *selection, int level, int i, int j) {
+  Cdlod *lod = selection->lod;
+  float min[3], max[3];
+  node_box(lod, level, i, j, min, max);
+  if (box_culled(selection, min, max))
+    return 1;
+  float distance2 = box_distance2(selection->camera, min, max);
+  if (distance2 > selection->ranges[level] * selection->ranges[level])
+    return 0;
+  if (level == 0 || distance2 > selection->ranges[level - 1] * selection->ranges[level - 1]) {
+    add_node(lod, level, i, j);
+    return 1;
+  }
+  // children nearest first: the one on the camera's side of each midline
+  float midX = 0.5f * (min[0] + max[0]), midZ = 0.5f * (min[2] + max[2]);
+  int nearX = selection->camera[0] > midX, nearZ = selection->camera[2] > midZ;
+  for (int child = 0; child < 4; child++) {
+    int ci = 2 * i + ((child & 1) ^ nearX);
+    int cj = 2 * j + ((child >> 1) ^ nearZ);
+    if (!select_node(selection, level - 1, ci, cj))
+      add_node(lod, level - 1, ci, cj);
+  }
+  return 1;
+}
+
+int cdlod_select(Cdlod *lod, const float clip[16], const float cameraPosition[3], float projectionScale,
+                 float pixelError) {
+  Selection selection;
+  selection.lod = lod;
+  memcpy(selection.camera, cameraPosition, sizeof(selection.camera));
+  // frustum planes from the rows of the clip matrix, inside is positive
+  for (int p = 0; p < 6; p++) {
+    int row = p / 2;
+    float sign = p % 2 ? -1.0f : 1.0f;
+    for (int k = 0; k < 4; k++)
+      selection.planes[p][k] = clip[4 * k + 3] + sign * clip[4 * k + row];
+  }
+  for (int level = 0; level < lod->levels; level++) {
+    float quad = lod->worldSize / (lod->sides[level] * lod->patchQuads);
+    // the root is drawn at any distance
+    float range = level == lod->levels - 1 ? FLT_MAX : quad * projectionScale / pixelError;
+    selection.ranges[level] = range;
+    lod->morphRanges[2 * level] = CDLOD_MORPH_START * range;
+    lod->morphRanges[2 * level + 1] = range;
+  }
+  lod->count = 0;
+  select_node(&selection, lod->levels - 1, 0, 0);
+  return lod->count;
+}
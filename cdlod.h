@@ -0,0 +1,62 @@
+#ifndef CDLOD_H
+#define CDLOD_H
+
+// Continuous distance-dependent level of detail for the terrain.
+//
+// A quadtree over [-worldSize / 2, worldSize / 2] in x and z: the root covers
+// the whole plane and every level below halves the node side, down to level
+// 0 whose quads are no wider than a heightmap texel. Every node is drawn as
+// the same patch of patchQuads^2 quads, so the quad size doubles per level.
+//
+// Selection walks the tree from the root each frame. A node is drawn whole
+// once it lies beyond the range of the level below; the range of a level is
+// the distance at which one of its quads shrinks to pixelError pixels, so
+// the triangle count follows the screen and not the heightmap resolution.
+// Nodes outside the view frustum are dropped with everything under them,
+// bounded in height by the heightmap texels their surface is filtered from.
+//
+// Within the last part of its range a node's vertices morph towards the
+// grid of the level above, in terrain.vs, so the two meet without cracks
+// where they touch and nothing pops when a node changes level.
+
+#define CDLOD_MAX_LEVELS 12 // terrain.vs sizes its morph ranges by this
+#define CDLOD_MORPH_START 0.7f // share of a level's range before morphing starts
+
+// One selected node, as uploaded per instance
+typedef struct {
+  float x, z;  // min corner, world
+  float size;  // side, world
+  float level; // 0 finest
+} CdlodNode;
+
+typedef struct {
+  float worldSize;
+  int patchQuads;
+  int levels;
+  int valid;                       // bounds built at least once
+  int sides[CDLOD_MAX_LEVELS];     // nodes per side, 1 at the root
+  float *bounds[CDLOD_MAX_LEVELS]; // min, max height per node, row j = z
+  // per level, from the last selection: morph start and end distance
+  float morphRanges[2 * CDLOD_MAX_LEVELS];
+  CdlodNode *nodes; // selected, roughly nearest first
+  int count;
+  int capacity;
+} Cdlod;
+
+// Enough levels that the finest quads are at most one texel of a
+// heightmapResolution^2 heightmap. Returns 0 when out of memory or past
+// CDLOD_MAX_LEVELS.
+int cdlod_init(Cdlod *lod, float worldSize, int patchQuads, int heightmapResolution);
+void cdlod_free(Cdlod *lod);
+
+// texels: resolution^2 rendered heights, row j = z, as read back from the
+// heightmap's red channel.
+void cdlod_build_bounds(Cdlod *lod, const float *texels, int resolution);
+
+// Fills nodes for a camera at cameraPosition. clip: the column-major
+// model-view-projection matrix; projectionScale: pixels per world unit at
+// distance 1, the screen height / (2 tan(fovy / 2)). Returns the count.
+int cdlod_select(Cdlod *lod, const float clip[16], const float cameraPosition[3], float projectionScale,
+                 float pixelError);
+
+#endif
@@ -0,0 +1,462 @@
+#include "chord.h"
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+#define CHORD_TASK_BUDGET 512 // boxes a task bounds before it hands off the rest
+
+typedef struct {
+  float freq;
+  int dim; // coordinate that scales it, -1 for a fixed voice
+} ChordPartial;
+
+typedef struct {
+  int i, j; // i has the lower base frequency
+  float weight;
+} ChordPair;
+
+typedef struct {
+  float lo[CHORD_MAX_DIMS], hi[CHORD_MAX_DIMS];
+  float bound; // of the parent until the box is bounded itself
+} ChordBox;
+
+typedef struct ChordBatch ChordBatch;
+
+typedef struct {
+  ChordBox *stack;
+  int stackCapacity;
+  ChordBatch *batches; // handed off from this slot, freed at the end
+  float bestValue;
+  float bestPoint[CHORD_MAX_DIMS];
+  float closedBound; // lowest bound of a pruned or finished box
+  float openBound;   // lowest parent bound of a box left when maxBoxes ran out
+  long long boxes, pruned;
+  int failed;
+} ChordThread;
+
+typedef struct {
+  const ChordSearchSettings *settings;
+  TaskGroup *group;
+  int handOff; // more than one thread to share the boxes with
+  int partialCount;
+  ChordPartial *partials;
+  int pairCount;
+  ChordPair *pairs;
+  float constant; // pairs between fixed partials
+  ChordThread *threads;
+  unsigned int bestBits; // shared best value; dissonance is >= 0, so the bits order like the floats
+  long long boxes;       // bounded so far over all threads
+  int exhausted;         // maxBoxes ran out
+} ChordJob;
+
+// boxes searched as one loop of the group, a task each
+struct ChordBatch {
+  ChordBatch *next;
+  ChordJob *job;
+  ChordBox boxes[];
+};
+
+ChordSearchSettings chord_default_settings(void) {
+  ChordSearchSettings settings = {4, {0, 1, 3, 4}, {0.5f, 0.5f, 0.5f, 0.5f}, {4.0f, 4.0f, 4.0f, 4.0f},
+                                  1e-3f, 1e-4f, 50000000};
+  return settings;
+}
+
+static float critical_bandwidth(float f) { return 25.0f + 75.0f * powf(1.0f + 1.4e-6f * f * f, 0.69f); }
+
+static float plomp_curve(float d) { return expf(-PLOMP_A * d) - expf(-PLOMP_B * d); }
+
+// lowest value of the curve over [dlo, dhi]: it rises up to its single peak
+// and falls after, so the minimum is at one of the ends
+static float plomp_curve_min(float dlo, float dhi) {
+  const float peak = logf(PLOMP_B / PLOMP_A) / (PLOMP_B - PLOMP_A);
+  if (dlo <= 0.0f)
+    return 0.0f;
+  if (dlo >= peak)
+    return plomp_curve(dhi);
+  if (dhi <= peak)
+    return plomp_curve(dlo);
+  return fminf(plomp_curve(dlo), plomp_curve(dhi));
+}
+
+static int coordinate_of(const ChordSearchSettings *settings, int voice) {
+  for (int k = 0; k < settings->dims; k++)
+    if (settings->voices[k] == voice)
+      return k;
+  return -1;
+}
+
+static int build_problem(ChordJob *job, const Voices *voices) {
+  int total = voices_partial_total(voices);
+  job->partialCount = total;
+  job->partials = (ChordPartial *)malloc((total > 0 ? total : 1) * sizeof(ChordPartial));
+  job->pairs = (ChordPair *)malloc(((size_t)total * total / 2 + 1) * sizeof(ChordPair));
+  if (!job->partials || !job->pairs)
+    return 0;
+  for (int v = 0; v < voices->count; v++) {
+    int dim = coordinate_of(job->settings, v);
+    for (int p = voices->offsets[v]; p < voices->offsets[v + 1]; p++) {
+      job->partials[p].freq = voices->freqs[p];
+      job->partials[p].dim = dim;
+    }
+  }
+
+  job->pairCount = 0;
+  job->constant = 0.0f;
+  for (int i = 0; i < total; i++) {
+    for (int j = i + 1; j < total; j++) {
+      float weight = fminf(voices->amps[i], voices->amps[j]);
+      if (weight <= 0.0f)
+        continue;
+      ChordPartial *a = &job->partials[i], *b = &job->partials[j];
+      if (a->dim < 0 && b->dim < 0) {
+        job->constant += pairwise_dissonance(a->freq, weight, b->freq, weight);
+        continue;
+      }
+      ChordPair pair = {a->freq <= b->freq ? i : j, a->freq <= b->freq ? j : i, weight};
+      job->pairs[job->pairCount++] = pair;
+    }
+  }
+  return 1;
+}
+
+static float evaluate(const ChordJob *job, const float *point) {
+  float sum = job->constant;
+  for (int k = 0; k < job->pairCount; k++) {
+    const ChordPair *pair = &job->pairs[k];
+    const ChordPartial *a = &job->partials[pair->i], *b = &job->partials[pair->j];
+    float fa = a->freq * (a->dim >= 0 ? point[a->dim] : 1.0f);
+    float fb = b->freq * (b->dim >= 0 ? point[b->dim] : 1.0f);
+    float lo = fminf(fa, fb);
+    sum += pair->weight * plomp_curve(fabsf(fb - fa) / critical_bandwidth(lo));
+  }
+  return sum;
+}
+
+// Lower bound of the total over the box. Stops once the sum reaches cutoff,
+// the partial sum is still a bound.
+static float lower_bound(const ChordJob *job, const ChordBox *box, float cutoff) {
+  int n = job->partialCount;
+  float flo[n > 0 ? n : 1], fhi[n > 0 ? n : 1], cbwLo[n > 0 ? n : 1], cbwHi[n > 0 ? n : 1];
+  for (int p = 0; p < n; p++) {
+    const ChordPartial *partial = &job->partials[p];
+    flo[p] = partial->freq * (partial->dim >= 0 ? box->lo[partial->dim] : 1.0f);
+    fhi[p] = partial->freq * (partial->dim >= 0 ? box->hi[partial->dim] : 1.0f);
+    // the bandwidth grows with frequency
+    cbwLo[p] = critical_bandwidth(flo[p]);
+    cbwHi[p] = critical_bandwidth(fhi[p]);
+  }
+
+  float sum = job->constant;
+  for (int k = 0; k < job->pairCount && sum < cutoff; k++) {
+    const ChordPair *pair = &job->pairs[k];
+    int i = pair->i, j = pair->j;
+    float dlo, dhi;
+    if (job->partials[i].dim == job->partials[j].dim) {
+      // one scale s for both: d = (fj - fi) s / cbw(fi s), i is the lower one
+      float spread = job->partials[j].freq - job->partials[i].freq;
+      float s = job->partials[i].freq > 0.0f ? flo[i] / job->partials[i].freq : 0.0f;
+      float t = job->partials[i].freq > 0.0f ? fhi[i] / job->partials[i].freq : 0.0f;
+      dlo = spread * s / cbwHi[i];
+      dhi = spread * t / cbwLo[i];
+    } else {
+      // the lower of the two frequencies sets the bandwidth
+      float gapLo = fmaxf(0.0f, fmaxf(flo[j] - fhi[i], flo[i] - fhi[j]));
+      float gapHi = fmaxf(fhi[j] - flo[i], fhi[i] - flo[j]);
+      dlo = gapLo / fminf(cbwHi[i], cbwHi[j]);
+      dhi = gapHi / fminf(cbwLo[i], cbwLo[j]);
+    }
+    sum += pair->weight * plomp_curve_min(dlo, dhi);
+  }
+  return sum;
+}
+
+static int push(ChordBox **items, int *count, int *capacity, const ChordBox *box) {
+  if (*count == *capacity) {
+    int grown = *capacity > 0 ? 2 * *capacity : 64;
+    ChordBox *moved = (ChordBox *)realloc(*items, grown * sizeof(ChordBox));
+    if (!moved)
+      return 0;
+    *items = moved;
+    *capacity = grown;
+  }
+  (*items)[(*count)++] = *box;
+  return 1;
+}
+
+static float shared_best(ChordJob *job) {
+  unsigned int bits = __atomic_load_n(&job->bestBits, __ATOMIC_RELAXED);
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static void offer_best(ChordJob *job, float value) {
+  unsigned int bits;
+  memcpy(&bits, &value, sizeof(bits));
+  unsigned int seen = __atomic_load_n(&job->bestBits, __ATOMIC_RELAXED);
+  while (bits < seen && !__atomic_compare_exchange_n(&job->bestBits, &seen, bits, 1, __ATOMIC_RELAXED,
+                                                     __ATOMIC_RELAXED)) {
+  }
+}
+
+static void search_batch(void *ctx, int index, int thread);
+
+// Hands the whole stack to the group as a loop of its own, top first so the
+// thread that picks it up goes on depth first while idle threads steal the
+// widest boxes from the far end. Returns 0 when the task has to keep them.
+static int hand_off(ChordJob *job, ChordThread *state, int depth) {
+  // a single box would run right here, nested
+  if (depth < 2)
+    return 0;
+  ChordBatch *batch = (ChordBatch *)malloc(sizeof(ChordBatch) + depth * sizeof(ChordBox));
+  if (!batch)
+    return 0;
+  batch->job = job;
+  for (int k = 0; k < depth; k++)
+    batch->boxes[k] = state->stack[depth - 1 - k];
+  batch->next = state->batches;
+  state->batches = batch;
+  threadpool_group_run(job->group, depth, search_batch, batch);
+  return 1;
+}
+
+// depth first from one box of a batch
+static void search_batch(void *ctx, int index, int thread) {
+  ChordBatch *batch = (ChordBatch *)ctx;
+  ChordJob *job = batch->job;
+  const ChordSearchSettings *s = job->settings;
+  ChordThread *state = &job->threads[thread];
+  int depth = 0;
+  if (!push(&state->stack, &depth, &state->stackCapacity, &batch->boxes[index])) {
+    state->failed = 1;
+    return;
+  }
+
+  for (int budget = CHORD_TASK_BUDGET; depth > 0; budget--) {
+    if (threadpool_group_cancelled(job->group))
+      return;
+    if (__atomic_load_n(&job->boxes, __ATOMIC_RELAXED) >= s->maxBoxes) {
+      // the boxes still open only have their parent's bound
+      __atomic_store_n(&job->exhausted, 1, __ATOMIC_RELAXED);
+      for (int i = 0; i < depth; i++)
+        state->openBound = fminf(state->openBound, state->stack[i].bound);
+      return;
+    }
+    // a task ends after its budget, so the workers turn over and other
+    // loops on the pool get their turn
+    if (budget == 0) {
+      budget = CHORD_TASK_BUDGET;
+      if (job->handOff && hand_off(job, state, depth))
+        return;
+    }
+    ChordBox box = state->stack[--depth];
+    float cutoff = shared_best(job) - s->gap;
+    box.bound = lower_bound(job, &box, cutoff);
+    state->boxes++;
+    __atomic_add_fetch(&job->boxes, 1, __ATOMIC_RELAXED);
+    if (box.bound >= cutoff) {
+      state->pruned++;
+      state->closedBound = fminf(state->closedBound, box.bound);
+      continue;
+    }
+
+    float center[CHORD_MAX_DIMS] = {0};
+    int widest = 0;
+    for (int k = 0; k < s->dims; k++) {
+      center[k] = 0.5f * (box.lo[k] + box.hi[k]);
+      if (box.hi[k] - box.lo[k] > box.hi[widest] - box.lo[widest])
+        widest = k;
+    }
+    float value = evaluate(job, center);
+    if (value < state->bestValue) {
+      state->bestValue = value;
+      memcpy(state->bestPoint, center, sizeof(center));
+      offer_best(job, value);
+    }
+    if (box.hi[widest] - box.lo[widest] < s->tolerance) {
+      state->closedBound = fminf(state->closedBound, box.bound);
+      continue;
+    }
+
+    ChordBox upper = box;
+    box.hi[widest] = center[widest];
+    upper.lo[widest] = center[widest];
+    // the lower half is searched first
+    if (!push(&state->stack, &depth, &state->stackCapacity, &upper) ||
+        !push(&state->stack, &depth, &state->stackCapacity, &box)) {
+      state->failed = 1;
+      return;
+    }
+  }
+}
+
+// The search box cut into at least count pieces, halving the widest side of
+// every piece in turn. Returns the batch, NULL when out of memory.
+static ChordBatch *split_root(ChordJob *job, int count, int *pieces) {
+  const ChordSearchSettings *s = job->settings;
+  int n = 1;
+  while (n < count)
+    n *= 2;
+  ChordBatch *batch = (ChordBatch *)malloc(sizeof(ChordBatch) + n * sizeof(ChordBox));
+  if (!batch)
+    return NULL;
+  batch->next = NULL;
+  batch->job = job;
+  ChordBox *boxes = batch->boxes;
+  memcpy(boxes[0].lo, s->lo, sizeof(s->lo));
+  memcpy(boxes[0].hi, s->hi, sizeof(s->hi));
+  boxes[0].bound = 0.0f;
+  for (int have = 1; have < n; have *= 2) {
+    for (int i = 0; i < have; i++) {
+      ChordBox *box = &boxes[i];
+      int widest = 0;
+      for (int k = 1; k < s->dims; k++)
+        if (box->hi[k] - box->lo[k] > box->hi[widest] - box->lo[widest])
+          widest = k;
+      float mid = 0.5f * (box->lo[widest] + box->hi[widest]);
+      boxes[have + i] = *box;
+      boxes[have + i].lo[widest] = mid;
+      box->hi[widest] = mid;
+    }
+  }
+  *pieces = n;
+  return batch;
+}
+
+float chord_dissonance(const ChordSearchSettings *settings, const Voices *voices, const float *point) {
+  ChordJob job;
+  memset(&job, 0, sizeof(job));
+  job.settings = settings;
+  float value = build_problem(&job, voices) ? evaluate(&job, point) : 0.0f;
+  free(job.partials);
+  free(job.pairs);
+  return value;
+}
+
+int chord_search(TaskGroup *group, const ChordSearchSettings *settings, const Voices *voices,
+                 ChordSearchResult *result) {
+  memset(result, 0, sizeof(*result));
+  if (settings->dims < 1 || settings->dims > CHORD_MAX_DIMS || settings->tolerance <= 0.0f)
+    return 0;
+  for (int k = 0; k < settings->dims; k++)
+    if (!(settings->lo[k] > 0.0f && settings->hi[k] >= settings->lo[k]))
+      return 0;
+
+  double start = threadpool_now_ms();
+  int threadCount = threadpool_size(group->pool);
+  ChordJob job;
+  memset(&job, 0, sizeof(job));
+  job.settings = settings;
+  job.group = group;
+  job.handOff = threadCount > 1;
+  job.threads = (ChordThread *)calloc(threadCount, sizeof(ChordThread));
+  float infinity = INFINITY;
+  memcpy(&job.bestBits, &infinity, sizeof(job.bestBits));
+  int ok = job.threads && build_problem(&job, voices);
+  for (int t = 0; ok && t < threadCount; t++) {
+    job.threads[t].bestValue = INFINITY;
+    job.threads[t].closedBound = INFINITY;
+    job.threads[t].openBound = INFINITY;
+  }
+
+  // a few pieces per thread to start from, the rest spreads by hand-offs
+  int pieces = 0;
+  ChordBatch *root = ok ? split_root(&job, 2 * threadCount, &pieces) : NULL;
+  ok = root != NULL;
+  if (ok) {
+    threadpool_group_run(group, pieces, search_batch, root);
+    threadpool_group_wait(group);
+  }
+  for (int t = 0; ok && t < threadCount; t++)
+    ok = !job.threads[t].failed;
+  // a cancelled search has lost the boxes it skipped, its bound means nothing
+  ok = ok && !threadpool_group_cancelled(group);
+
+  if (ok) {
+    result->value = INFINITY;
+    result->lowerBound = INFINITY;
+    for (int t = 0; t < threadCount; t++) {
+      ChordThread *state = &job.threads[t];
+      if (state->bestValue < result->value) {
+        result->value = state->bestValue;
+        memcpy(result->point, state->bestPoint, sizeof(result->point));
+      }
+      result->lowerBound = fminf(result->lowerBound, fminf(state->closedBound, state->openBound));
+      result->boxes += state->boxes;
+      result->pruned += state->pruned;
+    }
+    result->lowerBound = fminf(result->lowerBound, result->value);
+    result->complete = !job.exhausted;
+  }
+  result->ms = threadpool_now_ms() - start;
+
+  free(root);
+  for (int t = 0; job.threads && t < threadCount; t++) {
+    for (ChordBatch *batch = job.threads[t].batches; batch;) {
+      ChordBatch *next = batch->next;
+      free(batch);
+      result->handOffs++;
+      batch = next;
+    }
+    free(job.threads[t].stack);
+  }
+  free(job.threads);
+  free(job.partials);
+  free(job.pairs);
+  return ok;
+}
+
+struct ChordSearchTask {
+  pthread_t thread;
+  ThreadPool *pool;
+  TaskGroup group;
+  ChordSearchSettings settings;
+  Arena arena; // voices
+  Voices voices;
+  ChordSearchResult result;
+  int ok;
+  int done; // read by the caller, atomically
+};
+
+static void *search_main(void *arg) {
+  ChordSearchTask *task = (ChordSearchTask *)arg;
+  task->ok = chord_search(&task->group, &task->settings, &task->voices, &task->result);
+  __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+ChordSearchTask *chord_search_start(ThreadPool *pool, const ChordSearchSettings *settings, const Voices *voices) {
+  ChordSearchTask *task = (ChordSearchTask *)calloc(1, sizeof(ChordSearchTask));
+  if (!task)
+    return NULL;
+  task->settings = *settings;
+  threadpool_group_init(pool, &task->group);
+  arena_init(&task->arena, ARENA_DEFAULT_BLOCK);
+  if (!voices_copy(&task->voices, &task->arena, voices) ||
+      pthread_create(&task->thread, NULL, search_main, task) != 0) {
+    arena_free(&task->arena);
+    free(task);
+    return NULL;
+  }
+  return task;
+}
+
+int chord_search_done(ChordSearchTask *task, ChordSearchResult *result, int *ok) {
+  if (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE))
+    return 0;
+  *result = task->result;
+  *ok = task->ok;
+  return 1;
+}
+
+void chord_search_cancel(ChordSearchTask *task) { threadpool_group_cancel(&task->group); }
+
+void chord_search_free(ChordSearchTask *task) {
+  if (!task)
+    return;
+  chord_search_cancel(task);
+  pthread_join(task->thread, NULL);
+  arena_free(&task->arena);
+  free(task);
+}
@@ -0,0 +1,80 @@
+#ifndef CHORD_H
+#define CHORD_H
+
+#include "dissonance.h"
+#include "threadpool.h"
+
+// Certified global search for the most consonant chord: the total dissonance
+// of all voices (every pair, min-amplitude weights, exact kernel) as a
+// function of up to CHORD_MAX_DIMS voice scales, by default x, z, voice 4 and
+// voice 5 of the viewer.
+//
+// Branch and bound over boxes of scales. A box's lower bound takes every pair
+// of partials on its own: both frequencies lie in intervals, which bounds the
+// critical-bandwidth distance d to an interval, and the Plomp-Levelt curve
+// e^{-3.5 d} - e^{-5.75 d} has a single peak, so its minimum over [dlo, dhi]
+// is at one of the ends. Pairs within one voice scale together and keep
+// their ratio. The value at the box centre is an upper bound for the best
+// chord. Boxes whose bound is within gap of the best chord found are pruned,
+// the others are split along their widest side until narrower than
+// tolerance.
+//
+// The work runs as tasks of a task group: the search box is cut into a few
+// pieces per thread, each searched depth first. After a budget of boxes a
+// task hands its whole stack to the group as a loop of its own and ends: the
+// thread that picks the loop up goes on depth first, idle threads steal the
+// widest boxes, and no task holds a worker for long, so the other loops on a
+// shared pool keep running. No thread waits for the others until the whole
+// tree is done. The best value is shared between the threads as it improves.
+// Cancelling the group stops every task at its next box.
+
+#define CHORD_MAX_DIMS 4
+
+typedef struct {
+  int dims;
+  int voices[CHORD_MAX_DIMS]; // voice scaled by each coordinate
+  float lo[CHORD_MAX_DIMS], hi[CHORD_MAX_DIMS];
+  float tolerance;    // narrowest box that is still split, in scale units
+  float gap;          // absolute: boxes that cannot beat the best by more are pruned
+  long long maxBoxes; // give up (complete = 0) after this many bounded boxes
+} ChordSearchSettings;
+
+typedef struct {
+  float point[CHORD_MAX_DIMS]; // scales of the best chord
+  float value;                 // its total dissonance
+  float lowerBound;            // no chord in the search box is below this
+  int complete;                // the bound holds (maxBoxes not reached)
+  long long boxes;             // boxes bounded
+  long long pruned;
+  int handOffs;                // loops of boxes handed to idle threads
+  double ms;
+} ChordSearchResult;
+
+// Scales of voices 0, 1, 3 and 4 over [0.5, 4]. The field goes to zero with
+// the frequencies (every partial collapses onto 0 Hz), so the range has to
+// stay away from zero.
+ChordSearchSettings chord_default_settings(void);
+
+// voices holds the spectra at scale 1. group: freshly initialised on the
+// pool to search on, waited for before returning. Returns 0 on bad settings,
+// when out of memory or when the group was cancelled.
+int chord_search(TaskGroup *group, const ChordSearchSettings *settings, const Voices *voices,
+                 ChordSearchResult *result);
+
+// The same search on a thread of its own, for the viewer: it takes seconds.
+// The settings and voices are copied. NULL when out of memory or when the
+// thread cannot start.
+typedef struct ChordSearchTask ChordSearchTask;
+ChordSearchTask *chord_search_start(ThreadPool *pool, const ChordSearchSettings *settings, const Voices *voices);
+// 1 once the search has finished, with its result and chord_search's return
+// value in *ok; 0 while it runs.
+int chord_search_done(ChordSearchTask *task, ChordSearchResult *result, int *ok);
+// Stops the search soon; it then finishes with *ok = 0.
+void chord_search_cancel(ChordSearchTask *task);
+// Cancels the search if it still runs and waits for its thread. NULL is fine.
+void chord_search_free(ChordSearchTask *task);
+
+// total dissonance of voices with the given scales, exact kernel
+float chord_dissonance(const ChordSearchSettings *settings, const Voices *voices, const float *point);
+
+#endif
@@ -0,0 +1,41 @@
+#version 330
+
+out vec4 finalColor;
+
+// Separable field, see separable.h:
+//   height = cross(x, z) + curveX(x) + curveZ(z) + offset
+// All three textures are sampled at the same texel centers as baking.fs.
+// Every term carries its derivatives, the output is (height, d/dx, d/dz).
+uniform sampler2D crossTerm;  // resolution x resolution, baked by baking.fs with BAKE_CROSS: (cross, d/dx, d/dz)
+uniform sampler2D crossCoarse; // the same at 1/8 resolution, bilinear, always baked whole
+uniform int refinedRows;       // rows of crossTerm baked so far, the rest comes from crossCoarse
+uniform int mirrorCross;       // only x <= z was baked, cross(x, z) = cross(z, x)
+uniform sampler2D curveX;     // resolution x 2: row 0 the curve, row 1 its slope
+uniform sampler2D curveZ;     // resolution x 2
+uniform float offset;
+uniform float maxHeight;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    // above the diagonal read the mirror image, with d/dx and d/dz swapped
+    bool mirrored = mirrorCross != 0 && texel.x > texel.y;
+    ivec2 source = mirrored ? texel.yx : texel;
+    // upsampled at the same texel centre while the full bake is under way;
+    // the coarse bake covers both triangles, it is read unmirrored so its
+    // filter never straddles the diagonal
+    vec3 cross;
+    if (source.y < refinedRows) {
+        cross = texelFetch(crossTerm, source, 0).rgb;
+        if (mirrored)
+            cross = cross.rbg;
+    } else {
+        cross = texture(crossCoarse, (vec2(texel) + 0.5) / vec2(textureSize(crossTerm, 0))).rgb;
+    }
+    float height = cross.r
+                 + texelFetch(curveX, ivec2(texel.x, 0), 0).r
+                 + texelFetch(curveZ, ivec2(texel.y, 0), 0).r
+                 + offset;
+    float dx = cross.g + texelFetch(curveX, ivec2(texel.x, 1), 0).r;
+    float dz = cross.b + texelFetch(curveZ, ivec2(texel.y, 1), 0).r;
+    finalColor = vec4(vec3(height, dx, dz) / maxHeight, 1.0);
+}
@@ -3,32 +3,129 @@
 #include <stdio.h>
 #include <string.h>
 
-#define PLOMP_A 3.5f
-#define PLOMP_B 5.75f
+int voices_init(Voices *voices, Arena *arena, int voiceCapacity, int partialCapacity) {
+  memset(voices, 0, sizeof(*voices));
+  voices->arena = arena;
+  return voices_reserve(voices, voiceCapacity, partialCapacity);
+}
+
+// Grows into fresh arena memory, the old arrays are left to the arena.
+int voices_reserve(Voices *voices, int voiceCapacity, int partialCapacity) {
+  if (voices->offsets && voiceCapacity <= voices->capacity && partialCapacity <= voices->partialCapacity)
+    return 1;
+  int capacity = voiceCapacity > voices->capacity ? voiceCapacity : voices->capacity;
+  int partials = partialCapacity > voices->partialCapacity ? partialCapacity : voices->partialCapacity;
+
+  int *offsets = (int *)arena_alloc(voices->arena, (capacity + 1) * sizeof(int));
+  float *freqs = (float *)arena_alloc(voices->arena, (partials > 0 ? partials : 1) * sizeof(float));
+  float *amps = (float *)arena_alloc(voices->arena, (partials > 0 ? partials : 1) * sizeof(float));
+  if (!offsets || !freqs || !amps)
+    return 0;
+
+  if (voices->offsets) {
+    int total = voices_partial_total(voices);
+    memcpy(offsets, voices->offsets, (voices->count + 1) * sizeof(int));
+    memcpy(freqs, voices->freqs, total * sizeof(float));
+    memcpy(amps, voices->amps, total * sizeof(float));
+  }
+  voices->offsets = offsets;
+  voices->freqs = freqs;
+  voices->amps = amps;
+  voices->capacity = capacity;
+  voices->partialCapacity = partials;
+  return 1;
+}
+
+int voices_partial_total(const Voices *voices) { return voices->offsets[voices->count]; }
+
+int voices_partial_count(const Voices *voices, int voice) {
+  return voices->offsets[voice + 1] - voices->offsets[voice];
+}
+
+int voices_axis_end(const Voices *voices) { return voices->offsets[voices->count < 2 ? voices->count : 2]; }
+
+int voices_axis_symmetric(const Voices *voices) {
+  if (voices->count < 2)
+    return 0;
+  int n = voices_partial_count(voices, 0);
+  size_t bytes = n * sizeof(float);
+  int z = voices->offsets[1];
+  return voices_partial_count(voices, 1) == n && !memcmp(voices->freqs, voices->freqs + z, bytes) &&
+         !memcmp(voices->amps, voices->amps + z, bytes);
+}
+
+int voices_copy(Voices *dst, Arena *arena, const Voices *src) {
+  arena_reset(arena);
+  if (!voices_init(dst, arena, src->count, voices_partial_total(src)))
+    return 0;
+  for (int v = 0; v < src->count; v++) {
+    int first = src->offsets[v];
+    if (!voices_add_spectrum(dst, src->freqs + first, src->amps + first, voices_partial_count(src, v)))
+      return 0;
+  }
+  return 1;
+}
+
+int voices_equal(const Voices *a, const Voices *b) {
+  if (a->count != b->count || memcmp(a->offsets, b->offsets, (a->count + 1) * sizeof(int)))
+    return 0;
+  size_t bytes = voices_partial_total(a) * sizeof(float);
+  return !memcmp(a->freqs, b->freqs, bytes) && !memcmp(a->amps, b->amps, bytes);
+}
+
+// room for one more voice of numPartials partials, both capacities double
+static int reserve_next_voice(Voices *voices, int numPartials) {
+  int capacity = voices->capacity;
+  while (capacity < voices->count + 1)
+    capacity = capacity > 0 ? 2 * capacity : DEFAULT_VOICES;
+  int partials = voices->partialCapacity;
+  while (partials < voices_partial_total(voices) + numPartials)
+    partials = partials > 0 ? 2 * partials : DEFAULT_VOICES * DEFAULT_PARTIALS;
+  return voices_reserve(voices, capacity, partials);
+}
+
+int voices_add_spectrum(Voices *voices, const float *freqs, const float *amps, int numPartials) {
+  if (numPartials < 0 || !reserve_next_voice(voices, numPartials))
+    return 0;
+  int offset = voices_partial_total(voices);
+  memcpy(voices->freqs + offset, freqs, numPartials * sizeof(float));
+  memcpy(voices->amps + offset, amps, numPartials * sizeof(float));
+  voices->count++;
+  voices->offsets[voices->count] = offset + numPartials;
+  return 1;
+}
 
 void generate_harmonic_series(Voices *voices, float baseFreq, float baseAmps, int numPartials) {
-  if (voices->count + 1 > MAX_VOICES)
+  if (numPartials < 0 || !reserve_next_voice(voices, numPartials))
     return;
-  int partial_count = voices->count * MAX_PARTIALS;
+  int partial_count = voices_partial_total(voices);
   for (int i = 0; i < numPartials; i++) {
     voices->freqs[partial_count + i] = baseFreq * (i + 1);
     voices->amps[partial_count + i] = baseAmps / (i + 1);
   }
-  for (int i = 0; i < MAX_PARTIALS - numPartials; i++)
-    voices->amps[partial_count + numPartials + i] = 0.0f;
   voices->count++;
+  voices->offsets[voices->count] = partial_count + numPartials;
+}
+
+void remove_voice(Voices *voices, int voice) {
+  if (voice < 0 || voice >= voices->count)
+    return;
+  int start = voices->offsets[voice];
+  int n = voices_partial_count(voices, voice);
+  int tail = voices_partial_total(voices) - start - n;
+  memmove(voices->freqs + start, voices->freqs + start + n, tail * sizeof(float));
+  memmove(voices->amps + start, voices->amps + start + n, tail * sizeof(float));
+  for (int v = voice + 1; v < voices->count; v++)
+    voices->offsets[v] = voices->offsets[v + 1] - n;
+  voices->count--;
 }
 
 float pairwise_dissonance(float f1, float a1, float f2, float a2) {
-  if (a1 == 0.0 || a2 == 0.0)
-    return 0.0;
   float s1 = 3.5;
   float s2 = 5.75;
   float f_min = fmin(f1, f2);
   float f_max = fmax(f1, f2);
   float cbw = 25.0 + 75.0 * powf(1.0 + 1.4 * powf(f_min / 1000.0, 2.0), 0.69);
-  if (cbw == 0.0)
-    return 0.0;
   float f_diff_norm = (f_max - f_min) / cbw;
   return fmin(a1, a2) * (expf(-s1 * f_diff_norm) - expf(-s2 * f_diff_norm));
 }
@@ -37,16 +134,16 @@ float pairwise_dissonance(float f1, float a1, float f2, float a2) {
 float get_xz_dissonance(Voices *voices, float coeff_x, float coeff_z, float otherVoicesDissonance) {
   float xz_dissonance = 0;
 
-  float local_freqs[MAX_VOICES * MAX_PARTIALS];
-  memcpy(local_freqs, voices->freqs, sizeof(local_freqs));
+  int n = voices_partial_total(voices);
+  int axisEnd = voices_axis_end(voices);
+  float local_freqs[n > 0 ? n : 1];
+  memcpy(local_freqs, voices->freqs, n * sizeof(float));
 
-  for (int i = 0; i < MAX_PARTIALS; i++)
-    local_freqs[i] *= coeff_x;
-  for (int i = MAX_PARTIALS; i < 2 * MAX_PARTIALS; i++)
-    local_freqs[i] *= coeff_z;
+  for (int i = 0; i < axisEnd; i++)
+    local_freqs[i] *= i < voices->offsets[1] ? coeff_x : coeff_z;
 
-  for (int i = 0; i < 2 * MAX_PARTIALS; i++)
-    for (int j = i + 1; j < voices->count * MAX_PARTIALS; j++)
+  for (int i = 0; i < axisEnd; i++)
+    for (int j = i + 1; j < n; j++)
       xz_dissonance += pairwise_dissonance(local_freqs[i], voices->amps[i], local_freqs[j], voices->amps[j]);
 
   return otherVoicesDissonance + xz_dissonance;
@@ -54,13 +151,13 @@ float get_xz_dissonance(Voices *voices, float coeff_x, float coeff_z, float othe
 
 float calculate_dissonance(Voices *voices, int starting_index) {
   float total_dissonance = 0.0f;
-  // for (int i = 0; i < voices->count * MAX_PARTIALS; i++) {
+  // for (int i = 0; i < voices_partial_total(voices); i++) {
   //   printf("freq: %f, amp: %f, i: %d\n", voices->freqs[i], voices->amps[i], i);
   // }
-  for (int i = starting_index; i < voices->count * MAX_PARTIALS; ++i) {
+  for (int i = starting_index; i < voices_partial_total(voices); ++i) {
     float f1 = voices->freqs[i];
     float amp1 = voices->amps[i];
-    for (int j = i + 1; j < voices->count * MAX_PARTIALS; ++j) {
+    for (int j = i + 1; j < voices_partial_total(voices); ++j) {
       float fmin = fminf(f1, voices->freqs[j]);
       float fmax = fmaxf(f1, voices->freqs[j]);
       float amp_prod = amp1 * voices->amps[j];
@@ -7,33 +7,316 @@ out vec4 finalColor;
 /*                            CORE DEFINITIONS                                  */
 /* ============================================================================ */
 
+// The terrain traced per pixel over [-worldPlaneSize / 2, worldPlaneSize / 2]
+// in x and z, two ways:
+//
+// heightmap: the same surface as the terrain mesh, height the GL_LINEAR
+// sample of the heightmap's .r. Rays walk the maximum mipmap built by
+// maxmip.fs: a cell the ray passes above is skipped whole, a cell it dips
+// into is opened, and in a texel the bilinear patches are intersected
+// exactly, so no ridge or valley is stepped over however thin.
+//
+// analytic: no heightmap at all, the dissonance of the spectra is evaluated
+// at every step like baking.fs does per texel. Each evaluation also bounds
+// how fast the field can change within a radius of the point, and the ray
+// advances by as much as that bound proves empty, so detail is exact at any
+// zoom and the cost follows the pixels on screen.
+
 uniform mat4 invView;
 uniform mat4 invProj;
+uniform mat4 mvp;          // for the depth of the hit
+uniform mat4 modelView;
 uniform vec3 cameraPos;
 uniform sampler2D heightmap;
-uniform vec2 surfaceDimensions;
-uniform vec4 viewInts;
+uniform sampler2D maxMip;  // every level, see maxmip.fs
+uniform int maxMipLevels;
+uniform float worldPlaneSize;
+uniform vec4 viewInts;     // framebuffer width / height in .zw
+uniform vec3 lightPos;     // view space, like terrain.fs
+uniform vec3 lightColor;
+uniform float heightMultiplier;
+uniform int analytic;      // trace the field itself, not the heightmap
+
+// analytic only, the layout of baking.fs
+uniform ivec3 partialOffsets;
+uniform sampler2D spectrum;
+uniform float otherVoicesDissonance;
 uniform float maxHeight;
+uniform float fieldCeiling; // no pair term exceeds its peak, see field_ceiling in main.c
+uniform float pixelAngle;   // radians across one pixel, the precision a hit needs
+
+const float SURFACE_EXTENT = 4.0; // coefficients across the plane, see terrain.vs
+const int MAX_STEPS = 2048;        // ~60 for a ray that is not grazing the surface
+const int SPECTRUM_WIDTH = 256;    // SPECTRUM_TEXTURE_WIDTH in main.c
+const int FIELD_STEPS = 512;        // ~150 on average, creases crawl
+const float FIELD_RADIUS_MIN = 1e-4; // coefficient units
+const float FIELD_RADIUS_MAX = 0.25;
+
+// Plomp-Levelt: a pair term is w g(d), g(d) = exp(-S1 d) - exp(-S2 d), with d
+// the frequency difference over the critical bandwidth of the lower one.
+const float S1 = 3.5;
+const float S2 = 5.75;
+const float G_SLOPE_MAX = 2.25;    // max |g'| = S2 - S1, at d = 0
+const float G_SLOPE_SPLIT = 0.2857; // 1 / S1: past it |g'(d)| <= S1 exp(-S1 d), falling
+const float D_SLOPE_MAX = 0.3679;  // max d |g'(d)| <= 1 / e
+const float CBW_SLOPE = 1.4490e-4; // d cbw / d lo <= CBW_SLOPE lo
 
 /* ============================================================================ */
 /*                  Optimized Surface/Normal Functions                          */
 /* ============================================================================ */
 
-float getDissonanceAt(float x, float z) {
-    vec2 uv = vec2(x / surfaceDimensions.x, z / surfaceDimensions.y);
-    uv = clamp(uv, 0.0, 1.0);
-    return texture(heightmap, uv).r * maxHeight;
+// In here x and z are in heightmap texels, [0, resolution]; y and t are world
+// units.
+struct Ray {
+    vec3 origin;
+    vec3 direction;
+};
+
+float texelHeight(ivec2 texel, ivec2 size) {
+    return texelFetch(heightmap, clamp(texel, ivec2(0), size - 1), 0).r;
+}
+
+// First t in [ta, tb] where the ray meets the bilinear patch between texel
+// centres i0 and i0 + 1 (clamped at the edges), or -1. Solved from ta: along
+// the ray the patch is a quadratic in t.
+float patchHit(Ray ray, float ta, float tb, ivec2 i0, ivec2 size) {
+    float h00 = texelHeight(i0, size);
+    float h10 = texelHeight(i0 + ivec2(1, 0), size) - h00;
+    float h01 = texelHeight(i0 + ivec2(0, 1), size) - h00;
+    float k = texelHeight(i0 + ivec2(1, 1), size) - h00 - h10 - h01;
+    vec3 p = ray.origin + ta * ray.direction;
+    vec2 a = p.xz - 0.5 - vec2(i0);
+    vec2 b = ray.direction.xz;
+    float A = -k * b.x * b.y;
+    float B = ray.direction.y - h10 * b.x - h01 * b.y - k * (a.x * b.y + a.y * b.x);
+    float C = p.y - h00 - h10 * a.x - h01 * a.y - k * a.x * a.y;
+    float span = tb - ta;
+    if (C == 0.0)
+        return ta;
+    if (abs(A) < 1e-12) {
+        float s = -C / B;
+        return B != 0.0 && s >= 0.0 && s <= span ? ta + s : -1.0;
+    }
+    float disc = B * B - 4.0 * A * C;
+    if (disc < 0.0)
+        return -1.0;
+    float q = -0.5 * (B + (B < 0.0 ? -1.0 : 1.0) * sqrt(disc));
+    float s0 = q / A, s1 = q != 0.0 ? C / q : s0;
+    float s = min(s0, s1);
+    if (s < 0.0)
+        s = max(s0, s1);
+    return s >= 0.0 && s <= span ? ta + s : -1.0;
+}
+
+// First hit inside level-0 texel cell over [ta, tb], or -1. The footprint
+// straddles up to four bilinear patches, split where the ray crosses the
+// texel-centre lines.
+float texelHit(Ray ray, ivec2 cell, float ta, float tb, ivec2 size) {
+    float cuts[4] = float[4](ta, tb, tb, tb);
+    int count = 1;
+    for (int axis = 0; axis < 2; axis++) {
+        float d = axis == 0 ? ray.direction.x : ray.direction.z;
+        float o = axis == 0 ? ray.origin.x : ray.origin.z;
+        float centre = float(axis == 0 ? cell.x : cell.y) + 0.5;
+        float t = d != 0.0 ? (centre - o) / d : ta;
+        if (t > ta && t < tb)
+            cuts[count++] = t;
+    }
+    if (count == 3 && cuts[2] < cuts[1])
+        cuts = float[4](ta, cuts[2], cuts[1], tb);
+    cuts[count] = tb;
+    for (int k = 0; k < count; k++) {
+        vec3 mid = ray.origin + 0.5 * (cuts[k] + cuts[k + 1]) * ray.direction;
+        float t = patchHit(ray, cuts[k], cuts[k + 1], ivec2(floor(mid.xz - 0.5)), size);
+        if (t >= 0.0)
+            return t;
+    }
+    return -1.0;
+}
+
+// Cell of the level above holding cell i of a level with the given count:
+// sizes round down, so the last one also takes the odd cell left over.
+int parentCell(int i, int cells) {
+    return min(i / 2, cells / 2 - 1);
+}
+
+// t of the first hit, or -1. The walk keeps the cell by index: it steps to
+// the neighbour across the wall it leaves, climbs to the coarsest level at
+// which that cell is new, and opens a cell the ray dips into by the child
+// under the ray, clamped to the cell, so rounding never strands it on a wall.
+float trace(Ray ray, float tStart, float tEnd) {
+    ivec2 size = textureSize(heightmap, 0);
+    int top = maxMipLevels - 1;
+    int level = top;
+    ivec2 cell = ivec2(0);
+    float t = tStart;
+    for (int step = 0; step < MAX_STEPS; step++) {
+        ivec2 cells = textureSize(maxMip, level);
+        float width = float(1 << level);
+        vec2 lo = vec2(cell) * width;
+        vec2 hi = vec2(cell.x == cells.x - 1 ? float(size.x) : lo.x + width,
+                       cell.y == cells.y - 1 ? float(size.y) : lo.y + width);
+        vec2 wall = vec2(ray.direction.x > 0.0 ? hi.x : lo.x, ray.direction.z > 0.0 ? hi.y : lo.y);
+        vec2 exits = vec2(ray.direction.x != 0.0 ? (wall.x - ray.origin.x) / ray.direction.x : 1e30,
+                          ray.direction.z != 0.0 ? (wall.y - ray.origin.z) / ray.direction.z : 1e30);
+        bool alongX = exits.x < exits.y;
+        float tExit = clamp(min(exits.x, exits.y), t, tEnd);
+        float highest = texelFetch(maxMip, cell, level).r;
+        float y = ray.origin.y + t * ray.direction.y;
+        float yExit = ray.origin.y + tExit * ray.direction.y;
+        if (min(y, yExit) <= highest) {
+            if (y > highest)
+                t = (highest - ray.origin.y) / ray.direction.y; // down to the top of the cell
+            if (level > 0) {
+                vec2 p = ray.origin.xz + t * ray.direction.xz;
+                ivec2 below = textureSize(maxMip, level - 1);
+                ivec2 last = ivec2(cell.x == cells.x - 1 ? below.x - 1 : 2 * cell.x + 1,
+                                   cell.y == cells.y - 1 ? below.y - 1 : 2 * cell.y + 1);
+                cell = clamp(ivec2(floor(p / (0.5 * width))), 2 * cell, last);
+                level--;
+                continue;
+            }
+            float hit = texelHit(ray, cell, t, tExit, size);
+            if (hit >= 0.0)
+                return hit;
+        }
+        if (tExit >= tEnd)
+            return -1.0;
+        t = tExit;
+        ivec2 previous = cell;
+        if (alongX)
+            cell.x += ray.direction.x > 0.0 ? 1 : -1;
+        else
+            cell.y += ray.direction.z > 0.0 ? 1 : -1;
+        if (any(lessThan(cell, ivec2(0))) || any(greaterThanEqual(cell, cells)))
+            return -1.0;
+        while (level < top) {
+            ivec2 up = ivec2(parentCell(cell.x, cells.x), parentCell(cell.y, cells.y));
+            if (up == ivec2(parentCell(previous.x, cells.x), parentCell(previous.y, cells.y)))
+                break;
+            previous = ivec2(parentCell(previous.x, cells.x), parentCell(previous.y, cells.y));
+            cell = up;
+            level++;
+            cells = textureSize(maxMip, level);
+        }
+    }
+    // out of steps only along a long graze, where the ray is at the surface
+    return t;
+}
+
+/* ============================================================================ */
+/*                        Analytic field and its bound                          */
+/* ============================================================================ */
+
+vec2 getPartial(int index) {
+    return texelFetch(spectrum, ivec2(index % SPECTRUM_WIDTH, index / SPECTRUM_WIDTH), 0).rg;
+}
+
+float criticalBandwidth(float lo) {
+    return 25.0 + 75.0 * pow(1.0 + 1.4e-6 * lo * lo, 0.69);
+}
+
+// Field at coefficients (x, z) in .x, in .yz bounds on |dF/dx| and |dF/dz|
+// anywhere in the square of half side radius around it. Per pair the two
+// frequencies can move by spread inside the square, which bounds d from
+// below and the bandwidth from both sides; |g'| and d |g'| fall off with d,
+// so pairs far from a coincidence add next to nothing.
+vec3 fieldBound(float x, float z, float radius) {
+    vec3 total = vec3(otherVoicesDissonance, 0.0, 0.0);
+    for (int i = 0; i < partialOffsets.y; i++) {
+        bool iOnX = i < partialOffsets.x;
+        vec2 p1 = getPartial(i);
+        float f1 = p1.x * (iOnX ? x : z);
+        for (int j = i + 1; j < partialOffsets.z; j++) {
+            vec2 p2 = getPartial(j);
+            float w = min(p1.y, p2.y);
+            if (w == 0.0)
+                continue;
+            bool jOnX = j < partialOffsets.x;
+            bool jOnZ = !jOnX && j < partialOffsets.y;
+            float f2 = p2.x * (jOnX ? x : jOnZ ? z : 1.0);
+            float lo = min(f1, f2);
+            float cbw = criticalBandwidth(lo);
+            float d = abs(f2 - f1) / cbw;
+            total.x += w * (exp(-S1 * d) - exp(-S2 * d));
+
+            float spread = radius * (p1.x + (jOnX || jOnZ ? p2.x : 0.0));
+            float loMax = lo + spread;
+            float cbwSlope = CBW_SLOPE * loMax;
+            float cbwLow = max(100.0, cbw - spread * cbwSlope);
+            float cbwHigh = cbw + spread * cbwSlope;
+            float dMin = max(0.0, abs(f2 - f1) - spread) / cbwHigh;
+            float fall = S1 * exp(-S1 * dMin);
+            float slope = dMin < G_SLOPE_SPLIT ? G_SLOPE_MAX : fall;
+            float dSlope = dMin < G_SLOPE_SPLIT ? D_SLOPE_MAX : dMin * fall;
+            // per unit of either frequency; the lower one also moves the bandwidth
+            float perFreq = w * (slope + dSlope * cbwSlope) / cbwLow;
+            if (iOnX) total.y += perFreq * p1.x; else total.z += perFreq * p1.x;
+            if (jOnX) total.y += perFreq * p2.x;
+            else if (jOnZ) total.z += perFreq * p2.x;
+        }
+    }
+    return total;
+}
+
+// (d/dx, d/dz) of the field, for the normal at a hit; pairwiseDissonanceGrad
+// in baking.fs.
+vec2 fieldGradient(float x, float z) {
+    vec2 total = vec2(0.0);
+    for (int i = 0; i < partialOffsets.y; i++) {
+        bool iOnX = i < partialOffsets.x;
+        vec2 p1 = getPartial(i);
+        float f1 = p1.x * (iOnX ? x : z);
+        for (int j = i + 1; j < partialOffsets.z; j++) {
+            vec2 p2 = getPartial(j);
+            bool jOnX = j < partialOffsets.x;
+            bool jOnZ = !jOnX && j < partialOffsets.y;
+            float f2 = p2.x * (jOnX ? x : jOnZ ? z : 1.0);
+            float lo = min(f1, f2);
+            float q = 1.0 + 1.4e-6 * lo * lo;
+            float qp = pow(q, 0.69);
+            float cbw = 25.0 + 75.0 * qp;
+            float dcbw = 75.0 * 0.69 * 2.8e-6 * qp / q * lo;
+            float d = abs(f2 - f1) / cbw;
+            float slope = min(p1.y, p2.y) * (-S1 * exp(-S1 * d) + S2 * exp(-S2 * d));
+            float dLo = -slope * (1.0 + d * dcbw) / cbw;
+            float dHi = slope / cbw;
+            float d1 = f1 < f2 ? dLo : dHi, d2 = f1 < f2 ? dHi : dLo;
+            if (iOnX) total.x += d1 * p1.x; else total.y += d1 * p1.x;
+            if (jOnX) total.x += d2 * p2.x;
+            else if (jOnZ) total.y += d2 * p2.x;
+        }
+    }
+    return total;
 }
 
-vec3 getNormal(float x, float z) {
-    vec2 e = vec2(0.01, 0.0);
-    float h = getDissonanceAt(x, z);
-    vec3 n = vec3(
-        h - getDissonanceAt(x - e.x, z),
-        e.x,
-        h - getDissonanceAt(x, z - e.y)
-    );
-    return normalize(n);
+// World t of the first hit of origin + t * direction (world units), or -1.
+// Within the square the bound holds the gap between the ray and the surface
+// closes no faster than closing per unit t, so the ray safely advances by
+// gap / closing; the square follows the step, wide while the ray is far
+// from the surface, tight when it closes in. A hit is a gap below the
+// pixel's footprint.
+float traceField(vec3 origin, vec3 direction, float tStart, float tEnd) {
+    float halfPlane = 0.5 * worldPlaneSize;
+    float toCoefficient = SURFACE_EXTENT / worldPlaneSize;
+    float across = max(abs(direction.x), abs(direction.z)) * toCoefficient;
+    float t = tStart;
+    float radius = FIELD_RADIUS_MAX;
+    for (int step = 0; step < FIELD_STEPS && t <= tEnd; step++) {
+        vec3 p = origin + t * direction;
+        vec2 coefficient = (p.xz + halfPlane) * toCoefficient;
+        vec3 field = fieldBound(coefficient.x, coefficient.y, radius) / maxHeight;
+        float gap = p.y - field.x;
+        if (gap <= pixelAngle * t)
+            return t;
+        float closing = (field.y * abs(direction.x) + field.z * abs(direction.z)) * toCoefficient - direction.y;
+        float reach = across > 0.0 ? radius / across : tEnd - t;
+        float advance = closing > 0.0 ? min(gap / closing, reach) : reach;
+        t += advance;
+        radius = clamp(2.0 * advance * across, FIELD_RADIUS_MIN, FIELD_RADIUS_MAX);
+    }
+    // out of steps: crawling along a crease or a graze, next to the surface
+    return t <= tEnd ? t : -1.0;
 }
 
 /* ============================================================================ */
@@ -41,85 +324,114 @@ vec3 getNormal(float x, float z) {
 /* ============================================================================ */
 void main() {
     /* --- Ray Generation --- */
-    vec2 fragCoord = gl_FragCoord.xy;
-    // Flip Y-coordinate
-    fragCoord.y = viewInts.w - fragCoord.y;
-    vec2 ndc = fragCoord / vec2(viewInts.z, viewInts.w) * 2.0 - 1.0;
+    vec2 ndc = gl_FragCoord.xy / viewInts.zw * 2.0 - 1.0;
     vec4 ray_eye = invProj * vec4(ndc.x, ndc.y, -1.0, 1.0);
-    vec3 rayDir = normalize((invView * vec4(ray_eye.xyz, 0.0)).xyz);
-    vec3 rayOrigin = cameraPos;
-
-    // Bounding sphere pre-check
-    vec3 sphereCenter = vec3(2.0, 0.5, 2.0);
-    float sphereRadius = 3.0 * maxHeight;
-    vec3 oc = rayOrigin - sphereCenter;
-    float b = dot(oc, rayDir);
-    float c = dot(oc, oc) - sphereRadius*sphereRadius;
-    float discriminant = b*b - c;
-
-    if (discriminant < 0.0) {
-        finalColor = vec4(0.05, 0.05, 0.1, 1.0);
-    } else {
-        /* --- Raymarching Loop --- */
-        float t = -b - sqrt(discriminant);
-        t = max(0.0, t); // Start at the sphere entry point, but not behind the camera
-
-        vec3 p = rayOrigin + t * rayDir;
-        float h_prev = p.y - getDissonanceAt(p.x, p.z);
-        bool hit = false;
-        float min_h = h_prev;
-
-        for (int i = 0; i < 64; i++) {
-            float step = max(0.005, abs(h_prev) * 0.5) * (0.5 + t * 0.015);
-            float t_curr = t + step;
-            p = rayOrigin + t_curr * rayDir;
-            float h_curr = p.y - getDissonanceAt(p.x, p.z);
-            if (p.x > 4.0 || p.x < 0.0 || p.z > 4.0 || p.z < 0.0)
-              break;
-
-            min_h = min(min_h, h_curr);
-            if (h_curr > min_h + 0.5) break; // Divergence check
-
-            if (h_curr * h_prev < 0.0) {
-                // Refinement phase: Adaptive binary search
-                float t_lower = t;
-                float t_upper = t_curr;
-                int refinement_steps = int(max(2.0, 10.0 - t * 0.1));
-                for (int j = 0; j < refinement_steps; j++) {
-                    float t_mid = (t_lower + t_upper) / 2.0;
-                    vec3 p_mid = rayOrigin + t_mid * rayDir;
-                    float h_mid = p_mid.y - getDissonanceAt(p_mid.x, p_mid.z);
-                    if (h_mid * h_prev < 0.0) {
-                        t_upper = t_mid;
-                    } else {
-                        t_lower = t_mid;
-                    }
-                }
-                t = (t_lower + t_upper) / 2.0;
-                p = rayOrigin + t * rayDir;
-                hit = true;
-                break;
+    vec3 rayDir = normalize((invView * vec4(ray_eye.xyz / ray_eye.w, 0.0)).xyz);
+
+    vec3 world;
+    vec2 slope; // d height / d world x and z, before heightMultiplier
+    if (analytic != 0) {
+        // clip to the column over the plane and below the ceiling; the field
+        // never dips under the offset, so a ray gets no further than that
+        float halfPlane = 0.5 * worldPlaneSize;
+        float tStart = 0.0, tEnd = 200.0;
+        for (int axis = 0; axis < 3; axis += 2) {
+            float o = cameraPos[axis], d = rayDir[axis];
+            if (d == 0.0) {
+                if (abs(o) > halfPlane)
+                    discard;
+                continue;
             }
+            float a = (-halfPlane - o) / d, b = (halfPlane - o) / d;
+            tStart = max(tStart, min(a, b));
+            tEnd = min(tEnd, max(a, b));
+        }
+        float ceiling = fieldCeiling / maxHeight;
+        if (rayDir.y > 0.0)
+            tEnd = min(tEnd, (ceiling - cameraPos.y) / rayDir.y);
+        else if (cameraPos.y > ceiling)
+            tStart = max(tStart, (ceiling - cameraPos.y) / rayDir.y);
+        if (tStart > tEnd)
+            discard;
+        float t = traceField(cameraPos, rayDir, tStart, tEnd);
+        if (t < 0.0)
+            discard;
+        world = cameraPos + t * rayDir;
+        vec2 coefficient = (world.xz + halfPlane) * (SURFACE_EXTENT / worldPlaneSize);
+        slope = fieldGradient(coefficient.x, coefficient.y) / maxHeight * (SURFACE_EXTENT / worldPlaneSize);
+    } else {
+        // to texel space in x and z, so cells are unit squares at level 0
+        ivec2 size = textureSize(heightmap, 0);
+        vec2 scale = vec2(size) / worldPlaneSize;
+        Ray ray;
+        ray.origin = vec3((cameraPos.x + 0.5 * worldPlaneSize) * scale.x, cameraPos.y,
+                          (cameraPos.z + 0.5 * worldPlaneSize) * scale.y);
+        ray.direction = vec3(rayDir.x * scale.x, rayDir.y, rayDir.z * scale.y);
 
-            t = t_curr;
-            h_prev = h_curr;
-            if (t > 200.0) break;
+        // clip to the column over the plane and below the highest point
+        float tStart = 0.0, tEnd = 200.0;
+        vec2 boxHi = vec2(size);
+        for (int axis = 0; axis < 2; axis++) {
+            float o = axis == 0 ? ray.origin.x : ray.origin.z;
+            float d = axis == 0 ? ray.direction.x : ray.direction.z;
+            float hi = axis == 0 ? boxHi.x : boxHi.y;
+            if (d == 0.0) {
+                if (o < 0.0 || o > hi)
+                    discard;
+                continue;
+            }
+            float a = (0.0 - o) / d, b = (hi - o) / d;
+            tStart = max(tStart, min(a, b));
+            tEnd = min(tEnd, max(a, b));
         }
+        float highest = texelFetch(maxMip, ivec2(0), maxMipLevels - 1).r;
+        if (ray.direction.y > 0.0)
+            tEnd = min(tEnd, (highest - ray.origin.y) / ray.direction.y);
+        else if (ray.origin.y > highest)
+            tStart = max(tStart, (highest - ray.origin.y) / ray.direction.y);
+        if (tStart > tEnd)
+            discard;
 
-        /* --- Coloring and Lighting --- */
-        if (hit) {
-            vec3 normal = getNormal(p.x, p.z);
-            vec3 lightDir = normalize(vec3(0.5, 0.8, -0.5));
-            float diffuse = max(0.0, dot(normal, lightDir));
-            vec3 color1 = vec3(0.1, 0.2, 0.8);
-            vec3 color2 = vec3(1.0, 0.3, 0.2);
-            vec3 surfaceColor = mix(color1, color2, clamp(p.y, 0.0, 1.0));
-            float fog = 1.0 - clamp(t / 200.0, 0.0, 1.0);
-            vec3 finalRgb = surfaceColor * (diffuse * 0.8 + 0.2);
-            finalColor = vec4(mix(vec3(0.0), finalRgb, fog), 1.0);
-            // finalColor = vec4(mix(vec3(0.0), surfaceColor, fog), 1.0);
-        } else {
-            finalColor = vec4(0.05, 0.05, 0.1, 1.0);
-       }
+        float t = trace(ray, tStart, tEnd);
+        if (t < 0.0)
+            discard;
+        vec3 hit = ray.origin + t * ray.direction;
+        world = vec3(hit.x / scale.x - 0.5 * worldPlaneSize, hit.y, hit.z / scale.y - 0.5 * worldPlaneSize);
+        slope = texture(heightmap, hit.xz / vec2(size)).gb * (SURFACE_EXTENT / worldPlaneSize);
     }
+
+    /* --- Coloring and Lighting --- */
+    // shaded like terrain.fs
+    slope *= heightMultiplier;
+    vec3 norm = normalize(mat3(modelView) * vec3(-slope.x, 1.0, -slope.y));
+    vec3 viewPos = (modelView * vec4(world, 1.0)).xyz;
+
+    float height = world.y / heightMultiplier;
+    vec3 color1 = vec3(0.05, 0.1, 0.3);  // Deep blue (valleys)
+    vec3 color2 = vec3(0.3, 0.2, 0.5);   // Deep purple (low-mid)
+    vec3 color3 = vec3(0.5, 0.1, 0.7);   // Purple (mid-level)
+    vec3 color4 = vec3(0.8, 0.2, 0.4);   // Magenta-red (highlands)
+    vec3 color5 = vec3(1.0, 0.3, 0.3);   // Bright red (peaks)
+    vec3 objectColor = mix(color1, color2, smoothstep(0.0, 0.25, height));
+    objectColor = mix(objectColor, color3, smoothstep(0.25, 0.5, height));
+    objectColor = mix(objectColor, color4, smoothstep(0.5, 0.75, height));
+    objectColor = mix(objectColor, color5, smoothstep(0.75, 1.0, height));
+
+    vec3 lightDir = normalize(lightPos - viewPos);
+    vec3 ambient = 0.5 * lightColor;
+    float diff = pow(max(dot(norm, lightDir), 0.0), 0.6);
+    vec3 diffuse = diff * lightColor * 1.5;
+    vec3 viewDir = normalize(-viewPos);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 8.0);
+    vec3 specular = 0.5 * spec * mix(lightColor, objectColor, 0.3);
+    float rim = pow(1.0 - max(dot(viewDir, norm), 0.0), 2.0);
+    vec3 rimLighting = rim * lightColor * 0.6;
+    vec3 result = (ambient + diffuse + specular + rimLighting) * objectColor;
+    result *= 1.0 + 0.5 * height;
+    finalColor = vec4(min(result, vec3(1.0)), 1.0);
+
+    // depth like the mesh, so the grid and markers sort against it
+    vec4 clip = mvp * vec4(world, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
 }
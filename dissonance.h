@@ -3,19 +3,48 @@
 
 #include <stdlib.h>
 #include "raylib.h"
-#define MAX_PARTIALS 6
-#define MAX_VOICES 8 
+#include "arena.h"
 
+// default shape of the harmonic voices built by main.c
+#define DEFAULT_PARTIALS 6
+#define DEFAULT_VOICES 8
+
+#define PLOMP_A 3.5f
+#define PLOMP_B 5.75f
+
+// Compressed rows: voice v owns partials [offsets[v], offsets[v + 1]) of the
+// packed freqs / amps arrays, so a 2-partial voice next to a 40-partial one
+// stores and visits only real partials. Both capacities grow on demand, the
+// arrays live in the arena.
 typedef struct {
     int count;
-    int numPartials[MAX_VOICES];
+    int capacity;        // voices
+    int partialCapacity; // packed partial slots
+    int *offsets;        // count + 1 entries, offsets[0] = 0
     float baseFreq;
     float baseAmp;
-    float freqs[MAX_VOICES * MAX_PARTIALS];
-    float amps[MAX_VOICES * MAX_PARTIALS];
+    float *freqs;
+    float *amps;
+    Arena *arena;
 } Voices;
 
+int voices_init(Voices *voices, Arena *arena, int voiceCapacity, int partialCapacity);
+int voices_reserve(Voices *voices, int voiceCapacity, int partialCapacity);
+int voices_add_spectrum(Voices *voices, const float *freqs, const float *amps, int numPartials);
+int voices_partial_total(const Voices *voices);
+int voices_partial_count(const Voices *voices, int voice);
+// first partial past the x and z voices (0 and 1), the fixed voices start here
+int voices_axis_end(const Voices *voices);
+// 1 when the x and z voices have the same spectrum, the XZ field is then
+// symmetric about x = z
+int voices_axis_symmetric(const Voices *voices);
+// dst: a copy of src in arena, which is reset first (a worker's request
+// buffer). Returns 0 when out of memory.
+int voices_copy(Voices *dst, Arena *arena, const Voices *src);
+int voices_equal(const Voices *a, const Voices *b);
+
 void generate_harmonic_series(Voices* voice, float baseFreq, float baseAmp, int numPartials);
+void remove_voice(Voices* voices, int voice);
 float pairwise_dissonance(float f1, float a1, float f2, float a2);
 float get_xz_dissonance(Voices *voices, float coeff_x, float coeff_z, float otherVoicesDissonance);
 float calculate_dissonance(Voices* voices, int starting_index);
@@ -0,0 +1,105 @@
+#include "dissonance_lut.h"
+#include "dissonance.h"
+#include <math.h>
+
+static DissonanceLut lut;
+static int lutReady = 0;
+
+float critical_bandwidth(float fmin) {
+  float u = fmin / 1000.0f;
+  return 25.0f + 75.0f * powf(1.0f + 1.4f * u * u, 0.69f);
+}
+
+float plomp_levelt(float fmin, float fmax) {
+  float d = (fmax - fmin) / critical_bandwidth(fmin);
+  return expf(-PLOMP_A * d) - expf(-PLOMP_B * d);
+}
+
+static float cbw_lookup(float fmin) {
+  float p = fmin * ((CBW_LUT_SIZE - 1) / LUT_FREQ_MAX);
+  int i = (int)p;
+  if (i >= CBW_LUT_SIZE - 1)
+    return critical_bandwidth(fmin);
+  float t = p - i;
+  return lut.cbw[i] + t * (lut.cbw[i + 1] - lut.cbw[i]);
+}
+
+float plomp_levelt_cbw_lut(float fmin, float fmax) {
+  float d = (fmax - fmin) / cbw_lookup(fmin);
+  return expf(-PLOMP_A * d) - expf(-PLOMP_B * d);
+}
+
+float plomp_levelt_kernel_lut(float fmin, float fmax) {
+  float pf = fmin * ((KERNEL_LUT_FREQS - 1) / LUT_FREQ_MAX);
+  int fi = (int)pf;
+  if (fi >= KERNEL_LUT_FREQS - 1 || !lut.kernel)
+    return plomp_levelt(fmin, fmax);
+  float y = (fmax - fmin) / (KERNEL_LUT_NORM_BASE + KERNEL_LUT_NORM_SLOPE * fmin);
+  float py = y * ((KERNEL_LUT_DIFFS - 1) / KERNEL_LUT_DIFF_MAX);
+  int yi = (int)py;
+  if (yi >= KERNEL_LUT_DIFFS - 1)
+    return 0.0f;
+  float tf = pf - fi;
+  float ty = py - yi;
+  const float *r0 = lut.kernel + (size_t)fi * KERNEL_LUT_DIFFS + yi;
+  const float *r1 = r0 + KERNEL_LUT_DIFFS;
+  float v0 = r0[0] + ty * (r0[1] - r0[0]);
+  float v1 = r1[0] + ty * (r1[1] - r1[0]);
+  return v0 + tf * (v1 - v0);
+}
+
+// max |d P'(d)|, scales a relative cbw error into an absolute pair error
+static float max_relative_sensitivity(void) {
+  float worst = 0.0f;
+  for (int i = 0; i < 10000; i++) {
+    float d = i * 0.001f;
+    float s = fabsf(d * (-PLOMP_A * expf(-PLOMP_A * d) + PLOMP_B * expf(-PLOMP_B * d)));
+    worst = s > worst ? s : worst;
+  }
+  return worst;
+}
+
+static void build_tables(void) {
+  for (int i = 0; i < CBW_LUT_SIZE; i++)
+    lut.cbw[i] = critical_bandwidth(i * (LUT_FREQ_MAX / (CBW_LUT_SIZE - 1)));
+
+  lut.kernel = (float *)malloc((size_t)KERNEL_LUT_FREQS * KERNEL_LUT_DIFFS * sizeof(float));
+  for (int fi = 0; lut.kernel && fi < KERNEL_LUT_FREQS; fi++) {
+    float fmin = fi * (LUT_FREQ_MAX / (KERNEL_LUT_FREQS - 1));
+    float norm = KERNEL_LUT_NORM_BASE + KERNEL_LUT_NORM_SLOPE * fmin;
+    for (int yi = 0; yi < KERNEL_LUT_DIFFS; yi++) {
+      float df = yi * (KERNEL_LUT_DIFF_MAX / (KERNEL_LUT_DIFFS - 1)) * norm;
+      lut.kernel[(size_t)fi * KERNEL_LUT_DIFFS + yi] = plomp_levelt(fmin, fmin + df);
+    }
+  }
+
+  // linear interpolation is worst near cell centers
+  float cbwRelError = 0.0f;
+  for (int i = 0; i < CBW_LUT_SIZE - 1; i++) {
+    float f = (i + 0.5f) * (LUT_FREQ_MAX / (CBW_LUT_SIZE - 1));
+    float exact = critical_bandwidth(f);
+    float e = fabsf(cbw_lookup(f) - exact) / exact;
+    cbwRelError = e > cbwRelError ? e : cbwRelError;
+  }
+  lut.cbwMaxError = cbwRelError * max_relative_sensitivity();
+
+  float kernelError = 0.0f;
+  for (int fi = 0; fi < KERNEL_LUT_FREQS - 1; fi++) {
+    float fmin = (fi + 0.5f) * (LUT_FREQ_MAX / (KERNEL_LUT_FREQS - 1));
+    float norm = KERNEL_LUT_NORM_BASE + KERNEL_LUT_NORM_SLOPE * fmin;
+    for (int yi = 0; yi < KERNEL_LUT_DIFFS - 1; yi++) {
+      float fmax = fmin + (yi + 0.5f) * (KERNEL_LUT_DIFF_MAX / (KERNEL_LUT_DIFFS - 1)) * norm;
+      float e = fabsf(plomp_levelt_kernel_lut(fmin, fmax) - plomp_levelt(fmin, fmax));
+      kernelError = e > kernelError ? e : kernelError;
+    }
+  }
+  lut.kernelMaxError = kernelError;
+}
+
+const DissonanceLut *dissonance_lut(void) {
+  if (!lutReady) {
+    build_tables();
+    lutReady = 1;
+  }
+  return &lut;
+}
@@ -0,0 +1,41 @@
+#ifndef DISSONANCE_LUT_H
+#define DISSONANCE_LUT_H
+
+// Lookup tables for the Plomp-Levelt pair term
+//   P(fmin, df) = exp(-A d) - exp(-B d),  d = df / cbw(fmin)
+//   cbw(f) = 25 + 75 (1 + 1.4 (f / 1000)^2)^0.69
+//
+// cbw table: cbw sampled on [0, LUT_FREQ_MAX], linear interpolation.
+// kernel table: P sampled on fmin in [0, LUT_FREQ_MAX] and the normalized
+// difference y = df / norm(fmin), norm(f) = 100 + 0.14 f, bilinear
+// interpolation. norm is a cheap affine stand-in for cbw (within a factor
+// 0.67..1.42 of it), so a lookup needs no pow or exp at all.
+//
+// Frequencies above LUT_FREQ_MAX fall back to the exact formula. The same
+// layout is sampled by baking.fs (kernelLut, cbwLut).
+
+#define LUT_FREQ_MAX 8192.0f
+#define CBW_LUT_SIZE 1024
+#define KERNEL_LUT_FREQS 256
+#define KERNEL_LUT_DIFFS 4096
+#define KERNEL_LUT_DIFF_MAX 9.0f // P < 1e-9 past this
+#define KERNEL_LUT_NORM_BASE 100.0f
+#define KERNEL_LUT_NORM_SLOPE 0.14f
+
+typedef struct {
+  float cbw[CBW_LUT_SIZE];
+  float *kernel; // KERNEL_LUT_FREQS rows of KERNEL_LUT_DIFFS, row = fmin
+  // measured max abs error of one pair term at unit amplitude weight
+  float cbwMaxError;
+  float kernelMaxError;
+} DissonanceLut;
+
+// Tables are built once, on first call. Not thread-safe until built.
+const DissonanceLut *dissonance_lut(void);
+
+float critical_bandwidth(float fmin);
+float plomp_levelt(float fmin, float fmax);
+float plomp_levelt_cbw_lut(float fmin, float fmax);
+float plomp_levelt_kernel_lut(float fmin, float fmax);
+
+#endif
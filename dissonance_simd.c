@@ -0,0 +1,352 @@
+#include "dissonance_simd.h"
+#include "dissonance_lut.h"
+#include <math.h>
+#include <string.h>
+
+typedef float (*RowSumFn)(float f1, float a1, const float *f2, const float *a2, int n, int mode);
+
+static float row_sum_scalar(float f1, float a1, const float *f2, const float *a2, int n, int mode) {
+  float sum = 0.0f;
+  for (int j = 0; j < n; j++) {
+    if (mode == DISS_AMP_MIN) {
+      sum += pairwise_dissonance(f1, a1, f2[j], a2[j]);
+    } else if (a1 != 0.0f && a2[j] != 0.0f) {
+      // pairwise_dissonance weighs by min(a1, a2), undo that for the product
+      sum += a1 * a2[j] * pairwise_dissonance(f1, 1.0f, f2[j], 1.0f);
+    }
+  }
+  return sum;
+}
+
+static float row_sum_cbw_lut(float f1, float a1, const float *f2, const float *a2, int n, int mode) {
+  float sum = 0.0f;
+  for (int j = 0; j < n; j++) {
+    float amp = mode == DISS_AMP_MIN ? fminf(a1, a2[j]) : a1 * a2[j];
+    if (amp != 0.0f)
+      sum += amp * plomp_levelt_cbw_lut(fminf(f1, f2[j]), fmaxf(f1, f2[j]));
+  }
+  return sum;
+}
+
+static float row_sum_kernel_lut(float f1, float a1, const float *f2, const float *a2, int n, int mode) {
+  float sum = 0.0f;
+  for (int j = 0; j < n; j++) {
+    float amp = mode == DISS_AMP_MIN ? fminf(a1, a2[j]) : a1 * a2[j];
+    if (amp != 0.0f)
+      sum += amp * plomp_levelt_kernel_lut(fminf(f1, f2[j]), fmaxf(f1, f2[j]));
+  }
+  return sum;
+}
+
+// Value and derivatives of one pair term with respect to the lower and the
+// higher frequency, see dissonance_row_derivs for the chain rule.
+//   c(lo) = 25 + 75 q^0.69, q = 1 + 1.4 (lo / 1000)^2, d = (hi - lo) / c
+//   G(d) = exp(-A d) - exp(-B d)
+static void pair_derivs_scalar(float lo, float hi, float w, float t[6]) {
+  float q = 1.0f + 1.4e-6f * lo * lo;
+  float qp = powf(q, 0.69f);
+  float c = 25.0f + 75.0f * qp;
+  float k = 75.0f * 0.69f * 2.8e-6f * qp / q; // c' = k lo
+  float c1 = k * lo;
+  float c2 = k * (1.0f - 0.31f * 2.8e-6f * lo * lo / q);
+  float inv = 1.0f / c;
+  float d = (hi - lo) * inv;
+  float dh = inv;
+  float dl = -(1.0f + d * c1) * inv;
+  float dlh = -c1 * inv * inv;
+  float dll = -(2.0f * dl * c1 + d * c2) * inv;
+  float ea = expf(-PLOMP_A * d), eb = expf(-PLOMP_B * d);
+  float g1 = -PLOMP_A * ea + PLOMP_B * eb;
+  float g2 = PLOMP_A * PLOMP_A * ea - PLOMP_B * PLOMP_B * eb;
+  t[0] = w * (ea - eb);
+  t[1] = w * g1 * dl;
+  t[2] = w * g1 * dh;
+  t[3] = w * (g2 * dl * dl + g1 * dll);
+  t[4] = w * (g2 * dl * dh + g1 * dlh);
+  t[5] = w * g2 * dh * dh;
+}
+
+static void row_derivs_scalar(float f1, float a1, float g1x, float g1z, const float *f2, const float *a2,
+                              const float *b2, float e2x, float e2z, int n, int hessian, float acc[6]) {
+  for (int j = 0; j < n; j++) {
+    float t[6];
+    int low = f1 < f2[j];
+    float lo = low ? f1 : f2[j];
+    float hi = low ? f2[j] : f1;
+    pair_derivs_scalar(lo, hi, fminf(a1, a2[j]), t);
+    float g2x = b2[j] * e2x, g2z = b2[j] * e2z;
+    float lx = low ? g1x : g2x, lz = low ? g1z : g2z;
+    float hx = low ? g2x : g1x, hz = low ? g2z : g1z;
+    acc[0] += t[0];
+    acc[1] += t[1] * lx + t[2] * hx;
+    acc[2] += t[1] * lz + t[2] * hz;
+    if (hessian) {
+      acc[3] += t[3] * lx * lx + 2.0f * t[4] * lx * hx + t[5] * hx * hx;
+      acc[4] += t[3] * lx * lz + t[4] * (lx * hz + hx * lz) + t[5] * hx * hz;
+      acc[5] += t[3] * lz * lz + 2.0f * t[4] * lz * hz + t[5] * hz * hz;
+    }
+  }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#endif
+
+#if defined(__GNUC__)
+#define KERNEL_WIDTH 4
+#define KERNEL_SUFFIX 128
+#if defined(HAVE_X86_KERNELS)
+#define KERNEL_ATTR __attribute__((target("sse2")))
+#else
+#define KERNEL_ATTR
+#endif
+#include "dissonance_simd_kernel.h"
+#undef KERNEL_ATTR
+#undef KERNEL_SUFFIX
+#undef KERNEL_WIDTH
+#endif
+
+#if defined(HAVE_X86_KERNELS)
+#define KERNEL_WIDTH 8
+#define KERNEL_SUFFIX avx2
+#define KERNEL_ATTR __attribute__((target("avx2,fma")))
+#include "dissonance_simd_kernel.h"
+#undef KERNEL_ATTR
+#undef KERNEL_SUFFIX
+#undef KERNEL_WIDTH
+
+#define KERNEL_WIDTH 16
+#define KERNEL_SUFFIX avx512
+#define KERNEL_ATTR __attribute__((target("avx512f")))
+#include "dissonance_simd_kernel.h"
+#undef KERNEL_ATTR
+#undef KERNEL_SUFFIX
+#undef KERNEL_WIDTH
+#endif
+
+static RowSumFn row_sum_fns[DISS_ISA_COUNT] = {
+    row_sum_scalar,
+#if defined(__GNUC__)
+    row_sum_128,
+#else
+    NULL,
+#endif
+#if defined(HAVE_X86_KERNELS)
+    row_sum_avx2,
+    row_sum_avx512,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+typedef void (*RowDerivsFn)(float f1, float a1, float g1x, float g1z, const float *f2, const float *a2,
+                            const float *b2, float e2x, float e2z, int n, int hessian, float acc[6]);
+
+static RowDerivsFn row_derivs_fns[DISS_ISA_COUNT] = {
+    row_derivs_scalar,
+#if defined(__GNUC__)
+    row_derivs_128,
+#else
+    NULL,
+#endif
+#if defined(HAVE_X86_KERNELS)
+    row_derivs_avx2,
+    row_derivs_avx512,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+// -1 until the first call resolves it
+static int active_isa = -1;
+static int eval_mode = DISS_EVAL_POLY;
+
+int dissonance_simd_supported(DissIsa isa) {
+  if (isa < 0 || isa >= DISS_ISA_COUNT || row_sum_fns[isa] == NULL)
+    return 0;
+#if defined(HAVE_X86_KERNELS)
+  __builtin_cpu_init();
+  if (isa == DISS_ISA_AVX2)
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  if (isa == DISS_ISA_AVX512)
+    return __builtin_cpu_supports("avx512f") != 0;
+#endif
+  return 1;
+}
+
+DissIsa dissonance_simd_isa(void) {
+  int isa = __atomic_load_n(&active_isa, __ATOMIC_ACQUIRE);
+  if (isa < 0) {
+    isa = DISS_ISA_COUNT - 1;
+    while (isa > DISS_ISA_SCALAR && !dissonance_simd_supported(isa))
+      isa--;
+    __atomic_store_n(&active_isa, isa, __ATOMIC_RELEASE);
+  }
+  return (DissIsa)isa;
+}
+
+int dissonance_simd_set_isa(DissIsa isa) {
+  if (!dissonance_simd_supported(isa))
+    return 0;
+  __atomic_store_n(&active_isa, (int)isa, __ATOMIC_RELEASE);
+  return 1;
+}
+
+const char *dissonance_simd_isa_name(DissIsa isa) {
+  switch (isa) {
+  case DISS_ISA_SCALAR:
+    return "scalar";
+  case DISS_ISA_VEC128:
+#if defined(HAVE_X86_KERNELS)
+    return "sse2";
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+    return "neon";
+#else
+    return "vec128";
+#endif
+  case DISS_ISA_AVX2:
+    return "avx2";
+  case DISS_ISA_AVX512:
+    return "avx512";
+  default:
+    return "unknown";
+  }
+}
+
+void dissonance_set_eval_mode(DissEvalMode mode) {
+  if (mode < 0 || mode >= DISS_EVAL_COUNT)
+    return;
+  if (mode == DISS_EVAL_CBW_LUT || mode == DISS_EVAL_KERNEL_LUT)
+    dissonance_lut();
+  __atomic_store_n(&eval_mode, (int)mode, __ATOMIC_RELEASE);
+}
+
+DissEvalMode dissonance_eval_mode(void) { return (DissEvalMode)__atomic_load_n(&eval_mode, __ATOMIC_ACQUIRE); }
+
+const char *dissonance_eval_mode_name(DissEvalMode mode) {
+  switch (mode) {
+  case DISS_EVAL_EXACT:
+    return "exact";
+  case DISS_EVAL_POLY:
+    return "poly";
+  case DISS_EVAL_CBW_LUT:
+    return "cbw lut";
+  case DISS_EVAL_KERNEL_LUT:
+    return "kernel lut";
+  default:
+    return "unknown";
+  }
+}
+
+float dissonance_eval_max_error(DissEvalMode mode) {
+  switch (mode) {
+  case DISS_EVAL_POLY:
+    return 5e-7f;
+  case DISS_EVAL_CBW_LUT:
+    return dissonance_lut()->cbwMaxError;
+  case DISS_EVAL_KERNEL_LUT:
+    return dissonance_lut()->kernelMaxError;
+  default:
+    return 0.0f;
+  }
+}
+
+static RowSumFn active_row_sum(void) {
+  switch (dissonance_eval_mode()) {
+  case DISS_EVAL_EXACT:
+    return row_sum_scalar;
+  case DISS_EVAL_CBW_LUT:
+    return row_sum_cbw_lut;
+  case DISS_EVAL_KERNEL_LUT:
+    return row_sum_kernel_lut;
+  default:
+    return row_sum_fns[dissonance_simd_isa()];
+  }
+}
+
+void dissonance_row_derivs(float f1, float a1, float g1x, float g1z, const float *f2, const float *a2, const float *b2,
+                           float e2x, float e2z, int n, int hessian, float acc[6]) {
+  if (n <= 0)
+    return;
+  // the tables have no derivatives, the LUT modes use the vector kernel here
+  RowDerivsFn fn = dissonance_eval_mode() == DISS_EVAL_EXACT ? row_derivs_scalar : row_derivs_fns[dissonance_simd_isa()];
+  fn(f1, a1, g1x, g1z, f2, a2, b2, e2x, e2z, n, hessian, acc);
+}
+
+float dissonance_row_sum(float f1, float a1, const float *f2, const float *a2, int n, DissAmpMode mode) {
+  if (n <= 0)
+    return 0.0f;
+  return active_row_sum()(f1, a1, f2, a2, n, mode);
+}
+
+// same pair set as get_xz_dissonance: every partial of the x and z voices
+// against every later partial. Only the axis partials are scaled, the fixed
+// ones are read in place.
+float get_xz_dissonance_simd(Voices *voices, float coeff_x, float coeff_z, float otherVoicesDissonance) {
+  float out;
+  get_xz_dissonance_batch(voices, &coeff_x, 0, &coeff_z, 0, 1, otherVoicesDissonance, &out, 1);
+  return out;
+}
+
+void get_xz_dissonance_batch(Voices *voices, const float *coeff_x, int xStride, const float *coeff_z, int zStride,
+                             int count, float otherVoicesDissonance, float *out, int outStride) {
+  // per-configuration work, done once for all points
+  int n = voices_partial_total(voices);
+  int split = voices->offsets[1];
+  int axisCount = voices_axis_end(voices);
+  const float *amps = voices->amps;
+  const float *fixedFreqs = voices->freqs + axisCount;
+  const float *fixedAmps = voices->amps + axisCount;
+  int fixedCount = n - axisCount;
+  RowSumFn row_sum = active_row_sum();
+  float axisFreqs[axisCount > 0 ? axisCount : 1];
+
+  for (int p = 0; p < count; p++) {
+    float x = coeff_x[(size_t)p * xStride];
+    float z = coeff_z[(size_t)p * zStride];
+    for (int i = 0; i < axisCount; i++)
+      axisFreqs[i] = voices->freqs[i] * (i < split ? x : z);
+
+    float xz_dissonance = 0.0f;
+    for (int i = 0; i < axisCount; i++) {
+      xz_dissonance += row_sum(axisFreqs[i], amps[i], axisFreqs + i + 1, amps + i + 1, axisCount - i - 1, DISS_AMP_MIN);
+      if (fixedCount > 0)
+        xz_dissonance += row_sum(axisFreqs[i], amps[i], fixedFreqs, fixedAmps, fixedCount, DISS_AMP_MIN);
+    }
+    out[(size_t)p * outStride] = otherVoicesDissonance + xz_dissonance;
+  }
+}
+
+// One pass over the pairs of get_xz_dissonance. An x partial of base
+// frequency b sits at b * x and moves by (b, 0) per unit (x, z), a z partial
+// by (0, b), a fixed one not at all.
+DissonanceDerivs get_xz_dissonance_derivs(Voices *voices, float coeff_x, float coeff_z, float otherVoicesDissonance,
+                                          int hessian) {
+  int n = voices_partial_total(voices);
+  int split = voices->offsets[1];
+  int axisCount = voices_axis_end(voices);
+  const float *base = voices->freqs;
+  const float *amps = voices->amps;
+  float axisFreqs[axisCount > 0 ? axisCount : 1];
+  for (int i = 0; i < axisCount; i++)
+    axisFreqs[i] = base[i] * (i < split ? coeff_x : coeff_z);
+
+  float acc[6] = {0};
+  for (int i = 0; i < axisCount; i++) {
+    int onX = i < split;
+    float gx = onX ? base[i] : 0.0f, gz = onX ? 0.0f : base[i];
+    // later partials of the same axis, then the other axis, then the fixed ones
+    int sameEnd = onX ? split : axisCount;
+    dissonance_row_derivs(axisFreqs[i], amps[i], gx, gz, axisFreqs + i + 1, amps + i + 1, base + i + 1, onX, !onX,
+                          sameEnd - i - 1, hessian, acc);
+    if (onX)
+      dissonance_row_derivs(axisFreqs[i], amps[i], gx, gz, axisFreqs + split, amps + split, base + split, 0.0f, 1.0f,
+                            axisCount - split, hessian, acc);
+    dissonance_row_derivs(axisFreqs[i], amps[i], gx, gz, base + axisCount, amps + axisCount, base + axisCount, 0.0f,
+                          0.0f, n - axisCount, hessian, acc);
+  }
+  DissonanceDerivs result = {otherVoicesDissonance + acc[0], acc[1], acc[2], acc[3], acc[4], acc[5]};
+  return result;
+}
@@ -0,0 +1,91 @@
+#ifndef DISSONANCE_SIMD_H
+#define DISSONANCE_SIMD_H
+
+#include "dissonance.h"
+
+// How the two amplitudes of a partial pair are combined. The XZ surface
+// (get_xz_dissonance, baking.fs) uses the minimum, calculate_dissonance
+// uses the product.
+typedef enum {
+  DISS_AMP_MIN = 0,
+  DISS_AMP_PRODUCT,
+} DissAmpMode;
+
+typedef enum {
+  DISS_ISA_SCALAR = 0, // reference path: pairwise terms with libm powf/expf
+  DISS_ISA_VEC128,     // 4 lanes: SSE2 on x86, NEON on arm64, plain C elsewhere
+  DISS_ISA_AVX2,       // 8 lanes
+  DISS_ISA_AVX512,     // 16 lanes
+  DISS_ISA_COUNT
+} DissIsa;
+
+// How each pair term is evaluated. Max abs error per pair at unit amplitude
+// weight, against the libm formula:
+//   EXACT       libm powf/expf, scalar              (reference)
+//   POLY        vector kernel, polynomial exp/log   < 5e-7
+//   CBW_LUT     cbw from a 1D table, libm expf      see dissonance_lut()->cbwMaxError
+//   KERNEL_LUT  whole term from a 2D table          see dissonance_lut()->kernelMaxError
+//
+// On the CPU the kernel table is the fastest: atlas-bake -r 300 -4 1.25 -5 1.5
+// (one thread, AVX-512 rows) takes about 190 ms with it, 270 ms with POLY,
+// 300 ms with the cbw table and 650 ms exact. Its error is the largest (about
+// 1e-4 per pair against 5e-7), so POLY stays the default; the cbw table only
+// replaces the pow and pays a scalar expf per pair, which makes it slower
+// than POLY.
+typedef enum {
+  DISS_EVAL_EXACT = 0,
+  DISS_EVAL_POLY,
+  DISS_EVAL_CBW_LUT,
+  DISS_EVAL_KERNEL_LUT,
+  DISS_EVAL_COUNT
+} DissEvalMode;
+
+// Defaults to DISS_EVAL_POLY. Switching to a LUT mode builds the tables.
+void dissonance_set_eval_mode(DissEvalMode mode);
+DissEvalMode dissonance_eval_mode(void);
+const char *dissonance_eval_mode_name(DissEvalMode mode);
+float dissonance_eval_max_error(DissEvalMode mode);
+
+// Sum of the Plomp-Levelt terms between one partial (f1, a1) and n others.
+// Evaluated in the current eval mode, POLY picks the vector ISA below.
+float dissonance_row_sum(float f1, float a1, const float *f2, const float *a2, int n, DissAmpMode mode);
+
+// Drop-in counterpart of get_xz_dissonance.
+float get_xz_dissonance_simd(Voices *voices, float coeff_x, float coeff_z, float otherVoicesDissonance);
+
+// get_xz_dissonance_simd for count points, the per-configuration setup is
+// done once. Point p reads coeff_x[p * xStride] and coeff_z[p * zStride] and
+// writes out[p * outStride]. Strides are in floats: 1 for separate arrays,
+// 2 for interleaved (x, z) pairs, 0 to hold a coordinate fixed (one row).
+void get_xz_dissonance_batch(Voices *voices, const float *coeff_x, int xStride, const float *coeff_z, int zStride,
+                             int count, float otherVoicesDissonance, float *out, int outStride);
+
+// Value, gradient and Hessian of the XZ field at one point.
+typedef struct {
+  float value;
+  float dx, dz;
+  float dxx, dxz, dzz;
+} DissonanceDerivs;
+
+// Closed-form derivatives of get_xz_dissonance, fused into one pass over the
+// pairs. The Hessian is only computed (otherwise left zero) when hessian is
+// nonzero. The kernel is not differentiable where two partials cross; there
+// the one-sided derivative of the current ordering is returned. The LUT eval
+// modes have no derivative tables and use the POLY kernel here.
+DissonanceDerivs get_xz_dissonance_derivs(Voices *voices, float coeff_x, float coeff_z, float otherVoicesDissonance,
+                                          int hessian);
+
+// Row form of the derivative pass, min amplitude weighting: partial (f1, a1)
+// moves by (g1x, g1z) per unit (x, z), partial j of f2 by b2[j] * (e2x, e2z).
+// Adds value, d/dx, d/dz, d2/dx2, d2/dxdz, d2/dz2 to acc.
+void dissonance_row_derivs(float f1, float a1, float g1x, float g1z, const float *f2, const float *a2, const float *b2,
+                           float e2x, float e2z, int n, int hessian, float acc[6]);
+
+// The best ISA is picked on first use from cpuid. Forcing an ISA the CPU does
+// not support fails and returns 0.
+DissIsa dissonance_simd_isa(void);
+int dissonance_simd_set_isa(DissIsa isa);
+int dissonance_simd_supported(DissIsa isa);
+const char *dissonance_simd_isa_name(DissIsa isa);
+
+#endif
@@ -0,0 +1,162 @@
+// Vector body of the pair-sum kernel. Not a regular header: dissonance_simd.c
+// includes it once per vector width with KERNEL_WIDTH (lanes), KERNEL_SUFFIX
+// and KERNEL_ATTR (target attribute, may be empty) defined.
+
+#define KCAT_(a, b) a##b
+#define KCAT(a, b) KCAT_(a, b)
+#define VF KCAT(vf_, KERNEL_SUFFIX)
+#define VI KCAT(vi_, KERNEL_SUFFIX)
+#define FN(name) KCAT(name##_, KERNEL_SUFFIX)
+
+typedef float VF __attribute__((vector_size(KERNEL_WIDTH * 4)));
+typedef int VI __attribute__((vector_size(KERNEL_WIDTH * 4)));
+
+static inline KERNEL_ATTR VF FN(vsel)(VI mask, VF a, VF b) { return (VF)(((VI)a & mask) | ((VI)b & ~mask)); }
+static inline KERNEL_ATTR VF FN(vmin)(VF a, VF b) { return FN(vsel)(a < b, a, b); }
+static inline KERNEL_ATTR VF FN(vmax)(VF a, VF b) { return FN(vsel)(a > b, a, b); }
+
+static inline KERNEL_ATTR VF FN(vload)(const float *p) {
+  VF v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// exp(x) for x in [-87, 88], cephes expf polynomial on [-ln2/2, ln2/2]
+static inline KERNEL_ATTR VF FN(vexp)(VF x) {
+  x = FN(vmax)(FN(vmin)(x, (VF){0} + 88.0f), (VF){0} + -87.0f);
+  VF t = x * 1.44269504088896341f + 0.5f;
+  VI n = __builtin_convertvector(t, VI);
+  VF nf = __builtin_convertvector(n, VF);
+  n += (VI)(nf > t); // truncation -> floor
+  nf = __builtin_convertvector(n, VF);
+  VF r = x - nf * 0.693359375f + nf * 2.12194440e-4f;
+  VF p = (VF){0} + 1.9875691500e-4f;
+  p = p * r + 1.3981999507e-3f;
+  p = p * r + 8.3334519073e-3f;
+  p = p * r + 4.1665795894e-2f;
+  p = p * r + 1.6666665459e-1f;
+  p = p * r + 5.0000001201e-1f;
+  p = p * r * r + r + 1.0f;
+  return p * (VF)((n + 127) << 23);
+}
+
+// log(x) for positive normal x, cephes logf polynomial
+static inline KERNEL_ATTR VF FN(vlog)(VF x) {
+  VI bits = (VI)x;
+  VF e = __builtin_convertvector(((bits >> 23) & 0xff) - 126, VF);
+  VF m = (VF)((bits & 0x807fffff) | 0x3f000000); // [0.5, 1)
+  VI small = m < 0.707106781186547524f;
+  e -= FN(vsel)(small, (VF){0} + 1.0f, (VF){0});
+  m = m + FN(vsel)(small, m, (VF){0}) - 1.0f;
+  VF z = m * m;
+  VF p = (VF){0} + 7.0376836292e-2f;
+  p = p * m - 1.1514610310e-1f;
+  p = p * m + 1.1676998740e-1f;
+  p = p * m - 1.2420140846e-1f;
+  p = p * m + 1.4249322787e-1f;
+  p = p * m - 1.6668057665e-1f;
+  p = p * m + 2.0000714765e-1f;
+  p = p * m - 2.4999993993e-1f;
+  p = p * m + 3.3333331174e-1f;
+  VF y = m * z * p - e * 2.12194440e-4f - 0.5f * z;
+  return m + y + e * 0.693359375f;
+}
+
+static inline KERNEL_ATTR VF FN(vpair)(VF f1, VF a1, VF f2, VF a2, int mode) {
+  VF lo = FN(vmin)(f1, f2);
+  VF hi = FN(vmax)(f1, f2);
+  VF u = lo * 0.001f;
+  VF cbw = 25.0f + 75.0f * FN(vexp)(0.69f * FN(vlog)(1.0f + 1.4f * u * u));
+  VF d = (hi - lo) / cbw;
+  VF amp = mode == DISS_AMP_MIN ? FN(vmin)(a1, a2) : a1 * a2;
+  return amp * (FN(vexp)(-PLOMP_A * d) - FN(vexp)(-PLOMP_B * d));
+}
+
+static KERNEL_ATTR float FN(row_sum)(float f1, float a1, const float *f2, const float *a2, int n, int mode) {
+  VF vf1 = (VF){0} + f1;
+  VF va1 = (VF){0} + a1;
+  VF acc = {0};
+  int j = 0;
+  for (; j + KERNEL_WIDTH <= n; j += KERNEL_WIDTH)
+    acc += FN(vpair)(vf1, va1, FN(vload)(f2 + j), FN(vload)(a2 + j), mode);
+  if (j < n) {
+    // pad the tail with zero-amplitude copies of f1, they contribute nothing
+    float tf[KERNEL_WIDTH], ta[KERNEL_WIDTH];
+    for (int k = 0; k < KERNEL_WIDTH; k++) {
+      tf[k] = j + k < n ? f2[j + k] : f1;
+      ta[k] = j + k < n ? a2[j + k] : 0.0f;
+    }
+    acc += FN(vpair)(vf1, va1, FN(vload)(tf), FN(vload)(ta), mode);
+  }
+  float sum = 0.0f;
+  for (int k = 0; k < KERNEL_WIDTH; k++)
+    sum += acc[k];
+  return sum;
+}
+
+// Derivative pass, the vector form of row_derivs_scalar in dissonance_simd.c.
+// Only the min amplitude weighting of the XZ field.
+static inline KERNEL_ATTR void FN(vpair_derivs)(VF f1, VF a1, VF g1x, VF g1z, VF f2, VF a2, VF b2, float e2x,
+                                                float e2z, int hessian, VF acc[6]) {
+  VI low = f1 < f2;
+  VF lo = FN(vsel)(low, f1, f2);
+  VF hi = FN(vsel)(low, f2, f1);
+  VF q = 1.0f + 1.4e-6f * lo * lo;
+  VF qp = FN(vexp)(0.69f * FN(vlog)(q));
+  VF c = 25.0f + 75.0f * qp;
+  VF k = (75.0f * 0.69f * 2.8e-6f) * qp / q;
+  VF c1 = k * lo;
+  VF inv = 1.0f / c;
+  VF d = (hi - lo) * inv;
+  VF dl = -(1.0f + d * c1) * inv;
+  VF ea = FN(vexp)(-PLOMP_A * d), eb = FN(vexp)(-PLOMP_B * d);
+  VF w = FN(vmin)(a1, a2);
+  VF g1 = w * (-PLOMP_A * ea + PLOMP_B * eb);
+  VF t1 = g1 * dl, t2 = g1 * inv;
+  VF g2x = b2 * e2x, g2z = b2 * e2z;
+  VF lx = FN(vsel)(low, g1x, g2x), lz = FN(vsel)(low, g1z, g2z);
+  VF hx = FN(vsel)(low, g2x, g1x), hz = FN(vsel)(low, g2z, g1z);
+  acc[0] += w * (ea - eb);
+  acc[1] += t1 * lx + t2 * hx;
+  acc[2] += t1 * lz + t2 * hz;
+  if (hessian) {
+    VF c2 = k * (1.0f - (0.31f * 2.8e-6f) * lo * lo / q);
+    VF g2 = w * (PLOMP_A * PLOMP_A * ea - PLOMP_B * PLOMP_B * eb);
+    VF t3 = g2 * dl * dl - g1 * (2.0f * dl * c1 + d * c2) * inv;
+    VF t4 = g2 * dl * inv - g1 * c1 * inv * inv;
+    VF t5 = g2 * inv * inv;
+    acc[3] += t3 * lx * lx + 2.0f * t4 * lx * hx + t5 * hx * hx;
+    acc[4] += t3 * lx * lz + t4 * (lx * hz + hx * lz) + t5 * hx * hz;
+    acc[5] += t3 * lz * lz + 2.0f * t4 * lz * hz + t5 * hz * hz;
+  }
+}
+
+static KERNEL_ATTR void FN(row_derivs)(float f1, float a1, float g1x, float g1z, const float *f2, const float *a2,
+                                       const float *b2, float e2x, float e2z, int n, int hessian, float out[6]) {
+  VF vf1 = (VF){0} + f1, va1 = (VF){0} + a1;
+  VF vg1x = (VF){0} + g1x, vg1z = (VF){0} + g1z;
+  VF acc[6] = {{0}};
+  int j = 0;
+  for (; j + KERNEL_WIDTH <= n; j += KERNEL_WIDTH)
+    FN(vpair_derivs)(vf1, va1, vg1x, vg1z, FN(vload)(f2 + j), FN(vload)(a2 + j), FN(vload)(b2 + j), e2x, e2z,
+                     hessian, acc);
+  if (j < n) {
+    // zero-amplitude copies of f1 again
+    float tf[KERNEL_WIDTH], ta[KERNEL_WIDTH], tb[KERNEL_WIDTH];
+    for (int k = 0; k < KERNEL_WIDTH; k++) {
+      tf[k] = j + k < n ? f2[j + k] : f1;
+      ta[k] = j + k < n ? a2[j + k] : 0.0f;
+      tb[k] = j + k < n ? b2[j + k] : 0.0f;
+    }
+    FN(vpair_derivs)(vf1, va1, vg1x, vg1z, FN(vload)(tf), FN(vload)(ta), FN(vload)(tb), e2x, e2z, hessian, acc);
+  }
+  for (int m = 0; m < 6; m++)
+    for (int k = 0; k < KERNEL_WIDTH; k++)
+      out[m] += acc[m][k];
+}
+
+#undef FN
+#undef VI
+#undef VF
+#undef KCAT
+#undef KCAT_
@@ -0,0 +1,219 @@
+#include "fieldworker.h"
+#include "threadpool.h"
+#include <pthread.h>
+#include <string.h>
+
+// A stale build is abandoned only while the published snapshot is younger
+// than this; past it the build finishes, so a continuous drag whose builds
+// outlast a frame still shows progress.
+#define FIELD_WORKER_MAX_LAG_MS 50.0
+
+typedef struct {
+  Arena arena; // snapshot.voices
+  float *curves; // curveX, curveZ, curveXSlope, curveZSlope
+  FieldSnapshot snapshot;
+} FieldBuffer;
+
+struct FieldWorker {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake; // a new request, a released buffer or quit
+  int quit;
+
+  // newest request, under the lock
+  Arena requestArena;
+  Voices request;
+  float requestOffset;
+  int invalidate;
+  unsigned int requested; // also read by the cancellation poll, atomically
+
+  // worker thread only
+  SeparableField field;
+  Arena buildArena;
+  Voices build;
+  unsigned int building;
+  double publishedAt;
+
+  // published, under the lock
+  FieldBuffer buffers[2];
+  int front;    // newest snapshot, -1 before the first
+  int acquired; // buffer the renderer holds, -1 for none
+  int fresh;    // front not acquired yet
+};
+
+static int build_stale(void *ctx) {
+  FieldWorker *worker = (FieldWorker *)ctx;
+  return __atomic_load_n(&worker->requested, __ATOMIC_RELAXED) != worker->building &&
+         (__atomic_load_n(&worker->quit, __ATOMIC_RELAXED) || threadpool_now_ms() - worker->publishedAt < FIELD_WORKER_MAX_LAG_MS);
+}
+
+// under the lock, waits until the renderer does not hold the back buffer
+static void publish(FieldWorker *worker, int dirty, double ms) {
+  int back = worker->front < 0 ? 0 : 1 - worker->front;
+  while (worker->acquired == back && !worker->quit)
+    pthread_cond_wait(&worker->wake, &worker->lock);
+  if (worker->quit)
+    return;
+  FieldBuffer *buffer = &worker->buffers[back];
+  FieldSnapshot *snapshot = &buffer->snapshot;
+  int n = worker->field.resolution;
+  if (!voices_copy(&snapshot->voices, &buffer->arena, &worker->build))
+    return;
+  memcpy(buffer->curves, worker->field.curveX, n * sizeof(float));
+  memcpy(buffer->curves + n, worker->field.curveZ, n * sizeof(float));
+  memcpy(buffer->curves + 2 * n, worker->field.curveXSlope, n * sizeof(float));
+  memcpy(buffer->curves + 3 * n, worker->field.curveZSlope, n * sizeof(float));
+  snapshot->generation = worker->building;
+  // a front nobody acquired is skipped, its changes carry over
+  snapshot->dirty = dirty | (worker->fresh ? worker->buffers[worker->front].snapshot.dirty : 0);
+  snapshot->offset = worker->field.offset;
+  snapshot->ms = ms;
+  worker->front = back;
+  worker->fresh = 1;
+  worker->publishedAt = threadpool_now_ms();
+}
+
+static void *worker_main(void *arg) {
+  FieldWorker *worker = (FieldWorker *)arg;
+  unsigned int built = 0;
+  pthread_mutex_lock(&worker->lock);
+  while (!worker->quit) {
+    if (worker->requested == built) {
+      pthread_cond_wait(&worker->wake, &worker->lock);
+      continue;
+    }
+    worker->building = worker->requested;
+    float offset = worker->requestOffset;
+    int invalidate = worker->invalidate;
+    worker->invalidate = 0;
+    int copied = voices_copy(&worker->build, &worker->buildArena, &worker->request);
+    pthread_mutex_unlock(&worker->lock);
+
+    if (invalidate)
+      separable_invalidate(&worker->field);
+    double start = threadpool_now_ms();
+    int dirty = copied ? separable_update(&worker->field, &worker->build, offset) : SEPARABLE_CANCELLED;
+
+    pthread_mutex_lock(&worker->lock);
+    // a stale build starts over on the newest request; out of memory drops
+    // the request, the next one retries
+    if (copied && (dirty & SEPARABLE_CANCELLED))
+      continue;
+    built = worker->building;
+    if (copied && dirty)
+      publish(worker, dirty, threadpool_now_ms() - start);
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return NULL;
+}
+
+static void free_buffers(FieldWorker *worker) {
+  for (int b = 0; b < 2; b++) {
+    free(worker->buffers[b].curves);
+    arena_free(&worker->buffers[b].arena);
+  }
+  arena_free(&worker->requestArena);
+  arena_free(&worker->buildArena);
+  separable_free(&worker->field);
+}
+
+FieldWorker *field_worker_create(int resolution, float extent) {
+  FieldWorker *worker = (FieldWorker *)calloc(1, sizeof(FieldWorker));
+  if (!worker)
+    return NULL;
+  worker->front = -1;
+  worker->acquired = -1;
+  arena_init(&worker->requestArena, ARENA_DEFAULT_BLOCK);
+  arena_init(&worker->buildArena, ARENA_DEFAULT_BLOCK);
+  int ok = separable_init(&worker->field, resolution, extent, 0);
+  worker->field.cancelled = build_stale;
+  worker->field.cancelCtx = worker;
+  for (int b = 0; b < 2; b++) {
+    FieldBuffer *buffer = &worker->buffers[b];
+    arena_init(&buffer->arena, ARENA_DEFAULT_BLOCK);
+    buffer->curves = (float *)malloc(4 * (size_t)resolution * sizeof(float));
+    ok = ok && buffer->curves;
+    if (!buffer->curves)
+      continue;
+    buffer->snapshot.resolution = resolution;
+    buffer->snapshot.curveX = buffer->curves;
+    buffer->snapshot.curveZ = buffer->curves + resolution;
+    buffer->snapshot.curveXSlope = buffer->curves + 2 * resolution;
+    buffer->snapshot.curveZSlope = buffer->curves + 3 * resolution;
+  }
+  if (!ok) {
+    free_buffers(worker);
+    free(worker);
+    return NULL;
+  }
+  pthread_mutex_init(&worker->lock, NULL);
+  pthread_cond_init(&worker->wake, NULL);
+  if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->wake);
+    free_buffers(worker);
+    free(worker);
+    return NULL;
+  }
+  return worker;
+}
+
+void field_worker_destroy(FieldWorker *worker) {
+  if (!worker)
+    return;
+  pthread_mutex_lock(&worker->lock);
+  worker->quit = 1;
+  // abandons a build in flight
+  __atomic_add_fetch(&worker->requested, 1, __ATOMIC_RELAXED);
+  pthread_cond_broadcast(&worker->wake);
+  pthread_mutex_unlock(&worker->lock);
+  pthread_join(worker->thread, NULL);
+  pthread_mutex_destroy(&worker->lock);
+  pthread_cond_destroy(&worker->wake);
+  free_buffers(worker);
+  free(worker);
+}
+
+unsigned int field_worker_submit(FieldWorker *worker, const Voices *voices, float otherVoicesDissonance) {
+  pthread_mutex_lock(&worker->lock);
+  int unchanged = worker->requested > 0 && worker->requestOffset == otherVoicesDissonance &&
+                  voices_equal(&worker->request, voices);
+  if (!unchanged && voices_copy(&worker->request, &worker->requestArena, voices)) {
+    worker->requestOffset = otherVoicesDissonance;
+    __atomic_add_fetch(&worker->requested, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&worker->wake);
+  }
+  unsigned int generation = worker->requested;
+  pthread_mutex_unlock(&worker->lock);
+  return generation;
+}
+
+void field_worker_invalidate(FieldWorker *worker) {
+  pthread_mutex_lock(&worker->lock);
+  worker->invalidate = 1;
+  // the same voices again are a new request now
+  if (worker->requested > 0) {
+    __atomic_add_fetch(&worker->requested, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&worker->wake);
+  }
+  pthread_mutex_unlock(&worker->lock);
+}
+
+const FieldSnapshot *field_worker_acquire(FieldWorker *worker) {
+  pthread_mutex_lock(&worker->lock);
+  const FieldSnapshot *snapshot = NULL;
+  if (worker->fresh) {
+    worker->fresh = 0;
+    worker->acquired = worker->front;
+    snapshot = &worker->buffers[worker->front].snapshot;
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return snapshot;
+}
+
+void field_worker_release(FieldWorker *worker) {
+  pthread_mutex_lock(&worker->lock);
+  worker->acquired = -1;
+  pthread_cond_broadcast(&worker->wake);
+  pthread_mutex_unlock(&worker->lock);
+}
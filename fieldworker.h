@@ -0,0 +1,48 @@
+#ifndef FIELDWORKER_H
+#define FIELDWORKER_H
+
+#include "separable.h"
+
+// Builds the separable field on a background thread, so a configuration
+// whose curves take hundreds of milliseconds never stalls a frame.
+//
+// Every request carries a generation. Requests coalesce: the worker always
+// builds the newest one, and a build overtaken by a newer request is
+// abandoned at its next cancellation poll, unless the published snapshot is
+// already lagging: then it finishes, so a long drag still shows progress.
+// Finished builds are published double buffered: the renderer acquires the
+// newest snapshot, uploads it and releases it, while the worker fills the
+// other buffer. Until a snapshot lands the renderer keeps drawing what it
+// composed from the previous one.
+
+typedef struct {
+  unsigned int generation; // request the snapshot was built from
+  int dirty;    // SEPARABLE_*_DIRTY against the previously acquired snapshot
+  Voices voices; // configuration it was built from, e.g. for the GPU cross bake
+  int resolution;
+  const float *curveX, *curveZ;
+  const float *curveXSlope, *curveZSlope;
+  float offset;
+  double ms; // build time
+} FieldSnapshot;
+
+typedef struct FieldWorker FieldWorker;
+
+// The worker keeps no cross term, the GPU bakes it. NULL when out of memory
+// or when the thread cannot start.
+FieldWorker *field_worker_create(int resolution, float extent);
+void field_worker_destroy(FieldWorker *worker);
+
+// Requests a build of voices, copied. An unchanged configuration is not a new
+// request. Returns the generation of the newest request.
+unsigned int field_worker_submit(FieldWorker *worker, const Voices *voices, float otherVoicesDissonance);
+
+// Rebuilds everything for the next request, e.g. after the eval mode changed.
+void field_worker_invalidate(FieldWorker *worker);
+
+// The newest snapshot when one landed since the last call, else NULL. It
+// stays valid until field_worker_release.
+const FieldSnapshot *field_worker_acquire(FieldWorker *worker);
+void field_worker_release(FieldWorker *worker);
+
+#endif
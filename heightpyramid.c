@@ -0,0 +1,261 @@
+#include "heightpyramid.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BOX_EPSILON 1e-5f    // boxes grow by this, so rays along a face still enter
+#define EDGE_EPSILON 1e-6f   // barycentric slack, no cracks along shared edges
+
+int height_pyramid_init(HeightPyramid *pyramid, int meshResolution, float worldSize) {
+  memset(pyramid, 0, sizeof(*pyramid));
+  pyramid->meshResolution = meshResolution;
+  pyramid->worldSize = worldSize;
+  int levels = 1;
+  for (int size = meshResolution; size > 1; size = (size + 1) / 2)
+    levels++;
+  if (meshResolution < 1 || levels > HEIGHT_PYRAMID_MAX_LEVELS)
+    return 0;
+  pyramid->levels = levels;
+  size_t vertices = (size_t)(meshResolution + 1) * (meshResolution + 1);
+  pyramid->vertices = (float *)malloc(vertices * sizeof(float));
+  int ok = pyramid->vertices != NULL;
+  for (int level = 0, size = meshResolution; level < levels; level++, size = (size + 1) / 2) {
+    pyramid->sizes[level] = size;
+    pyramid->bounds[level] = (float *)malloc(2 * (size_t)size * size * sizeof(float));
+    ok = ok && pyramid->bounds[level];
+  }
+  if (!ok)
+    height_pyramid_free(pyramid);
+  return ok;
+}
+
+void height_pyramid_free(HeightPyramid *pyramid) {
+  free(pyramid->vertices);
+  for (int level = 0; level < pyramid->levels; level++)
+    free(pyramid->bounds[level]);
+  memset(pyramid, 0, sizeof(*pyramid));
+}
+
+// GL_LINEAR with GL_CLAMP_TO_EDGE at texture coordinate s along one axis:
+// the two texels and the weight of the second
+typedef struct {
+  int i0, i1;
+  float w;
+} LinearTaps;
+
+static LinearTaps linear_taps(float s, int resolution) {
+  float texel = s * resolution - 0.5f;
+  float floor0 = floorf(texel);
+  int i = (int)floor0;
+  LinearTaps taps = {i < 0 ? 0 : i >= resolution ? resolution - 1 : i,
+                     i + 1 < 0 ? 0 : i + 1 >= resolution ? resolution - 1 : i + 1, texel - floor0};
+  return taps;
+}
+
+typedef struct {
+  HeightPyramid *pyramid;
+  const float *texels;
+  int resolution;
+  const LinearTaps *columns; // taps of every vertex column, the same for each row
+  int level;
+} BuildJob;
+
+static void build_vertex_row(void *ctx, int j, int thread) {
+  BuildJob *job = (BuildJob *)ctx;
+  int n = job->pyramid->meshResolution;
+  LinearTaps rows = linear_taps((float)j / n, job->resolution);
+  const float *row0 = job->texels + (size_t)rows.i0 * job->resolution;
+  const float *row1 = job->texels + (size_t)rows.i1 * job->resolution;
+  float *out = job->pyramid->vertices + (size_t)j * (n + 1);
+  for (int i = 0; i <= n; i++) {
+    LinearTaps x = job->columns ? job->columns[i] : linear_taps((float)i / n, job->resolution);
+    float near = row0[x.i0] + (row0[x.i1] - row0[x.i0]) * x.w;
+    float far = row1[x.i0] + (row1[x.i1] - row1[x.i0]) * x.w;
+    out[i] = near + (far - near) * rows.w;
+  }
+}
+
+static float min4(float a, float b, float c, float d) {
+  float ab = a < b ? a : b, cd = c < d ? c : d;
+  return ab < cd ? ab : cd;
+}
+
+static float max4(float a, float b, float c, float d) {
+  float ab = a > b ? a : b, cd = c > d ? c : d;
+  return ab > cd ? ab : cd;
+}
+
+static void build_quad_row(void *ctx, int j, int thread) {
+  BuildJob *job = (BuildJob *)ctx;
+  int n = job->pyramid->meshResolution;
+  const float *v0 = job->pyramid->vertices + (size_t)j * (n + 1);
+  const float *v1 = v0 + n + 1;
+  float *out = job->pyramid->bounds[0] + 2 * (size_t)j * n;
+  for (int i = 0; i < n; i++) {
+    out[2 * i] = min4(v0[i], v0[i + 1], v1[i], v1[i + 1]);
+    out[2 * i + 1] = max4(v0[i], v0[i + 1], v1[i], v1[i + 1]);
+  }
+}
+
+static void build_level_row(void *ctx, int j, int thread) {
+  BuildJob *job = (BuildJob *)ctx;
+  const HeightPyramid *p = job->pyramid;
+  int level = job->level;
+  int below = p->sizes[level - 1];
+  // an odd last row or column repeats its neighbour
+  const float *row0 = p->bounds[level - 1] + 2 * (size_t)(2 * j) * below;
+  const float *row1 = 2 * j + 1 < below ? row0 + 2 * below : row0;
+  float *out = p->bounds[level] + 2 * (size_t)j * p->sizes[level];
+  for (int i = 0; i < p->sizes[level]; i++) {
+    int a = 2 * (2 * i), b = 2 * i + 1 < below ? a + 2 : a;
+    out[2 * i] = min4(row0[a], row0[b], row1[a], row1[b]);
+    out[2 * i + 1] = max4(row0[a + 1], row0[b + 1], row1[a + 1], row1[b + 1]);
+  }
+}
+
+void height_pyramid_build(ThreadPool *pool, HeightPyramid *pyramid, const float *texels, int resolution) {
+  double start = threadpool_now_ms();
+  int n = pyramid->meshResolution;
+  LinearTaps *columns = (LinearTaps *)malloc((n + 1) * sizeof(LinearTaps));
+  for (int i = 0; columns && i <= n; i++)
+    columns[i] = linear_taps((float)i / n, resolution);
+  BuildJob job = {pyramid, texels, resolution, columns, 0};
+  threadpool_parallel_for(pool, n + 1, build_vertex_row, &job);
+  threadpool_parallel_for(pool, n, build_quad_row, &job);
+  for (job.level = 1; job.level < pyramid->levels; job.level++)
+    threadpool_parallel_for(pool, pyramid->sizes[job.level], build_level_row, &job);
+  free(columns);
+  pyramid->valid = 1;
+  pyramid->ms = threadpool_now_ms() - start;
+}
+
+typedef struct {
+  const HeightPyramid *pyramid;
+  float origin[3], direction[3];
+  float step, half;
+  float maxT;
+  HeightRayHit *hit;
+} RayQuery;
+
+// entry and exit of the ray through [lo, hi] along one axis, narrowing
+// [t0, t1]; 0 when they no longer overlap
+static int slab(float origin, float direction, float lo, float hi, float *t0, float *t1) {
+  if (fabsf(direction) < 1e-12f)
+    return origin >= lo && origin <= hi;
+  float a = (lo - origin) / direction, b = (hi - origin) / direction;
+  if (a > b) {
+    float swap = a;
+    a = b;
+    b = swap;
+  }
+  *t0 = fmaxf(*t0, a);
+  *t1 = fminf(*t1, b);
+  return *t0 <= *t1;
+}
+
+// entry parameter of the ray into cell (i, j) of level, or -1 on a miss
+static float cell_entry(RayQuery *q, int level, int i, int j) {
+  const HeightPyramid *p = q->pyramid;
+  int n = p->meshResolution;
+  const float *bounds = p->bounds[level] + 2 * ((size_t)j * p->sizes[level] + i);
+  int i1 = (i + 1) << level, j1 = (j + 1) << level;
+  float x0 = (i << level) * q->step - q->half, x1 = (i1 < n ? i1 : n) * q->step - q->half;
+  float z0 = (j << level) * q->step - q->half, z1 = (j1 < n ? j1 : n) * q->step - q->half;
+  float t0 = 0.0f, t1 = q->maxT;
+  q->hit->cells++;
+  if (!slab(q->origin[0], q->direction[0], x0 - BOX_EPSILON, x1 + BOX_EPSILON, &t0, &t1) ||
+      !slab(q->origin[2], q->direction[2], z0 - BOX_EPSILON, z1 + BOX_EPSILON, &t0, &t1) ||
+      !slab(q->origin[1], q->direction[1], bounds[0] - BOX_EPSILON, bounds[1] + BOX_EPSILON, &t0, &t1))
+    return -1.0f;
+  return t0;
+}
+
+// Moller-Trumbore, both faces; t of the hit or -1
+static float triangle_hit(const RayQuery *q, const float *a, const float *b, const float *c) {
+  float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+  const float *d = q->direction;
+  float p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+  float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+  if (fabsf(det) < 1e-12f)
+    return -1.0f;
+  float inv = 1.0f / det;
+  float s[3] = {q->origin[0] - a[0], q->origin[1] - a[1], q->origin[2] - a[2]};
+  float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+  if (u < -EDGE_EPSILON || u > 1.0f + EDGE_EPSILON)
+    return -1.0f;
+  float r[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+  float v = (d[0] * r[0] + d[1] * r[1] + d[2] * r[2]) * inv;
+  if (v < -EDGE_EPSILON || u + v > 1.0f + EDGE_EPSILON)
+    return -1.0f;
+  float t = (e2[0] * r[0] + e2[1] * r[1] + e2[2] * r[2]) * inv;
+  return t >= 0.0f && t <= q->maxT ? t : -1.0f;
+}
+
+// the two triangles of quad (i, j), split like set_up_grid
+static int quad_hit(RayQuery *q, int i, int j) {
+  const HeightPyramid *p = q->pyramid;
+  int stride = p->meshResolution + 1;
+  const float *h = p->vertices + (size_t)j * stride + i;
+  float x0 = i * q->step - q->half, x1 = x0 + q->step;
+  float z0 = j * q->step - q->half, z1 = z0 + q->step;
+  float topLeft[3] = {x0, h[0], z0}, topRight[3] = {x1, h[1], z0};
+  float bottomLeft[3] = {x0, h[stride], z1}, bottomRight[3] = {x1, h[stride + 1], z1};
+  float t = triangle_hit(q, topLeft, bottomLeft, topRight);
+  float second = triangle_hit(q, topRight, bottomLeft, bottomRight);
+  if (second >= 0.0f && (t < 0.0f || second < t))
+    t = second;
+  if (t < 0.0f)
+    return 0;
+  q->hit->t = t;
+  return 1;
+}
+
+static int visit(RayQuery *q, int level, int i, int j) {
+  if (level == 0)
+    return quad_hit(q, i, j);
+  // children nearest first; their columns are disjoint, so the first hit
+  // found is the nearest
+  int size = q->pyramid->sizes[level - 1];
+  int ci[4], cj[4], count = 0;
+  float entry[4];
+  for (int dj = 0; dj < 2; dj++)
+    for (int di = 0; di < 2; di++) {
+      int x = 2 * i + di, z = 2 * j + dj;
+      if (x >= size || z >= size)
+        continue;
+      float t = cell_entry(q, level - 1, x, z);
+      if (t < 0.0f)
+        continue;
+      int k = count++;
+      for (; k > 0 && entry[k - 1] > t; k--) {
+        entry[k] = entry[k - 1];
+        ci[k] = ci[k - 1];
+        cj[k] = cj[k - 1];
+      }
+      entry[k] = t;
+      ci[k] = x;
+      cj[k] = z;
+    }
+  for (int k = 0; k < count; k++)
+    if (visit(q, level - 1, ci[k], cj[k]))
+      return 1;
+  return 0;
+}
+
+int height_pyramid_raycast(const HeightPyramid *pyramid, const float origin[3], const float direction[3], float maxT,
+                           HeightRayHit *hit) {
+  memset(hit, 0, sizeof(*hit));
+  if (!pyramid->valid)
+    return 0;
+  RayQuery q = {pyramid, {origin[0], origin[1], origin[2]}, {direction[0], direction[1], direction[2]},
+                pyramid->worldSize / pyramid->meshResolution, 0.5f * pyramid->worldSize, maxT, hit};
+  int top = pyramid->levels - 1;
+  if (cell_entry(&q, top, 0, 0) < 0.0f || !visit(&q, top, 0, 0))
+    return 0;
+  for (int k = 0; k < 3; k++)
+    hit->position[k] = origin[k] + hit->t * direction[k];
+  hit->u = (hit->position[0] + q.half) / pyramid->worldSize;
+  hit->v = (hit->position[2] + q.half) / pyramid->worldSize;
+  return 1;
+}
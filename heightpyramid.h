@@ -0,0 +1,55 @@
+#ifndef HEIGHTPYRAMID_H
+#define HEIGHTPYRAMID_H
+
+#include "threadpool.h"
+
+// Min-max pyramid over the terrain at its finest, for ray queries on the CPU.
+//
+// The terrain is a grid of meshResolution^2 quads over [-worldSize / 2,
+// worldSize / 2] in x and z, split into two triangles each like set_up_grid's
+// patches. Vertex (i, j) sits at texture coordinate (i, j) / meshResolution
+// and is lifted by the bilinear sample of the heightmap there, the value /
+// maxHeight of compose.fs, as terrain.vs lifts the nodes it draws: the
+// vertex heights are rebuilt from the same texels the same way. Level 0
+// bounds every quad by its four vertices, which bound both triangles
+// exactly; every level above takes the min and max of 2x2 cells of the one
+// below, up to a single root cell.
+//
+// A ray walks the pyramid front to back: cells its box test misses are
+// skipped whole, the ones it enters are opened nearest first, and the first
+// triangle hit found is the nearest.
+
+#define HEIGHT_PYRAMID_MAX_LEVELS 16
+
+typedef struct {
+  int meshResolution;
+  float worldSize;
+  int valid; // built at least once
+  float *vertices; // (meshResolution + 1)^2 heights, row j = z
+  int levels;
+  int sizes[HEIGHT_PYRAMID_MAX_LEVELS];     // cells per side, sizes[0] = meshResolution
+  float *bounds[HEIGHT_PYRAMID_MAX_LEVELS]; // min, max per cell, row-major
+  double ms; // last build
+} HeightPyramid;
+
+typedef struct {
+  float t;           // along the ray, in units of its direction
+  float position[3]; // world
+  float u, v;        // across the mesh in [0, 1], x and z
+  int cells;         // pyramid cells tested, for reporting
+} HeightRayHit;
+
+// Returns 0 when out of memory or meshResolution is past the levels.
+int height_pyramid_init(HeightPyramid *pyramid, int meshResolution, float worldSize);
+void height_pyramid_free(HeightPyramid *pyramid);
+
+// texels: resolution^2 rendered heights, row j = z, as read back from the
+// heightmap's red channel.
+void height_pyramid_build(ThreadPool *pool, HeightPyramid *pyramid, const float *texels, int resolution);
+
+// Nearest hit of origin + t * direction with t in [0, maxT]. Returns 0 on a
+// miss or before the first build.
+int height_pyramid_raycast(const HeightPyramid *pyramid, const float origin[3], const float direction[3], float maxT,
+                           HeightRayHit *hit);
+
+#endif
@@ -1,4 +1,13 @@
 #include "dissonance.h"
+#include "dissonance_simd.h"
+#include "dissonance_lut.h"
+#include "chord.h"
+#include "valleyworker.h"
+#include "paircache.h"
+#include "fieldworker.h"
+#include "voicestate.h"
+#include "heightpyramid.h"
+#include "cdlod.h"
 #include "raylib.h"
 #include "raymath.h"
 #include "rlgl.h"
@@ -9,14 +18,20 @@
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio.h"
 
-// Audio structures
+// Audio structures. sineWave belongs to the audio thread once the device
+// runs; the main loop only talks to it through the snapshots in audioState.
 ma_device device;
 ma_waveform sineWave;
-bool isPlaying = false;
+VoiceState audioState;
+bool isPlaying = false; // main thread, published as VoiceSnapshot.playing
 
-// Audio data callback function
+// Audio data callback function. Reads the newest snapshot wait-free, never
+// blocks on the main loop.
 void data_callback(ma_device *pDevice, void *pOutput, const void *pInput, ma_uint32 frameCount) {
-  if (isPlaying) {
+  const VoiceSnapshot *snapshot = voice_state_read((VoiceState *)pDevice->pUserData);
+  if (snapshot->playing) {
+    if (sineWave.config.frequency != snapshot->toneFreq)
+      ma_waveform_set_frequency(&sineWave, snapshot->toneFreq);
     ma_waveform_read_pcm_frames(&sineWave, pOutput, frameCount, NULL);
   } else {
     // Output silence when not playing
@@ -24,8 +39,35 @@ void data_callback(ma_device *pDevice, void *pOutput, const void *pInput, ma_uin
   }
 }
 
-void handle_input(Camera3D *cameraMesh, Voices *voices, float otherVoicesDissonance, float worldPlaneSize,
-                  float maxHeight) {
+// progressive cross bake, see the main loop
+#define CROSS_COARSE_FACTOR 8
+#define CROSS_BANDS 8
+
+// 'V' cycles how the terrain is drawn: the displaced grid, a raymarch of the
+// same heightmap through its maximum mipmap, or a raymarch of the field
+// itself with no heightmap (both dissonance.fs)
+typedef enum { RENDER_MESH = 0, RENDER_RAYMARCH, RENDER_ANALYTIC, RENDER_MODE_COUNT } RenderMode;
+const char *renderModeNames[RENDER_MODE_COUNT] = {"mesh", "raymarch", "analytic"};
+
+// Highest the XZ field can reach: a pair term w g(d) never exceeds w times
+// the peak of g, the fixed pairs add the offset. The analytic raymarch clips
+// its rays to it.
+float field_ceiling(const Voices *voices, float otherVoicesDissonance) {
+  const float s1 = 3.5f, s2 = 5.75f;
+  float peak = logf(s2 / s1) / (s2 - s1);
+  peak = expf(-s1 * peak) - expf(-s2 * peak);
+  float weight = 0.0f;
+  int axisEnd = voices_axis_end(voices), total = voices_partial_total(voices);
+  for (int i = 0; i < axisEnd; i++)
+    for (int j = i + 1; j < total; j++)
+      weight += fminf(voices->amps[i], voices->amps[j]);
+  return otherVoicesDissonance + peak * weight;
+}
+
+// Moves the camera and picks the terrain under the mouse into hover; false
+// when the mouse is off the terrain or the pyramid is not built yet.
+bool handle_input(Camera3D *cameraMesh, Voices *voices, const DissonancePlan *plan, float worldPlaneSize,
+                  const HeightPyramid *pyramid, HeightRayHit *hover) {
   UpdateCameraPro(cameraMesh,
                   (Vector3){IsKeyDown(KEY_W) * 0.1f - IsKeyDown(KEY_S) * 0.1f,
                             IsKeyDown(KEY_D) * 0.1f - IsKeyDown(KEY_A) * 0.1f,
@@ -34,49 +76,25 @@ void handle_input(Camera3D *cameraMesh, Voices *voices, float otherVoicesDissona
                             IsKeyDown(KEY_DOWN) * 0.5f - IsKeyDown(KEY_UP) * 0.5f, 0.0f},
                   GetMouseWheelMove() * 2.0f);
 
-  if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT)) {
-    // Sample the terrain at mouse position - read-only operation
-    Vector2 mousePos = GetMousePosition();
-    Ray ray = GetMouseRay(mousePos, *cameraMesh);
-
-    bool hit = false;
-    Vector3 intersectionPoint = {0};
-    float t = 0.0f;
-    Vector3 p = {0};
-
-    // Simple raymarching to find terrain intersection
-    for (int i = 0; i < 1000; i++) {
-      p = Vector3Add(ray.position, Vector3Scale(ray.direction, t));
-
-      // Get the terrain height at this XZ position
-      float terrainHeight =
-          get_xz_dissonance(voices, p.x + 0.5 * worldPlaneSize, p.z + 0.5 * worldPlaneSize, otherVoicesDissonance);
-
-      // Check if ray height is below terrain height (considering height multiplier)
-      if (p.y <= terrainHeight * maxHeight) { // 50.0f is the height multiplier used in rendering
-        intersectionPoint = p;
-        hit = true;
-        break;
-      }
-
-      t += 0.1f; // Step size for raymarching
-      if (t > 200.0f) {
-        break; // Maximum ray distance
-      }
-    }
+  // the terrain under the mouse, picked against the drawn triangles
+  Ray ray = GetMouseRay(GetMousePosition(), *cameraMesh);
+  float origin[3] = {ray.position.x, ray.position.y, ray.position.z};
+  float direction[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+  bool hovering = height_pyramid_raycast(pyramid, origin, direction, 200.0f, hover);
 
-    if (hit) {
+  if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT)) {
+    if (hovering) {
       // Convert terrain coordinates (-2.0 to +2.0) to dissonance coordinates (0.0 to 4.0)
-      float coeff_x = intersectionPoint.x + 0.5 * worldPlaneSize; // Convert from -2..+2 to 0..4
-      float coeff_z = intersectionPoint.z + 0.5 * worldPlaneSize; // Convert from -2..+2 to 0..4
-      float dissonance = get_xz_dissonance(voices, coeff_x, coeff_z, otherVoicesDissonance);
+      float coeff_x = hover->position[0] + 0.5 * worldPlaneSize; // Convert from -2..+2 to 0..4
+      float coeff_z = hover->position[2] + 0.5 * worldPlaneSize; // Convert from -2..+2 to 0..4
+      float dissonance = dissonance_plan_xz(plan, coeff_x, coeff_z);
 
       printf("Terrain Sample (Read-Only):\n");
-      printf("  Position:      x=%.3f, z=%.3f, y=%.3f\n", intersectionPoint.x, intersectionPoint.z,
-             intersectionPoint.y);
+      printf("  Position:      x=%.3f, z=%.3f, y=%.3f\n", hover->position[0], hover->position[2],
+             hover->position[1]);
       printf("  Coefficients:  coeff_x=%.3f, coeff_z=%.3f (converted to 0-4 range)\n", coeff_x, coeff_z);
       printf("  Frequencies:   f_x=%.2f Hz, f_z=%.2f Hz\n", voices->freqs[0] * coeff_x,
-             voices->freqs[MAX_PARTIALS] * coeff_z);
+             voices->freqs[voices->offsets[1]] * coeff_z);
       printf("  Dissonance:    %.6f\n", dissonance);
     } else {
       printf("No terrain intersection found.\n\n");
@@ -92,6 +110,7 @@ void handle_input(Camera3D *cameraMesh, Voices *voices, float otherVoicesDissona
       printf("Sine wave stopped\n");
     }
   }
+  return hovering;
 }
 
 int set_up_audio()
@@ -102,7 +121,8 @@ int set_up_audio()
   deviceConfig.playback.channels = 2;
   deviceConfig.sampleRate = 44100;
   deviceConfig.dataCallback = data_callback;
-  deviceConfig.pUserData = NULL;
+  deviceConfig.pUserData = &audioState;
+  voice_state_init(&audioState);
 
   if (ma_device_init(NULL, &deviceConfig, &device) != MA_SUCCESS) {
     printf("Failed to initialize audio device\n");
@@ -120,53 +140,34 @@ int set_up_audio()
   return (1);
 }
 
-unsigned int set_up_grid(GLuint *terrainVAO, GLuint *terrainVBO, GLuint *terrainEBO, unsigned int meshResolution,
-                         float worldPlaneSize) {
-  glGenVertexArrays(1, terrainVAO);
-  glGenBuffers(1, terrainVBO);
-  glGenBuffers(1, terrainEBO);
-
-  // Generate grid vertices
-  int numVertices = (meshResolution + 1) * (meshResolution + 1);
-  int numIndices = meshResolution * meshResolution * 6;
-
-  float *vertices =
-      (float *)malloc(numVertices * 8 * sizeof(float)); // 8 floats per vertex: pos(3) + normal(3) + texcoord(2)
-  unsigned int *indices = (unsigned int *)malloc(numIndices * sizeof(unsigned int));
-
-  // Generate vertices
-  float step = worldPlaneSize / meshResolution;
-  float halfSize = worldPlaneSize * 0.5f;
-  int vertexIndex = 0;
-
-  for (unsigned int z = 0; z <= meshResolution; z++) {
-    for (unsigned int x = 0; x <= meshResolution; x++) {
-      // Position (x, 0, z) - y will be sampled from texture in shader
-      vertices[vertexIndex * 8 + 0] = x * step - halfSize; // x
-      vertices[vertexIndex * 8 + 1] = 0.0f;                // y (will be displaced by shader)
-      vertices[vertexIndex * 8 + 2] = z * step - halfSize; // z
-
-      // Normal (will be calculated in shader)
-      vertices[vertexIndex * 8 + 3] = 0.0f; // nx
-      vertices[vertexIndex * 8 + 4] = 1.0f; // ny
-      vertices[vertexIndex * 8 + 5] = 0.0f; // nz
-
-      // Texture coordinates
-      vertices[vertexIndex * 8 + 6] = (float)x / meshResolution; // u
-      vertices[vertexIndex * 8 + 7] = (float)z / meshResolution; // v
-
-      vertexIndex++;
-    }
-  }
-
-  // Generate indices
+// The terrain, made without vertex data: every selected CDLOD node is one
+// instance of a square patch whose indices are the patch's own vertex
+// numbers, so they fit in 16 bits and the post-transform cache still shares
+// vertices between neighbouring triangles. terrain.vs places each vertex from
+// gl_VertexID and the node, the only attribute, streamed per frame.
+typedef struct {
+  GLuint vao;
+  GLuint indexBuffer;
+  GLuint nodeBuffer;
+  int patchQuads; // quads per side of a patch
+  int patchIndices;
+  int nodeCapacity;
+} TerrainGrid;
+
+void set_up_grid(TerrainGrid *grid, int patchQuads, int nodeCapacity) {
+  grid->patchQuads = patchQuads;
+  grid->patchIndices = patchQuads * patchQuads * 6;
+  grid->nodeCapacity = nodeCapacity;
+
+  int row = patchQuads + 1;
+  unsigned short *indices = (unsigned short *)malloc(grid->patchIndices * sizeof(unsigned short));
   int indexIndex = 0;
-  for (unsigned int z = 0; z < meshResolution; z++) {
-    for (unsigned int x = 0; x < meshResolution; x++) {
-      int topLeft = z * (meshResolution + 1) + x;
-      int topRight = topLeft + 1;
-      int bottomLeft = (z + 1) * (meshResolution + 1) + x;
-      int bottomRight = bottomLeft + 1;
+  for (int z = 0; z < patchQuads; z++) {
+    for (int x = 0; x < patchQuads; x++) {
+      unsigned short topLeft = (unsigned short)(z * row + x);
+      unsigned short topRight = topLeft + 1;
+      unsigned short bottomLeft = (unsigned short)((z + 1) * row + x);
+      unsigned short bottomRight = bottomLeft + 1;
 
       // First triangle
       indices[indexIndex++] = topLeft;
@@ -180,33 +181,84 @@ unsigned int set_up_grid(GLuint *terrainVAO, GLuint *terrainVBO, GLuint *terrain
     }
   }
 
-  // Upload to GPU
-  glBindVertexArray(*terrainVAO);
-
-  glBindBuffer(GL_ARRAY_BUFFER, *terrainVBO);
-  glBufferData(GL_ARRAY_BUFFER, numVertices * 8 * sizeof(float), vertices, GL_STATIC_DRAW);
-
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *terrainEBO);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned int), indices, GL_STATIC_DRAW);
-
-  // Set up vertex attributes to match shader expectations
-  // Position (location 0) - matches shader's aPos
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)0);
+  glGenVertexArrays(1, &grid->vao);
+  glGenBuffers(1, &grid->indexBuffer);
+  glGenBuffers(1, &grid->nodeBuffer);
+  glBindVertexArray(grid->vao);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, grid->indexBuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, grid->patchIndices * sizeof(unsigned short), indices, GL_STATIC_DRAW);
+
+  // Node (location 0) - matches shader's node, one per instance
+  glBindBuffer(GL_ARRAY_BUFFER, grid->nodeBuffer);
+  glBufferData(GL_ARRAY_BUFFER, nodeCapacity * sizeof(CdlodNode), NULL, GL_STREAM_DRAW);
+  glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(CdlodNode), (void *)0);
+  glVertexAttribDivisor(0, 1);
   glEnableVertexAttribArray(0);
 
-  // Texture coordinates (location 1) - matches shader's aTexCoords
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(6 * sizeof(float)));
-  glEnableVertexAttribArray(1);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-  // Note: Normal (location 2) is not used by shader - it calculates normals from heightmap
+  free(indices);
+}
 
+void draw_grid(const TerrainGrid *grid, const CdlodNode *nodes, int count) {
+  // orphaned first, so the upload never waits on last frame's draw
+  glBindBuffer(GL_ARRAY_BUFFER, grid->nodeBuffer);
+  glBufferData(GL_ARRAY_BUFFER, grid->nodeCapacity * sizeof(CdlodNode), NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(CdlodNode), nodes);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glBindVertexArray(grid->vao);
+  glDrawElementsInstanced(GL_TRIANGLES, grid->patchIndices, GL_UNSIGNED_SHORT, 0, count);
   glBindVertexArray(0);
+}
 
-  // Clean up CPU memory
-  free(vertices);
-  free(indices);
+void unload_grid(TerrainGrid *grid) {
+  glDeleteVertexArrays(1, &grid->vao);
+  glDeleteBuffers(1, &grid->indexBuffer);
+  glDeleteBuffers(1, &grid->nodeBuffer);
+}
+
+// A moved slider voice is taken out of the set and appended again at its
+// new pitch: only its row of the pair cache is recomputed, the others keep
+// theirs. The fixed voices stay first, the field does not depend on the
+// order of the rest.
+void retune_slider_voice(PairCache *cache, Voices *voices, int sliderVoice[2], int slider, float baseFreq) {
+  int voice = sliderVoice[slider];
+  pair_cache_remove_voice(cache, voices, voice);
+  if (sliderVoice[1 - slider] > voice)
+    sliderVoice[1 - slider]--;
+  pair_cache_add_voice(cache, voices, baseFreq, 1.0f, DEFAULT_PARTIALS);
+  sliderVoice[slider] = voices->count - 1;
+}
 
-  return numIndices;
+// Packed partials for baking.fs: one RGBA32F texel each (.r frequency, .g
+// amplitude), SPECTRUM_TEXTURE_WIDTH per row. Recreated when the partial
+// capacity grows.
+#define SPECTRUM_TEXTURE_WIDTH 256
+
+void upload_spectrum(Texture2D *texture, const Voices *voices) {
+  int width = SPECTRUM_TEXTURE_WIDTH;
+  int height = (voices->partialCapacity + width - 1) / width;
+  if (height < 1)
+    height = 1;
+  float *texels = (float *)calloc((size_t)width * height * 4, sizeof(float));
+  if (!texels)
+    return;
+  for (int i = 0; i < voices_partial_total(voices); i++) {
+    texels[i * 4 + 0] = voices->freqs[i];
+    texels[i * 4 + 1] = voices->amps[i];
+  }
+  if (texture->id == 0 || texture->width != width || texture->height != height) {
+    if (texture->id != 0)
+      UnloadTexture(*texture);
+    Image image = {texels, width, height, 1, PIXELFORMAT_UNCOMPRESSED_R32G32B32A32};
+    *texture = LoadTextureFromImage(image);
+    SetTextureFilter(*texture, TEXTURE_FILTER_POINT);
+  } else {
+    UpdateTexture(*texture, texels);
+  }
+  free(texels);
 }
 
 RenderTexture2D LoadRenderTextureFloat(int width, int height) {
@@ -216,10 +268,11 @@ RenderTexture2D LoadRenderTextureFloat(int width, int height) {
   if (target.id > 0) {
     rlEnableFramebuffer(target.id);
 
-    target.texture.id = rlLoadTexture(NULL, width, height, PIXELFORMAT_UNCOMPRESSED_R32, 1);
+    // RGBA: baking.fs and compose.fs write (height, d/dx, d/dz)
+    target.texture.id = rlLoadTexture(NULL, width, height, PIXELFORMAT_UNCOMPRESSED_R32G32B32A32, 1);
     target.texture.width = width;
     target.texture.height = height;
-    target.texture.format = PIXELFORMAT_UNCOMPRESSED_R32;
+    target.texture.format = PIXELFORMAT_UNCOMPRESSED_R32G32B32A32;
     target.texture.mipmaps = 1;
 
     rlFramebufferAttach(target.id, target.texture.id, RL_ATTACHMENT_COLOR_CHANNEL0, RL_ATTACHMENT_TEXTURE2D, 0);
@@ -234,6 +287,130 @@ RenderTexture2D LoadRenderTextureFloat(int width, int height) {
   return target;
 }
 
+// Copies the heightmap's red channel back for the picking pyramid without
+// stalling the main loop: glReadPixels into a pixel pack buffer returns at
+// once, a fence tells when the copy has landed.
+typedef struct {
+  GLuint buffer;
+  GLsync fence; // 0 while no copy is in flight
+  bool stale;   // the heightmap was drawn again since the last copy started
+} HeightReadback;
+
+void heightmap_readback_init(HeightReadback *readback, int resolution) {
+  readback->fence = 0;
+  readback->stale = true;
+  glGenBuffers(1, &readback->buffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+  glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)resolution * resolution * sizeof(float), NULL, GL_STREAM_READ);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void heightmap_readback_start(HeightReadback *readback, RenderTexture2D heightmap) {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, heightmap.id);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+  glReadPixels(0, 0, heightmap.texture.width, heightmap.texture.height, GL_RED, GL_FLOAT, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  readback->stale = false;
+}
+
+// Rebuilds the pyramid and the terrain's node bounds and hands the heights to
+// the valley worker once the copy in flight has landed; true then.
+bool heightmap_readback_poll(HeightReadback *readback, ThreadPool *pool, HeightPyramid *pyramid, Cdlod *lod,
+                             ValleyWorker *valleyWorker, float maxHeight, int resolution) {
+  if (!readback->fence)
+    return false;
+  GLenum state = glClientWaitSync(readback->fence, 0, 0);
+  if (state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED)
+    return false;
+  glDeleteSync(readback->fence);
+  readback->fence = 0;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+  const float *texels = (const float *)glMapBufferRange(
+      GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)resolution * resolution * sizeof(float), GL_MAP_READ_BIT);
+  if (texels) {
+    height_pyramid_build(pool, pyramid, texels, resolution);
+    cdlod_build_bounds(lod, texels, resolution);
+    valley_worker_submit_heights(valleyWorker, texels, maxHeight);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  return texels != NULL;
+}
+
+// Maximum mipmap of the heightmap for the raymarch render mode, built level
+// by level by maxmip.fs. Sizes round down like glGenerateMipmap's, one
+// framebuffer is pointed at each level in turn.
+#define MAX_MIPMAP_LEVELS 16
+
+typedef struct {
+  GLuint texture;
+  GLuint framebuffer;
+  int levels;
+  int sizes[MAX_MIPMAP_LEVELS];
+} MaxMipmap;
+
+MaxMipmap load_max_mipmap(int resolution) {
+  MaxMipmap mip = {0};
+  glGenTextures(1, &mip.texture);
+  glBindTexture(GL_TEXTURE_2D, mip.texture);
+  for (int size = resolution; size >= 1 && mip.levels < MAX_MIPMAP_LEVELS; size /= 2) {
+    mip.sizes[mip.levels] = size;
+    glTexImage2D(GL_TEXTURE_2D, mip.levels++, GL_R32F, size, size, 0, GL_RED, GL_FLOAT, NULL);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mip.levels - 1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glGenFramebuffers(1, &mip.framebuffer);
+  return mip;
+}
+
+void build_max_mipmap(MaxMipmap *mip, Shader shader, RenderTexture2D heightmap) {
+  int sourceLoc = GetShaderLocation(shader, "source");
+  int sourceLevelLoc = GetShaderLocation(shader, "sourceLevel");
+  int sourceSizeLoc = GetShaderLocation(shader, "sourceSize");
+  for (int level = 0; level < mip->levels; level++) {
+    // each pass reads only the level below the one it writes, so the
+    // texture is never sampled where it is drawn
+    int sourceLevel = level - 1;
+    int sourceSize[2] = {level ? mip->sizes[level - 1] : heightmap.texture.width,
+                         level ? mip->sizes[level - 1] : heightmap.texture.height};
+    Texture2D source = heightmap.texture;
+    if (level > 0) {
+      source = (Texture2D){mip->texture, sourceSize[0], sourceSize[1], 1, PIXELFORMAT_UNCOMPRESSED_R32};
+      glBindTexture(GL_TEXTURE_2D, mip->texture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+      glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    RenderTexture2D target = {mip->framebuffer,
+                              {mip->texture, mip->sizes[level], mip->sizes[level], 1, PIXELFORMAT_UNCOMPRESSED_R32},
+                              {0}};
+    BeginTextureMode(target);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mip->texture, level);
+    BeginShaderMode(shader);
+    SetShaderValueTexture(shader, sourceLoc, source);
+    SetShaderValue(shader, sourceLevelLoc, &sourceLevel, SHADER_UNIFORM_INT);
+    SetShaderValue(shader, sourceSizeLoc, sourceSize, SHADER_UNIFORM_IVEC2);
+    DrawRectangle(0, 0, mip->sizes[level], mip->sizes[level], WHITE);
+    EndShaderMode();
+    EndTextureMode();
+  }
+  glBindTexture(GL_TEXTURE_2D, mip->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mip->levels - 1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void unload_max_mipmap(MaxMipmap *mip) {
+  glDeleteFramebuffers(1, &mip->framebuffer);
+  glDeleteTextures(1, &mip->texture);
+}
+
 int main(void) {
   /* --- Initialization --- */
   const int screenWidth = 1280;
@@ -242,6 +419,7 @@ int main(void) {
   const float worldPlaneSize = 4.0f;
 
   if (!set_up_audio()) return 1;
+  printf("Dissonance kernel: %s\n", dissonance_simd_isa_name(dissonance_simd_isa()));
 
   InitWindow(screenWidth, screenHeight, "Dissonance Visualizer");
   SetTargetFPS(60);
@@ -262,13 +440,31 @@ int main(void) {
     return 1;
   }
 
-  int baking_numVoicesLoc = GetShaderLocation(bakingShader, "numVoices");
-  int baking_numPartialsLoc = GetShaderLocation(bakingShader, "numPartials");
-  int baking_voiceFreqsLoc = GetShaderLocation(bakingShader, "voiceFreqs");
-  int baking_voiceAmplitudesLoc = GetShaderLocation(bakingShader, "voiceAmplitudes");
+  int baking_partialOffsetsLoc = GetShaderLocation(bakingShader, "partialOffsets");
+  int baking_spectrumLoc = GetShaderLocation(bakingShader, "spectrum");
   int baking_otherVoicesDissonanceLoc = GetShaderLocation(bakingShader, "otherVoicesDissonance");
   int baking_viewIntsLoc = GetShaderLocation(bakingShader, "viewInts");
   int baking_maxHeightLoc = GetShaderLocation(bakingShader, "maxHeight");
+  int baking_bakeTermLoc = GetShaderLocation(bakingShader, "bakeTerm");
+  int baking_evalModeLoc = GetShaderLocation(bakingShader, "evalMode");
+  int baking_cbwLutLoc = GetShaderLocation(bakingShader, "cbwLut");
+  int baking_kernelLutLoc = GetShaderLocation(bakingShader, "kernelLut");
+  int baking_lowerTriangleLoc = GetShaderLocation(bakingShader, "lowerTriangle");
+
+  Shader composeShader = LoadShader(0, "compose.fs");
+  if (!IsShaderValid(composeShader)) {
+    TraceLog(LOG_ERROR, "Failed to load compose shader");
+    return 1;
+  }
+
+  int compose_crossTermLoc = GetShaderLocation(composeShader, "crossTerm");
+  int compose_curveXLoc = GetShaderLocation(composeShader, "curveX");
+  int compose_curveZLoc = GetShaderLocation(composeShader, "curveZ");
+  int compose_offsetLoc = GetShaderLocation(composeShader, "offset");
+  int compose_maxHeightLoc = GetShaderLocation(composeShader, "maxHeight");
+  int compose_crossCoarseLoc = GetShaderLocation(composeShader, "crossCoarse");
+  int compose_refinedRowsLoc = GetShaderLocation(composeShader, "refinedRows");
+  int compose_mirrorCrossLoc = GetShaderLocation(composeShader, "mirrorCross");
 
   Shader terrainShader = LoadShader("terrain.vs", "terrain.fs");
   if (!IsShaderValid(terrainShader)) {
@@ -284,28 +480,113 @@ int main(void) {
   int terrain_textureSizeLoc = GetShaderLocation(terrainShader, "textureSize");
   int terrain_lightColorLoc = GetShaderLocation(terrainShader, "lightColor");
   int terrain_worldPlaneSizeLoc = GetShaderLocation(terrainShader, "worldPlaneSize");
+  int terrain_patchQuadsLoc = GetShaderLocation(terrainShader, "patchQuads");
+  int terrain_cameraPosLoc = GetShaderLocation(terrainShader, "cameraPos");
+  int terrain_morphRangesLoc = GetShaderLocation(terrainShader, "morphRanges");
   // int terrain_maxHeightLoc = GetShaderLocation(terrainShader, "maxHeight");
 
+  Shader raymarchShader = LoadShader("dissonance.vs", "dissonance.fs");
+  Shader maxMipShader = LoadShader(0, "maxmip.fs");
+  if (!IsShaderValid(raymarchShader) || !IsShaderValid(maxMipShader)) {
+    TraceLog(LOG_ERROR, "Failed to load raymarch shaders");
+    return 1;
+  }
+
+  int raymarch_invViewLoc = GetShaderLocation(raymarchShader, "invView");
+  int raymarch_invProjLoc = GetShaderLocation(raymarchShader, "invProj");
+  int raymarch_mvpLoc = GetShaderLocation(raymarchShader, "mvp");
+  int raymarch_modelViewLoc = GetShaderLocation(raymarchShader, "modelView");
+  int raymarch_cameraPosLoc = GetShaderLocation(raymarchShader, "cameraPos");
+  int raymarch_heightmapLoc = GetShaderLocation(raymarchShader, "heightmap");
+  int raymarch_maxMipLoc = GetShaderLocation(raymarchShader, "maxMip");
+  int raymarch_maxMipLevelsLoc = GetShaderLocation(raymarchShader, "maxMipLevels");
+  int raymarch_worldPlaneSizeLoc = GetShaderLocation(raymarchShader, "worldPlaneSize");
+  int raymarch_viewIntsLoc = GetShaderLocation(raymarchShader, "viewInts");
+  int raymarch_lightPosLoc = GetShaderLocation(raymarchShader, "lightPos");
+  int raymarch_lightColorLoc = GetShaderLocation(raymarchShader, "lightColor");
+  int raymarch_heightMultiplierLoc = GetShaderLocation(raymarchShader, "heightMultiplier");
+  int raymarch_analyticLoc = GetShaderLocation(raymarchShader, "analytic");
+  int raymarch_partialOffsetsLoc = GetShaderLocation(raymarchShader, "partialOffsets");
+  int raymarch_spectrumLoc = GetShaderLocation(raymarchShader, "spectrum");
+  int raymarch_otherVoicesDissonanceLoc = GetShaderLocation(raymarchShader, "otherVoicesDissonance");
+  int raymarch_maxHeightLoc = GetShaderLocation(raymarchShader, "maxHeight");
+  int raymarch_fieldCeilingLoc = GetShaderLocation(raymarchShader, "fieldCeiling");
+  int raymarch_pixelAngleLoc = GetShaderLocation(raymarchShader, "pixelAngle");
+
   RenderTexture2D target = LoadRenderTexture(screenWidth, screenHeight);
   RenderTexture2D heightmapTexture = LoadRenderTextureFloat(heightmapResolution, heightmapResolution);
   SetTextureFilter(heightmapTexture.texture, TEXTURE_FILTER_BILINEAR);
   SetTextureWrap(heightmapTexture.texture, TEXTURE_WRAP_CLAMP);
-
-  const int meshResolution = 1200;
-
-  // Create OpenGL buffers for terrain grid
-  GLuint terrainVAO, terrainVBO, terrainEBO;
-  unsigned int numIndices = set_up_grid(&terrainVAO, &terrainVBO, &terrainEBO, meshResolution, worldPlaneSize);
+  // rebuilt after compose redraws the heightmap, while it is drawn
+  MaxMipmap maxMip = load_max_mipmap(heightmapResolution);
+  bool maxMipStale = true;
+  RenderMode renderMode = RENDER_MESH;
+  GLuint emptyVAO; // the full-screen triangle of dissonance.vs has no attributes
+  glGenVertexArrays(1, &emptyVAO);
+
+  // Separable field: the cross term is baked on the GPU only when the x/z
+  // spectra change, the 1D curves are built on the field worker's thread and
+  // uploaded when a snapshot lands. Between snapshots the last heightmap
+  // stays up.
+  FieldWorker *fieldWorker = field_worker_create(heightmapResolution, worldPlaneSize);
+  if (!fieldWorker) {
+    TraceLog(LOG_ERROR, "Failed to start the field worker");
+    return 1;
+  }
+  float fieldOffset = 0.0f; // of the snapshot being composed
+  RenderTexture2D crossTexture = LoadRenderTextureFloat(heightmapResolution, heightmapResolution);
+  // Progressive cross bake: after a change the cross term is first baked at
+  // 1/CROSS_COARSE_FACTOR resolution, which compose upsamples, then at full
+  // resolution in CROSS_BANDS row bands, one per frame. Compose takes the
+  // rows below refinedRows from the full bake, so the terrain never has holes
+  // and a change costs one coarse pass before it shows.
+  const int coarseResolution = heightmapResolution / CROSS_COARSE_FACTOR;
+  RenderTexture2D crossCoarseTexture = LoadRenderTextureFloat(coarseResolution, coarseResolution);
+  SetTextureFilter(crossCoarseTexture.texture, TEXTURE_FILTER_BILINEAR);
+  SetTextureWrap(crossCoarseTexture.texture, TEXTURE_WRAP_CLAMP);
+  int crossPass = CROSS_BANDS + 1; // next pass: 0 coarse, 1..CROSS_BANDS the bands, past that done
+  int refinedRows = heightmapResolution;
+  // with one spectrum on both axes only the triangle x <= z is baked and
+  // compose mirrors it, every band then stops at the diagonal. The coarse
+  // pass still bakes the whole square: compose filters it bilinearly, and a
+  // filter footprint on the diagonal would reach into unbaked texels.
+  int mirrorCross = 0;
+  // row 0 the curve, row 1 its slope
+  float *curveBlank = (float *)calloc(2 * heightmapResolution, sizeof(float));
+  Image curveImage = {curveBlank, heightmapResolution, 2, 1, PIXELFORMAT_UNCOMPRESSED_R32};
+  Texture2D curveXTexture = LoadTextureFromImage(curveImage);
+  Texture2D curveZTexture = LoadTextureFromImage(curveImage);
+  free(curveBlank);
+
+  // drawn at the detail the view needs, the heightmap's resolution only sets
+  // the finest level
+  const int terrainPatchQuads = 32;
+  const float terrainPixelError = 2.0f;
+  Cdlod terrainLod;
+  if (!cdlod_init(&terrainLod, worldPlaneSize, terrainPatchQuads, heightmapResolution)) {
+    TraceLog(LOG_ERROR, "Failed to allocate the terrain quadtree");
+    return 1;
+  }
+  TerrainGrid terrainGrid;
+  set_up_grid(&terrainGrid, terrainPatchQuads, terrainLod.capacity);
+  int terrainNodes = 0;
 
   /* --- Voice Data Setup --- */
   // voices really contain the spectra at base_freq
-  Voices voices = {0};
-  int numPartials = MAX_PARTIALS;
+  Arena voiceArena;
+  arena_init(&voiceArena, ARENA_DEFAULT_BLOCK);
+  Voices voices;
+  if (!voices_init(&voices, &voiceArena, DEFAULT_VOICES, DEFAULT_VOICES * DEFAULT_PARTIALS)) {
+    TraceLog(LOG_ERROR, "Failed to allocate voices");
+    return 1;
+  }
   float base_freq = 220.0f;
-  generate_harmonic_series(&voices, base_freq, 1.0f, MAX_PARTIALS);
-  generate_harmonic_series(&voices, base_freq, 1.0f, MAX_PARTIALS);
-  generate_harmonic_series(&voices, base_freq, 1.0f, MAX_PARTIALS);
-  // for (int i = 0; i < voices.count * numPartials; i++) {
+  generate_harmonic_series(&voices, base_freq, 1.0f, DEFAULT_PARTIALS);
+  generate_harmonic_series(&voices, base_freq, 1.0f, DEFAULT_PARTIALS);
+  generate_harmonic_series(&voices, base_freq, 1.0f, DEFAULT_PARTIALS);
+  Texture2D spectrumTexture = {0};
+  Texture2D fieldSpectrumTexture = {0}; // the current voices, for the analytic raymarch
+  // for (int i = 0; i < voices_partial_total(&voices); i++) {
   //   printf("freq: %f, amp: %f, i: %d\n", voices.freqs[i], voices.amps[i], i);
   // }
 
@@ -315,29 +596,251 @@ int main(void) {
   float voice4 = 1.0;
   float voice5 = 1.0;
 
+  // voice-pair sums, only the voices the sliders retuned are recomputed
+  PairCache pairCache;
+  pair_cache_init(&pairCache, DISS_AMP_MIN);
+  // the slider voices follow the fixed ones; sliderVoice is where each sits
+  // now and sliderRatio the ratio it was built with
+  int sliderVoice[2] = {3, 4};
+  float sliderRatio[2] = {voice4, voice5};
+  pair_cache_add_voice(&pairCache, &voices, base_freq * voice4, 1.0f, DEFAULT_PARTIALS);
+  pair_cache_add_voice(&pairCache, &voices, base_freq * voice5, 1.0f, DEFAULT_PARTIALS);
+  // the same voices compiled for point queries (picking, minima), recompiled
+  // only when a slider or the eval mode changed them
+  DissonancePlan viewPlan;
+  dissonance_plan_init(&viewPlan, DISS_AMP_MIN, 0.0f);
+
+  // 'L' cycles exact / poly / cbw lut / kernel lut, tables are uploaded on
+  // first use
+  int evalMode = dissonance_eval_mode();
+  Texture2D cbwLutTexture = {0};
+  Texture2D kernelLutTexture = {0};
+
+  // 'M' marks the local minima of the field. While shown they are tracked
+  // across changes on the valley worker, each valley keeps its id (and
+  // colour); the tracker runs once per change of the voices and once per
+  // heightmap read back, whose basins seed the births
+  ThreadPool *pool = threadpool_shared(); // process-wide, shared by every subsystem
+  MinimaSettings minimaSettings = minima_default_settings(worldPlaneSize);
+  ValleyWorker *valleyWorker = valley_worker_create(pool, &minimaSettings, heightmapResolution);
+  if (!valleyWorker) {
+    TraceLog(LOG_ERROR, "Failed to start the valley worker");
+    return 1;
+  }
+  const ValleySnapshot *valleys = NULL; // drawn until the next one lands
+  bool showMinima = false;
+  // 'G' searches for the best chord in the background, pressed again cancels
+  ChordSearchTask *chordTask = NULL;
+
+  // the terrain on the CPU at its finest, one quad per texel, for picking;
+  // rebuilt from an asynchronous readback whenever compose redraws the
+  // heightmap
+  HeightPyramid pyramid;
+  if (!height_pyramid_init(&pyramid, heightmapResolution, worldPlaneSize))
+    TraceLog(LOG_WARNING, "Failed to allocate the height pyramid, picking is off");
+  HeightReadback readback;
+  heightmap_readback_init(&readback, heightmapResolution);
+  HeightRayHit hover;
+
   while (!WindowShouldClose()) {
-    voices.count = 3;
-    generate_harmonic_series(&voices, base_freq * voice4, 1.0f, MAX_PARTIALS);
-    generate_harmonic_series(&voices, base_freq * voice5, 1.0f, MAX_PARTIALS);
-    float otherVoicesDissonance = calculate_dissonance(&voices, 2);
-
-    handle_input(&cameraMesh, &voices, otherVoicesDissonance, worldPlaneSize, maxHeight);
-
-    BeginTextureMode(heightmapTexture);
-    ClearBackground(BLANK);
-    BeginShaderMode(bakingShader);
-    SetShaderValue(bakingShader, baking_numVoicesLoc, &voices.count, SHADER_UNIFORM_INT);
-    SetShaderValue(bakingShader, baking_numPartialsLoc, &numPartials, SHADER_UNIFORM_INT);
-    SetShaderValueV(bakingShader, baking_voiceFreqsLoc, voices.freqs, SHADER_UNIFORM_FLOAT, voices.count * numPartials);
-    SetShaderValueV(bakingShader, baking_voiceAmplitudesLoc, voices.amps, SHADER_UNIFORM_FLOAT,
-                    voices.count * numPartials);
-    SetShaderValue(bakingShader, baking_otherVoicesDissonanceLoc, &otherVoicesDissonance, SHADER_UNIFORM_FLOAT);
-    float bakingViewInts[] = {0.0, 0.0, (float)heightmapResolution, (float)heightmapResolution};
-    SetShaderValue(bakingShader, baking_viewIntsLoc, &bakingViewInts, SHADER_UNIFORM_VEC4);
-    SetShaderValue(bakingShader, baking_maxHeightLoc, &maxHeight, SHADER_UNIFORM_FLOAT);
-    DrawRectangle(0, 0, heightmapResolution, heightmapResolution, WHITE);
-    EndShaderMode();
-    EndTextureMode();
+    if (IsKeyPressed(KEY_L)) {
+      evalMode = (evalMode + 1) % DISS_EVAL_COUNT;
+      dissonance_set_eval_mode(evalMode);
+      if ((evalMode == DISS_EVAL_CBW_LUT || evalMode == DISS_EVAL_KERNEL_LUT) && kernelLutTexture.id == 0) {
+        const DissonanceLut *lut = dissonance_lut();
+        Image cbwImage = {(void *)lut->cbw, CBW_LUT_SIZE, 1, 1, PIXELFORMAT_UNCOMPRESSED_R32};
+        Image kernelImage = {lut->kernel, KERNEL_LUT_DIFFS, KERNEL_LUT_FREQS, 1, PIXELFORMAT_UNCOMPRESSED_R32};
+        cbwLutTexture = LoadTextureFromImage(cbwImage);
+        kernelLutTexture = LoadTextureFromImage(kernelImage);
+        SetTextureFilter(cbwLutTexture, TEXTURE_FILTER_BILINEAR);
+        SetTextureFilter(kernelLutTexture, TEXTURE_FILTER_BILINEAR);
+        SetTextureWrap(cbwLutTexture, TEXTURE_WRAP_CLAMP);
+        SetTextureWrap(kernelLutTexture, TEXTURE_WRAP_CLAMP);
+      }
+      printf("Eval mode: %s (max error per pair %g)\n", dissonance_eval_mode_name(evalMode),
+             dissonance_eval_max_error(evalMode));
+      // everything cached was computed in the old mode
+      field_worker_invalidate(fieldWorker);
+      pair_cache_invalidate(&pairCache);
+    }
+
+    if (IsKeyPressed(KEY_V)) {
+      renderMode = (renderMode + 1) % RENDER_MODE_COUNT;
+      printf("Render mode: %s\n", renderModeNames[renderMode]);
+    }
+
+    if (IsKeyPressed(KEY_G)) {
+      // global search over x, z, voice 4 and voice 5 on the pool; the sliders
+      // move to the best chord once it is done
+      if (chordTask) {
+        chord_search_free(chordTask);
+        chordTask = NULL;
+        printf("Chord search cancelled\n");
+      } else {
+        Arena chordArena;
+        arena_init(&chordArena, ARENA_DEFAULT_BLOCK);
+        Voices unscaled;
+        if (voices_init(&unscaled, &chordArena, DEFAULT_VOICES, DEFAULT_VOICES * DEFAULT_PARTIALS)) {
+          for (int v = 0; v < 5; v++)
+            generate_harmonic_series(&unscaled, base_freq, 1.0f, DEFAULT_PARTIALS);
+          ChordSearchSettings chordSettings = chord_default_settings();
+          chordTask = chord_search_start(pool, &chordSettings, &unscaled);
+        }
+        arena_free(&chordArena);
+        if (!chordTask)
+          TraceLog(LOG_WARNING, "Failed to start the chord search");
+      }
+    }
+    ChordSearchResult chord;
+    int chordOk;
+    if (chordTask && chord_search_done(chordTask, &chord, &chordOk)) {
+      if (chordOk) {
+        printf("Best chord: x=%.4f z=%.4f voice4=%.4f voice5=%.4f  dissonance %.5f (>= %.5f), %lld boxes in "
+               "%.1f ms\n",
+               chord.point[0], chord.point[1], chord.point[2], chord.point[3], chord.value, chord.lowerBound,
+               chord.boxes, chord.ms);
+        voice4 = chord.point[2];
+        voice5 = chord.point[3];
+      }
+      chord_search_free(chordTask);
+      chordTask = NULL;
+    }
+
+    float ratios[2] = {voice4, voice5};
+    for (int s = 0; s < 2; s++)
+      if (ratios[s] != sliderRatio[s]) {
+        retune_slider_voice(&pairCache, &voices, sliderVoice, s, base_freq * ratios[s]);
+        sliderRatio[s] = ratios[s];
+      }
+    // only after an eval mode change, the slider path kept the rest current
+    if (pair_cache_sync(&pairCache, &voices) < 0) {
+      TraceLog(LOG_ERROR, "Failed to cache the voice pairs");
+      break;
+    }
+    // all pairs among the fixed voices (2 and up), the only part of the field
+    // that depends on neither x nor z
+    float otherVoicesDissonance = pair_cache_sum(&pairCache, 2);
+    if (dissonance_plan_update(&viewPlan, &voices) < 0) {
+      TraceLog(LOG_ERROR, "Failed to compile the voices");
+      break;
+    }
+
+    bool hovering = handle_input(&cameraMesh, &voices, &viewPlan, worldPlaneSize, &pyramid, &hover);
+
+    VoiceSnapshot *audioSnapshot = voice_state_edit(&audioState);
+    audioSnapshot->playing = isPlaying;
+    audioSnapshot->toneFreq = 440.0f;
+    voice_state_set_voices(audioSnapshot, &voices);
+    voice_state_publish(&audioState);
+
+    field_worker_submit(fieldWorker, &voices, otherVoicesDissonance);
+    const FieldSnapshot *snapshot = field_worker_acquire(fieldWorker);
+    int dirty = snapshot ? snapshot->dirty : 0;
+
+    if (IsKeyPressed(KEY_M)) {
+      showMinima = !showMinima;
+      // nothing is tracked while hidden, it starts over when shown
+      valley_worker_set_active(valleyWorker, showMinima);
+      valley_worker_release(valleyWorker);
+      valleys = NULL;
+    }
+    valley_worker_submit(valleyWorker, &voices);
+    const ValleySnapshot *landed = valley_worker_acquire(valleyWorker);
+    if (landed) {
+      valleys = landed;
+      int events[3] = {0};
+      for (int i = 0; i < valleys->eventCount; i++)
+        events[valleys->events[i].type]++;
+      if (valleys->eventCount > 0)
+        printf("Valleys: %d (%d born, %d merged, %d died) in %.1f ms\n", valleys->count, events[VALLEY_BORN],
+               events[VALLEY_MERGED], events[VALLEY_DIED], valleys->ms);
+    }
+
+    if (dirty & SEPARABLE_CROSS_DIRTY) {
+      // the uniforms stay with the program for every pass of this bake, the
+      // textures are bound per pass
+      const Voices *built = &snapshot->voices;
+      upload_spectrum(&spectrumTexture, built);
+      int bakeTerm = 1; // BAKE_CROSS
+      SetShaderValue(bakingShader, baking_bakeTermLoc, &bakeTerm, SHADER_UNIFORM_INT);
+      SetShaderValue(bakingShader, baking_evalModeLoc, &evalMode, SHADER_UNIFORM_INT);
+      int partialOffsets[3] = {built->offsets[1], voices_axis_end(built), voices_partial_total(built)};
+      SetShaderValue(bakingShader, baking_partialOffsetsLoc, partialOffsets, SHADER_UNIFORM_IVEC3);
+      SetShaderValue(bakingShader, baking_otherVoicesDissonanceLoc, &snapshot->offset, SHADER_UNIFORM_FLOAT);
+      SetShaderValue(bakingShader, baking_maxHeightLoc, &maxHeight, SHADER_UNIFORM_FLOAT);
+      mirrorCross = voices_axis_symmetric(built);
+      crossPass = 0;
+      refinedRows = 0;
+    }
+    bool crossBaked = crossPass <= CROSS_BANDS;
+    if (crossBaked) {
+      bool coarse = crossPass == 0;
+      int size = coarse ? coarseResolution : heightmapResolution;
+      int bandRows = (heightmapResolution + CROSS_BANDS - 1) / CROSS_BANDS;
+      int rowStart = coarse ? 0 : (crossPass - 1) * bandRows;
+      int rowEnd = coarse || rowStart + bandRows > size ? size : rowStart + bandRows;
+      BeginTextureMode(coarse ? crossCoarseTexture : crossTexture);
+      if (coarse)
+        ClearBackground(BLANK);
+      BeginShaderMode(bakingShader);
+      if (kernelLutTexture.id != 0) {
+        SetShaderValueTexture(bakingShader, baking_cbwLutLoc, cbwLutTexture);
+        SetShaderValueTexture(bakingShader, baking_kernelLutLoc, kernelLutTexture);
+      }
+      SetShaderValueTexture(bakingShader, baking_spectrumLoc, spectrumTexture);
+      float bakingViewInts[] = {0.0, 0.0, (float)size, (float)size};
+      SetShaderValue(bakingShader, baking_viewIntsLoc, &bakingViewInts, SHADER_UNIFORM_VEC4);
+      int lowerTriangle = mirrorCross && !coarse;
+      SetShaderValue(bakingShader, baking_lowerTriangleLoc, &lowerTriangle, SHADER_UNIFORM_INT);
+      // texture mode draws y down, the band is counted in texel rows from
+      // the bottom like gl_FragCoord. Mirrored, no texel of the band lies
+      // right of column rowEnd.
+      DrawRectangle(0, size - rowEnd, lowerTriangle ? rowEnd : size, rowEnd - rowStart, WHITE);
+      EndShaderMode();
+      EndTextureMode();
+      if (!coarse)
+        refinedRows = rowEnd;
+      crossPass++;
+    }
+    if (dirty & SEPARABLE_CURVES_DIRTY) {
+      Rectangle curveRow = {0, 0, (float)heightmapResolution, 1};
+      Rectangle slopeRow = {0, 1, (float)heightmapResolution, 1};
+      UpdateTextureRec(curveXTexture, curveRow, snapshot->curveX);
+      UpdateTextureRec(curveXTexture, slopeRow, snapshot->curveXSlope);
+      UpdateTextureRec(curveZTexture, curveRow, snapshot->curveZ);
+      UpdateTextureRec(curveZTexture, slopeRow, snapshot->curveZSlope);
+    }
+    if (snapshot) {
+      fieldOffset = snapshot->offset;
+      field_worker_release(fieldWorker);
+    }
+    if (dirty || crossBaked) {
+      BeginTextureMode(heightmapTexture);
+      ClearBackground(BLANK);
+      BeginShaderMode(composeShader);
+      SetShaderValueTexture(composeShader, compose_crossTermLoc, crossTexture.texture);
+      SetShaderValueTexture(composeShader, compose_crossCoarseLoc, crossCoarseTexture.texture);
+      SetShaderValue(composeShader, compose_refinedRowsLoc, &refinedRows, SHADER_UNIFORM_INT);
+      SetShaderValue(composeShader, compose_mirrorCrossLoc, &mirrorCross, SHADER_UNIFORM_INT);
+      SetShaderValueTexture(composeShader, compose_curveXLoc, curveXTexture);
+      SetShaderValueTexture(composeShader, compose_curveZLoc, curveZTexture);
+      SetShaderValue(composeShader, compose_offsetLoc, &fieldOffset, SHADER_UNIFORM_FLOAT);
+      SetShaderValue(composeShader, compose_maxHeightLoc, &maxHeight, SHADER_UNIFORM_FLOAT);
+      DrawRectangle(0, 0, heightmapResolution, heightmapResolution, WHITE);
+      EndShaderMode();
+      EndTextureMode();
+      readback.stale = true;
+      maxMipStale = true;
+    }
+    if (renderMode == RENDER_RAYMARCH && maxMipStale) {
+      build_max_mipmap(&maxMip, maxMipShader, heightmapTexture);
+      maxMipStale = false;
+    }
+    // picking follows the drawn heightmap a frame or two behind; a redraw
+    // while a copy is in flight waits for it
+    heightmap_readback_poll(&readback, pool, &pyramid, &terrainLod, valleyWorker, maxHeight, heightmapResolution);
+    if (readback.stale && !readback.fence)
+      heightmap_readback_start(&readback, heightmapTexture);
 
     BeginDrawing();
     ClearBackground(BLACK);
@@ -349,12 +852,8 @@ int main(void) {
     // Bind heightmap texture to texture unit 1
     rlActiveTextureSlot(1);
     glBindTexture(GL_TEXTURE_2D, heightmapTexture.texture.id);
-    int heightMapLoc = GetShaderLocation(terrainShader, "heightMap");
     int textureUnit = 1;
-    SetShaderValue(terrainShader, heightMapLoc, &textureUnit, SHADER_UNIFORM_INT);
-
     float heightMultiplier = 4.0f;
-    SetShaderValue(terrainShader, terrain_heightMultiplierLoc, &heightMultiplier, SHADER_UNIFORM_FLOAT);
 
     Matrix modelView = GetCameraMatrix(cameraMesh);
     Matrix projection = rlGetMatrixProjection();
@@ -362,22 +861,93 @@ int main(void) {
     Matrix normalMatrix = MatrixTranspose(MatrixInvert(modelView));
 
     Vector3 lightPosView = Vector3Transform(lightPos, modelView);
-
-    SetShaderValueMatrix(terrainShader, terrain_mvpLoc, mvp);
-    SetShaderValueMatrix(terrainShader, terrain_modelViewLoc, modelView);
-    SetShaderValueMatrix(terrainShader, terrain_normalMatrixLoc, normalMatrix);
-    SetShaderValue(terrainShader, terrain_lightPosLoc, &lightPosView, SHADER_UNIFORM_VEC3);
-    float texSize = (float)heightmapResolution;
-    SetShaderValue(terrainShader, terrain_textureSizeLoc, &texSize, SHADER_UNIFORM_FLOAT);
     Vector3 lightColor = {1.0f, 0.95f, 0.8f}; // Warm white light
-    SetShaderValue(terrainShader, terrain_lightColorLoc, &lightColor, SHADER_UNIFORM_VEC3);
     float planeSize = worldPlaneSize;
-    SetShaderValue(terrainShader, terrain_worldPlaneSizeLoc, &planeSize, SHADER_UNIFORM_FLOAT);
 
-    // Render terrain using direct OpenGL
-    glBindVertexArray(terrainVAO);
-    glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    if (renderMode == RENDER_MESH) {
+      int heightMapLoc = GetShaderLocation(terrainShader, "heightMap");
+      SetShaderValue(terrainShader, heightMapLoc, &textureUnit, SHADER_UNIFORM_INT);
+      SetShaderValue(terrainShader, terrain_heightMultiplierLoc, &heightMultiplier, SHADER_UNIFORM_FLOAT);
+      SetShaderValueMatrix(terrainShader, terrain_mvpLoc, mvp);
+      SetShaderValueMatrix(terrainShader, terrain_modelViewLoc, modelView);
+      SetShaderValueMatrix(terrainShader, terrain_normalMatrixLoc, normalMatrix);
+      SetShaderValue(terrainShader, terrain_lightPosLoc, &lightPosView, SHADER_UNIFORM_VEC3);
+      float texSize = (float)heightmapResolution;
+      SetShaderValue(terrainShader, terrain_textureSizeLoc, &texSize, SHADER_UNIFORM_FLOAT);
+      SetShaderValue(terrainShader, terrain_lightColorLoc, &lightColor, SHADER_UNIFORM_VEC3);
+      SetShaderValue(terrainShader, terrain_worldPlaneSizeLoc, &planeSize, SHADER_UNIFORM_FLOAT);
+
+
+      // the nodes this view needs, finer where a quad would cover more than
+      // terrainPixelError pixels
+      float projectionScale = GetRenderHeight() / (2.0f * tanf(0.5f * cameraMesh.fovy * DEG2RAD));
+      float cameraPosition[3] = {cameraMesh.position.x, cameraMesh.position.y, cameraMesh.position.z};
+      terrainNodes = cdlod_select(&terrainLod, MatrixToFloatV(mvp).v, cameraPosition, projectionScale, terrainPixelError);
+      SetShaderValue(terrainShader, terrain_patchQuadsLoc, &terrainGrid.patchQuads, SHADER_UNIFORM_INT);
+      SetShaderValue(terrainShader, terrain_cameraPosLoc, cameraPosition, SHADER_UNIFORM_VEC3);
+      SetShaderValueV(terrainShader, terrain_morphRangesLoc, terrainLod.morphRanges, SHADER_UNIFORM_VEC2,
+                      terrainLod.levels);
+
+      // Render terrain using direct OpenGL
+      draw_grid(&terrainGrid, terrainLod.nodes, terrainNodes);
+    } else {
+      // one full-screen triangle, every pixel traces its own ray and writes
+      // the depth of its hit
+      rlActiveTextureSlot(2);
+      glBindTexture(GL_TEXTURE_2D, maxMip.texture);
+      int maxMipUnit = 2;
+      SetShaderValue(raymarchShader, raymarch_heightmapLoc, &textureUnit, SHADER_UNIFORM_INT);
+      SetShaderValue(raymarchShader, raymarch_maxMipLoc, &maxMipUnit, SHADER_UNIFORM_INT);
+      SetShaderValue(raymarchShader, raymarch_maxMipLevelsLoc, &maxMip.levels, SHADER_UNIFORM_INT);
+      SetShaderValueMatrix(raymarchShader, raymarch_invViewLoc, MatrixInvert(modelView));
+      SetShaderValueMatrix(raymarchShader, raymarch_invProjLoc, MatrixInvert(projection));
+      SetShaderValueMatrix(raymarchShader, raymarch_mvpLoc, mvp);
+      SetShaderValueMatrix(raymarchShader, raymarch_modelViewLoc, modelView);
+      SetShaderValue(raymarchShader, raymarch_cameraPosLoc, &cameraMesh.position, SHADER_UNIFORM_VEC3);
+      SetShaderValue(raymarchShader, raymarch_worldPlaneSizeLoc, &planeSize, SHADER_UNIFORM_FLOAT);
+      float viewInts[4] = {0.0f, 0.0f, (float)GetRenderWidth(), (float)GetRenderHeight()};
+      SetShaderValue(raymarchShader, raymarch_viewIntsLoc, viewInts, SHADER_UNIFORM_VEC4);
+      SetShaderValue(raymarchShader, raymarch_lightPosLoc, &lightPosView, SHADER_UNIFORM_VEC3);
+      SetShaderValue(raymarchShader, raymarch_lightColorLoc, &lightColor, SHADER_UNIFORM_VEC3);
+      SetShaderValue(raymarchShader, raymarch_heightMultiplierLoc, &heightMultiplier, SHADER_UNIFORM_FLOAT);
+      int analytic = renderMode == RENDER_ANALYTIC;
+      SetShaderValue(raymarchShader, raymarch_analyticLoc, &analytic, SHADER_UNIFORM_INT);
+      if (analytic) {
+        // every voice as it is this frame, the fixed ones included; a few KB
+        upload_spectrum(&fieldSpectrumTexture, &voices);
+        int partialOffsets[3] = {voices.offsets[1], voices_axis_end(&voices), voices_partial_total(&voices)};
+        float ceiling = field_ceiling(&voices, otherVoicesDissonance);
+        float pixelAngle = 2.0f * tanf(0.5f * cameraMesh.fovy * DEG2RAD) / GetRenderHeight();
+        // bound by hand like the heightmap, the draw bypasses the batch
+        rlActiveTextureSlot(3);
+        glBindTexture(GL_TEXTURE_2D, fieldSpectrumTexture.id);
+        int spectrumUnit = 3;
+        SetShaderValue(raymarchShader, raymarch_spectrumLoc, &spectrumUnit, SHADER_UNIFORM_INT);
+        SetShaderValue(raymarchShader, raymarch_partialOffsetsLoc, partialOffsets, SHADER_UNIFORM_IVEC3);
+        SetShaderValue(raymarchShader, raymarch_otherVoicesDissonanceLoc, &otherVoicesDissonance,
+                       SHADER_UNIFORM_FLOAT);
+        SetShaderValue(raymarchShader, raymarch_maxHeightLoc, &maxHeight, SHADER_UNIFORM_FLOAT);
+        SetShaderValue(raymarchShader, raymarch_fieldCeilingLoc, &ceiling, SHADER_UNIFORM_FLOAT);
+        SetShaderValue(raymarchShader, raymarch_pixelAngleLoc, &pixelAngle, SHADER_UNIFORM_FLOAT);
+      }
+
+      glBindVertexArray(emptyVAO);
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+      glBindVertexArray(0);
+    }
+
+    if (showMinima && valleys) {
+      // terrain height is value / maxHeight, the coefficients are offset by
+      // half the plane
+      for (int i = 0; i < valleys->count; i++) {
+        const DissonanceMinimum *m = &valleys->valleys[i].minimum;
+        Vector3 at = {m->x - 0.5f * worldPlaneSize, m->value / maxHeight, m->z - 0.5f * worldPlaneSize};
+        DrawSphere(at, 0.025f, ColorFromHSV((valleys->valleys[i].id * 47) % 360, 0.7f, 0.95f));
+      }
+    }
+
+    if (hovering)
+      DrawSphere((Vector3){hover.position[0], hover.position[1], hover.position[2]}, 0.015f, WHITE);
 
     DrawGrid(40, 0.1);
     EndMode3D();
@@ -391,20 +961,60 @@ int main(void) {
     sprintf(voice5freq, "%.2f", voice4);
     GuiSlider((Rectangle){0.1f * screenWidth, 0.92f * screenHeight, 0.1f * screenWidth, 0.01 * screenHeight}, "voice 5",
               voice5freq, &voice5, 0.0f, 4.0f);
+    if (hovering) {
+      // the exact field under the mouse, not the baked approximation
+      float coeff_x = hover.position[0] + 0.5f * worldPlaneSize;
+      float coeff_z = hover.position[2] + 0.5f * worldPlaneSize;
+      float dissonance = dissonance_plan_xz(&viewPlan, coeff_x, coeff_z);
+      DrawText(TextFormat("x %.3f  z %.3f", coeff_x, coeff_z), 10, 10, 20, RAYWHITE);
+      DrawText(TextFormat("f_x %.2f Hz  f_z %.2f Hz", voices.freqs[0] * coeff_x,
+                          voices.freqs[voices.offsets[1]] * coeff_z),
+               10, 34, 20, RAYWHITE);
+      DrawText(TextFormat("dissonance %.6f", dissonance), 10, 58, 20, RAYWHITE);
+    }
     DrawFPS(screenWidth - 90, 10);
+    if (renderMode == RENDER_MESH)
+      DrawText(TextFormat("%d triangles", terrainNodes * terrainGrid.patchIndices / 3), screenWidth - 160, 34, 20,
+               RAYWHITE);
     EndMode2D();
     EndDrawing();
   }
 
   UnloadRenderTexture(target);
   UnloadRenderTexture(heightmapTexture);
+  UnloadRenderTexture(crossTexture);
+  UnloadRenderTexture(crossCoarseTexture);
+  UnloadTexture(curveXTexture);
+  UnloadTexture(curveZTexture);
+  if (kernelLutTexture.id != 0) {
+    UnloadTexture(cbwLutTexture);
+    UnloadTexture(kernelLutTexture);
+  }
+  field_worker_destroy(fieldWorker);
+  if (readback.fence)
+    glDeleteSync(readback.fence);
+  glDeleteBuffers(1, &readback.buffer);
+  height_pyramid_free(&pyramid);
+  UnloadTexture(spectrumTexture);
+  if (fieldSpectrumTexture.id != 0)
+    UnloadTexture(fieldSpectrumTexture);
+  pair_cache_free(&pairCache);
+  valley_worker_destroy(valleyWorker);
+  chord_search_free(chordTask);
+  dissonance_plan_free(&viewPlan);
+  threadpool_destroy(pool);
+  arena_free(&voiceArena);
   UnloadShader(bakingShader);
   UnloadShader(terrainShader);
+  UnloadShader(composeShader);
+  UnloadShader(raymarchShader);
+  UnloadShader(maxMipShader);
+  unload_max_mipmap(&maxMip);
 
   // Clean up OpenGL resources
-  glDeleteVertexArrays(1, &terrainVAO);
-  glDeleteBuffers(1, &terrainVBO);
-  glDeleteBuffers(1, &terrainEBO);
+  unload_grid(&terrainGrid);
+  cdlod_free(&terrainLod);
+  glDeleteVertexArrays(1, &emptyVAO);
 
   // Clean up audio resources
   ma_device_uninit(&device);
@@ -0,0 +1,38 @@
+#version 330
+
+// Maximum mipmap of the heightmap for the raymarcher in dissonance.fs, one
+// pass per level. Level 0 holds, per texel, the highest point of the
+// GL_LINEAR surface over the texel's footprint: that surface interpolates
+// the texel centres, so across the footprint it reaches the centres of the
+// 8 neighbours. Every level above takes the max of 2x2 texels of the one
+// below; level sizes round down, so the last texel of a row also takes the
+// odd texel left over.
+
+uniform sampler2D source;  // heightmap for level 0, else the mipmap itself
+uniform int sourceLevel;   // -1 when building level 0 from the heightmap
+uniform ivec2 sourceSize;  // texels of the level read
+
+out vec4 finalColor;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 lo, hi;
+    if (sourceLevel < 0) {
+        lo = texel - 1;
+        hi = texel + 1;
+    } else {
+        lo = 2 * texel;
+        hi = 2 * texel + 1;
+        ivec2 last = sourceSize / 2 - 1;
+        hi.x += texel.x == last.x ? 1 : 0;
+        hi.y += texel.y == last.y ? 1 : 0;
+    }
+    lo = clamp(lo, ivec2(0), sourceSize - 1);
+    hi = clamp(hi, ivec2(0), sourceSize - 1);
+    int level = max(sourceLevel, 0);
+    float highest = texelFetch(source, lo, level).r;
+    for (int j = lo.y; j <= hi.y; j++)
+        for (int i = lo.x; i <= hi.x; i++)
+            highest = max(highest, texelFetch(source, ivec2(i, j), level).r);
+    finalColor = vec4(highest, 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,442 @@
+#include "minima.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#define MINIMA_ARMIJO 1e-4f
+#define MINIMA_MAX_STEP 0.25f // longest single step, in coefficient units
+#define MINIMA_MAX_HALVINGS 12 // a seed starts within a texel or two, 2^-12 of a step is below tolerance
+#define MINIMA_SEED_TEXELS 2.0f // first trust radius of a seed, in texels
+#define MINIMA_LOW 0.03125f // share of the extent kept clear of zero frequency
+
+typedef struct {
+  float x, z;
+  float value;
+  float startValue;
+  int converged;
+  long long evaluations;
+} SeedResult;
+
+static float clampf(float v, float lo, float hi) { return v < lo ? lo : v > hi ? hi : v; }
+
+typedef struct {
+  const MinimaSettings *settings;
+  Voices *voices;
+  const DissonancePlan *plan;
+  float lo, hi; // search box on both axes
+  SeedResult *seeds;
+  const MinimaBasins *basins;
+  const int *order; // seeded basins
+} MinimaJob;
+
+static MinimaJob make_job(const MinimaSettings *settings, Voices *voices, const DissonancePlan *plan) {
+  // the field is not defined at zero frequency, keep away from it
+  MinimaJob job = {settings, voices, plan, MINIMA_LOW * settings->extent, settings->extent, NULL, NULL, NULL};
+  return job;
+}
+
+static int on_border(const MinimaJob *job, float x, float z) {
+  float border = 2.0f * job->settings->tolerance;
+  return x <= job->lo + border || x >= job->hi - border || z <= job->lo + border || z >= job->hi - border;
+}
+
+MinimaSettings minima_default_settings(float extent) {
+  MinimaSettings settings = {extent, 64, 20, 1e-4f, 5e-3f};
+  return settings;
+}
+
+// Descent along a crease: where one pair of partials coincides the field has
+// a V-shaped fold, and the one-sided gradient points across it. The folds
+// run along x = const (an x partial meets a fixed one), z = const, or
+// through the origin (an x partial meets a z partial). Along its fold the
+// coinciding pair stays at distance zero and drops out of the derivatives,
+// so a 1D Newton step on the projected gradient and curvature works again.
+static int crease_step(const MinimaJob *job, const DissonanceDerivs *d, float radius, float *x, float *z,
+                       float *value, long long *evaluations) {
+  float r = sqrtf(*x * *x + *z * *z);
+  float dirs[3][2] = {{1, 0}, {0, 1}, {*x / r, *z / r}};
+  float best = *value, bestX = *x, bestZ = *z;
+  for (int k = 0; k < 3; k++) {
+    float ux = dirs[k][0], uz = dirs[k][1];
+    float gu = d->dx * ux + d->dz * uz;
+    float hu = d->dxx * ux * ux + 2.0f * d->dxz * ux * uz + d->dzz * uz * uz;
+    if (gu == 0.0f)
+      continue;
+    float step = hu > 0.0f ? -gu / hu : (gu > 0.0f ? -radius : radius);
+    if (fabsf(step) > radius)
+      step = step > 0.0f ? radius : -radius;
+    for (int h = 0; h < MINIMA_MAX_HALVINGS && fabsf(step) >= job->settings->tolerance; h++, step *= 0.5f) {
+      float nx = clampf(*x + step * ux, job->lo, job->hi);
+      float nz = clampf(*z + step * uz, job->lo, job->hi);
+      float v = dissonance_plan_xz(job->plan, nx, nz);
+      (*evaluations)++;
+      if (v < best) {
+        best = v;
+        bestX = nx;
+        bestZ = nz;
+        break;
+      }
+    }
+  }
+  if (best >= *value)
+    return 0;
+  *x = bestX;
+  *z = bestZ;
+  *value = best;
+  return 1;
+}
+
+// Values from the plan, derivatives from the voices: every comparison in the
+// line searches is between plan values, so a thresholded plan cannot make a
+// step look like descent when it is not
+static DissonanceDerivs derivs_at(const MinimaJob *job, float x, float z, float *value) {
+  DissonanceDerivs d = get_xz_dissonance_derivs(job->voices, x, z, job->plan->fixedDissonance, 1);
+  *value = dissonance_plan_xz(job->plan, x, z);
+  return d;
+}
+
+static void descend_from(const MinimaJob *job, float x, float z, float radius, SeedResult *seed) {
+  const MinimaSettings *s = job->settings;
+  x = clampf(x, job->lo, job->hi);
+  z = clampf(z, job->lo, job->hi);
+  float current;
+  DissonanceDerivs d = derivs_at(job, x, z, &current);
+  long long evaluations = 2;
+  seed->startValue = current;
+  seed->converged = 0;
+  // trust radius: grows after full steps, shrinks to what the line search
+  // accepted, so the next search starts near the right length
+  radius = clampf(radius, s->tolerance, MINIMA_MAX_STEP);
+
+  for (int it = 0; it < s->maxIterations; it++) {
+    // Newton where the Hessian is positive definite and the step goes down,
+    // steepest descent otherwise
+    float px = -d.dx, pz = -d.dz;
+    float det = d.dxx * d.dzz - d.dxz * d.dxz;
+    if (d.dxx > 0.0f && det > 0.0f) {
+      float nx = -(d.dzz * d.dx - d.dxz * d.dz) / det;
+      float nz = -(d.dxx * d.dz - d.dxz * d.dx) / det;
+      if (nx * d.dx + nz * d.dz < 0.0f) {
+        px = nx;
+        pz = nz;
+      }
+    }
+    float len = sqrtf(px * px + pz * pz);
+    if (len == 0.0f) {
+      seed->converged = 1;
+      break;
+    }
+    if (len > radius) {
+      px *= radius / len;
+      pz *= radius / len;
+    }
+
+    // backtracking on the step projected into the box
+    float t = 1.0f, nx = x, nz = z, value = current;
+    int accepted = 0;
+    for (int h = 0; h < MINIMA_MAX_HALVINGS; h++, t *= 0.5f) {
+      nx = clampf(x + t * px, job->lo, job->hi);
+      nz = clampf(z + t * pz, job->lo, job->hi);
+      float predicted = d.dx * (nx - x) + d.dz * (nz - z);
+      if (fabsf(nx - x) + fabsf(nz - z) < s->tolerance || predicted >= 0.0f)
+        break;
+      value = dissonance_plan_xz(job->plan, nx, nz);
+      evaluations++;
+      if (value <= current + MINIMA_ARMIJO * predicted) {
+        accepted = 1;
+        break;
+      }
+    }
+    if (!accepted) {
+      nx = x;
+      nz = z;
+      value = current;
+      if (!crease_step(job, &d, radius, &nx, &nz, &value, &evaluations)) {
+        // no descent in any direction down to tolerance: a smooth minimum
+        // or the point where two folds cross
+        seed->converged = 1;
+        break;
+      }
+    }
+    float moved = fabsf(nx - x) + fabsf(nz - z);
+    float stepLength = sqrtf((nx - x) * (nx - x) + (nz - z) * (nz - z));
+    radius = accepted && t == 1.0f ? 2.0f * radius : stepLength > radius ? radius : 2.0f * stepLength;
+    if (radius > MINIMA_MAX_STEP)
+      radius = MINIMA_MAX_STEP;
+    if (radius < s->tolerance)
+      radius = s->tolerance;
+    x = nx;
+    z = nz;
+    d = derivs_at(job, x, z, &current);
+    evaluations += 2;
+    if (moved < s->tolerance) {
+      seed->converged = 1;
+      break;
+    }
+  }
+
+  seed->x = x;
+  seed->z = z;
+  seed->value = current;
+  seed->evaluations = evaluations;
+}
+
+static void texel_centre(const MinimaBasins *basins, int texel, float *x, float *z) {
+  float size = basins->extent / basins->resolution;
+  *x = (texel % basins->resolution + 0.5f) * size;
+  *z = (texel / basins->resolution + 0.5f) * size;
+}
+
+static void descend(void *ctx, int index, int thread) {
+  MinimaJob *job = (MinimaJob *)ctx;
+  const MinimaBasins *basins = job->basins;
+  float x, z;
+  texel_centre(basins, basins->basins[job->order[index]].texel, &x, &z);
+  float radius = MINIMA_SEED_TEXELS * basins->extent / basins->resolution;
+  descend_from(job, x, z, radius, &job->seeds[index]);
+}
+
+static void fill_minimum(DissonanceMinimum *min, Voices *voices, float x, float z, float value) {
+  min->x = x;
+  min->z = z;
+  min->value = value;
+  min->freqX = voices->count > 0 && voices_partial_count(voices, 0) > 0 ? voices->freqs[0] * x : 0.0f;
+  min->freqZ = voices->count > 1 && voices_partial_count(voices, 1) > 0 ? voices->freqs[voices->offsets[1]] * z : 0.0f;
+}
+
+int minima_descend(const MinimaSettings *settings, Voices *voices, const DissonancePlan *plan, float x, float z,
+                   float step, DissonanceMinimum *out, long long *evaluations) {
+  SeedResult seed;
+  MinimaJob job = make_job(settings, voices, plan);
+  descend_from(&job, x, z, step > 0.0f ? step : MINIMA_MAX_STEP, &seed);
+  memset(out, 0, sizeof(*out));
+  fill_minimum(out, voices, seed.x, seed.z, seed.value);
+  *evaluations += seed.evaluations;
+  return seed.converged && !on_border(&job, seed.x, seed.z);
+}
+
+void minima_basins_init(MinimaBasins *basins) { memset(basins, 0, sizeof(*basins)); }
+
+void minima_basins_free(MinimaBasins *basins) {
+  free(basins->labels);
+  free(basins->basins);
+  minima_basins_init(basins);
+}
+
+// Lowest of the 8 neighbours when it is below the texel, else the texel
+static int drain(const float *heights, int n, int texel) {
+  int i = texel % n, j = texel / n, lowest = texel;
+  for (int dj = -1; dj <= 1; dj++)
+    for (int di = -1; di <= 1; di++) {
+      int ni = i + di, nj = j + dj;
+      if (ni < 0 || nj < 0 || ni >= n || nj >= n)
+        continue;
+      if (heights[nj * n + ni] < heights[lowest])
+        lowest = nj * n + ni;
+    }
+  return lowest;
+}
+
+static void lower_spill(MinimaBasin *basin, float height) {
+  if (height < basin->spill)
+    basin->spill = height;
+}
+
+int minima_basins_build(MinimaBasins *basins, const float *heights, int resolution, float extent, float scale) {
+  size_t texels = (size_t)resolution * resolution;
+  if (resolution != basins->resolution) {
+    free(basins->labels);
+    basins->labels = (int *)malloc(texels * sizeof(int));
+    basins->resolution = basins->labels ? resolution : 0;
+    if (!basins->labels)
+      return 0;
+  }
+  basins->extent = extent;
+  basins->count = 0;
+  int *labels = basins->labels;
+  int n = resolution;
+
+  // every texel points down its steepest neighbour, the local minima point
+  // at themselves and become basins, numbered in texel order
+  for (size_t t = 0; t < texels; t++) {
+    labels[t] = drain(heights, n, (int)t);
+    if (labels[t] != (int)t)
+      continue;
+    if (basins->count == basins->capacity) {
+      int grown = basins->capacity > 0 ? 2 * basins->capacity : 64;
+      MinimaBasin *moved = (MinimaBasin *)realloc(basins->basins, grown * sizeof(MinimaBasin));
+      if (!moved) {
+        basins->count = 0;
+        return 0;
+      }
+      basins->basins = moved;
+      basins->capacity = grown;
+    }
+    MinimaBasin basin = {(int)t, heights[t] * scale, FLT_MAX, 0};
+    basins->basins[basins->count++] = basin;
+  }
+  // follow the pointers down to a minimum, compressing the path on the way
+  // so later walks stop at the first resolved texel. Resolved labels are
+  // stored as -1 - basin to tell them from texel pointers.
+  for (int b = 0; b < basins->count; b++)
+    labels[basins->basins[b].texel] = -1 - b;
+  for (size_t t = 0; t < texels; t++) {
+    int at = (int)t;
+    while (labels[at] >= 0)
+      at = labels[at];
+    int label = labels[at];
+    for (at = (int)t; labels[at] >= 0;) {
+      int next = labels[at];
+      labels[at] = label;
+      at = next;
+    }
+  }
+  for (size_t t = 0; t < texels; t++)
+    labels[t] = -1 - labels[t];
+
+  // spills: every pair of 8-neighbours in different basins is a pass at the
+  // higher of the two, each pair visited once from its upper or left texel
+  const int offsets[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+  for (int j = 0; j < n; j++)
+    for (int i = 0; i < n; i++) {
+      int t = j * n + i;
+      MinimaBasin *basin = &basins->basins[labels[t]];
+      basin->texels++;
+      if (i == 0 || j == 0 || i == n - 1 || j == n - 1)
+        lower_spill(basin, heights[t] * scale);
+      for (int k = 0; k < 4; k++) {
+        int ni = i + offsets[k][0], nj = j + offsets[k][1];
+        if (ni < 0 || ni >= n || nj >= n || labels[nj * n + ni] == labels[t])
+          continue;
+        float pass = fmaxf(heights[t], heights[nj * n + ni]) * scale;
+        lower_spill(basin, pass);
+        lower_spill(&basins->basins[labels[nj * n + ni]], pass);
+      }
+    }
+  return 1;
+}
+
+int minima_basin_at(const MinimaBasins *basins, float x, float z) {
+  int n = basins->resolution;
+  int i = (int)floorf(x / basins->extent * n), j = (int)floorf(z / basins->extent * n);
+  if (n == 0 || i < 0 || j < 0 || i >= n || j >= n)
+    return -1;
+  return basins->labels[j * n + i];
+}
+
+void minima_basin_measure(const MinimaBasins *basins, int basin, DissonanceMinimum *min) {
+  const MinimaBasin *b = &basins->basins[basin];
+  float texelSize = basins->extent / basins->resolution;
+  min->basinSize = b->texels;
+  min->basinArea = b->texels * texelSize * texelSize;
+  min->depth = b->spill > min->value ? b->spill - min->value : 0.0f;
+}
+
+// deeper first, the lower texel first among equals
+static int deeper(const MinimaBasin *a, const MinimaBasin *b) {
+  float da = a->spill - a->low, db = b->spill - b->low;
+  return da != db ? da > db : a->texel < b->texel;
+}
+
+int minima_deepest_basins(const MinimaBasins *basins, int maxSeeds, int *order) {
+  int n = basins->resolution, count = 0;
+  // insertion into the few kept so far, there are far more basins than seeds
+  for (int b = 0; b < basins->count; b++) {
+    const MinimaBasin *basin = &basins->basins[b];
+    int i = basin->texel % n, j = basin->texel / n;
+    if (i == 0 || j == 0 || i == n - 1 || j == n - 1)
+      continue;
+    int at = count < maxSeeds ? count++ : maxSeeds;
+    while (at > 0 && deeper(basin, &basins->basins[order[at - 1]])) {
+      if (at < maxSeeds)
+        order[at] = order[at - 1];
+      at--;
+    }
+    if (at < maxSeeds)
+      order[at] = b;
+  }
+  return count;
+}
+
+typedef struct {
+  SeedResult seed;
+  int basin;
+} RankedSeed;
+
+static int compare_value(const void *a, const void *b) {
+  float va = ((const RankedSeed *)a)->seed.value;
+  float vb = ((const RankedSeed *)b)->seed.value;
+  return (va > vb) - (va < vb);
+}
+
+int find_minima(ThreadPool *pool, const MinimaSettings *settings, Voices *voices, const DissonancePlan *plan,
+                const MinimaBasins *basins, MinimaResult *result) {
+  memset(result, 0, sizeof(*result));
+  if (settings->maxSeeds <= 0 || settings->extent <= 0.0f || basins->count == 0)
+    return 0;
+  double start = threadpool_now_ms();
+  int *order = (int *)malloc(settings->maxSeeds * sizeof(int));
+  SeedResult *seeds = (SeedResult *)calloc(settings->maxSeeds, sizeof(SeedResult));
+  RankedSeed *ranked = (RankedSeed *)malloc(settings->maxSeeds * sizeof(RankedSeed));
+  result->minima = (DissonanceMinimum *)calloc(settings->maxSeeds, sizeof(DissonanceMinimum));
+  if (!order || !seeds || !ranked || !result->minima) {
+    free(order);
+    free(seeds);
+    free(ranked);
+    minima_result_free(result);
+    return 0;
+  }
+
+  int count = minima_deepest_basins(basins, settings->maxSeeds, order);
+  MinimaJob job = make_job(settings, voices, plan);
+  job.seeds = seeds;
+  job.basins = basins;
+  job.order = order;
+  threadpool_parallel_for(pool, count, descend, &job);
+
+  // lowest first, so every minimum is represented by its deepest seed
+  for (int i = 0; i < count; i++) {
+    ranked[i].seed = seeds[i];
+    ranked[i].basin = order[i];
+  }
+  qsort(ranked, count, sizeof(RankedSeed), compare_value);
+  float texelSize = basins->extent / basins->resolution;
+  for (int i = 0; i < count; i++) {
+    SeedResult *seed = &ranked[i].seed;
+    const MinimaBasin *basin = &basins->basins[ranked[i].basin];
+    result->evaluations += seed->evaluations;
+    if (!seed->converged || on_border(&job, seed->x, seed->z))
+      continue;
+
+    DissonanceMinimum *found = NULL;
+    for (int m = 0; m < result->count && !found; m++) {
+      DissonanceMinimum *min = &result->minima[m];
+      if (fabsf(min->x - seed->x) <= settings->mergeRadius && fabsf(min->z - seed->z) <= settings->mergeRadius)
+        found = min;
+    }
+    if (!found) {
+      found = &result->minima[result->count++];
+      fill_minimum(found, voices, seed->x, seed->z, seed->value);
+    }
+    // basins that descend to the same minimum were split by a pass of the
+    // grid, not of the field: the highest spill among them stands for all
+    found->basinSize += basin->texels;
+    found->basinArea = found->basinSize * texelSize * texelSize;
+    if (basin->spill - found->value > found->depth)
+      found->depth = basin->spill - found->value;
+  }
+
+  result->seeds = count;
+  result->basins = basins->count;
+  result->ms = threadpool_now_ms() - start;
+  free(order);
+  free(seeds);
+  free(ranked);
+  return 1;
+}
+
+void minima_result_free(MinimaResult *result) {
+  free(result->minima);
+  result->minima = NULL;
+  result->count = 0;
+}
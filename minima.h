@@ -0,0 +1,95 @@
+#ifndef MINIMA_H
+#define MINIMA_H
+
+#include "plan.h"
+#include "threadpool.h"
+
+// Consonant points: local minima of the XZ field, seeded from a baked
+// heightmap of it.
+//
+// The heightmap is split into basins first: every texel drains to its lowest
+// of 8 neighbours, and the texels that drain to the same local minimum of
+// the grid form its basin. A basin's spill is the lowest height at which
+// water leaves it, over a pass to a neighbouring basin (the higher texel of
+// the pair) or over the border of the range. Only the deepest basins seed a
+// descent (Newton steps where the Hessian is positive definite, gradient
+// steps otherwise, both with a backtracking line search) from their lowest
+// texel, which has to go at most a texel or two. Most minima of the field sit
+// on cusps where two partials coincide, the line search walks into those as
+// well. Converged points closer than mergeRadius are one minimum.
+//
+// Field values come from a plan compiled from the same voices, derivatives
+// from the voices themselves with the plan's fixedDissonance.
+
+typedef struct {
+  float x, z;         // coefficients
+  float value;        // field value at the minimum
+  float depth;        // spill of its basin on the heightmap minus value
+  int basinSize;      // heightmap texels that drain here
+  float basinArea;    // basinSize times the texel area, in coefficient units
+  float freqX, freqZ; // fundamentals of voice 0 / voice 1 at the minimum
+} DissonanceMinimum;
+
+typedef struct {
+  int texel;   // lowest texel, j * resolution + i
+  float low;   // its height, in field units
+  float spill; // field units, see above
+  int texels;
+} MinimaBasin;
+
+typedef struct {
+  int resolution;
+  float extent; // texel (i, j) is centred on ((i + 0.5), (j + 0.5)) * extent / resolution
+  int *labels;  // resolution^2 basin indices, row j = z
+  int count, capacity;
+  MinimaBasin *basins; // in texel order of their lowest texel
+} MinimaBasins;
+
+typedef struct {
+  float extent;  // the search covers (0, extent] on both axes
+  int maxSeeds;  // deepest basins that seed a descent
+  int maxIterations;
+  float tolerance; // step length in coefficient units
+  float mergeRadius;
+} MinimaSettings;
+
+typedef struct {
+  int count;
+  DissonanceMinimum *minima; // ascending value
+  int seeds;
+  int basins;            // on the heightmap, seeds were the deepest of them
+  long long evaluations; // field evaluations over all seeds
+  double ms;
+} MinimaResult;
+
+MinimaSettings minima_default_settings(float extent);
+
+void minima_basins_init(MinimaBasins *basins);
+void minima_basins_free(MinimaBasins *basins);
+// heights: resolution^2 texels, row j = z, times scale in field units (the
+// baker's maxHeight). Returns 0 when out of memory.
+int minima_basins_build(MinimaBasins *basins, const float *heights, int resolution, float extent, float scale);
+// Basin under coefficient (x, z), -1 outside the range.
+int minima_basin_at(const MinimaBasins *basins, float x, float z);
+// Sets min's depth and basin from basin (index into basins->basins) alone.
+void minima_basin_measure(const MinimaBasins *basins, int basin, DissonanceMinimum *min);
+// Up to maxSeeds basins, deepest first, leaving out those whose lowest texel
+// is on the border: the field falls on past the range there. order needs
+// room for maxSeeds entries. Returns the count.
+int minima_deepest_basins(const MinimaBasins *basins, int maxSeeds, int *order);
+
+// Runs the seeds on pool (may be NULL). Minima on the border of the range are
+// dropped, like the basins.
+int find_minima(ThreadPool *pool, const MinimaSettings *settings, Voices *voices, const DissonancePlan *plan,
+                const MinimaBasins *basins, MinimaResult *result);
+void minima_result_free(MinimaResult *result);
+
+// One descent from (x, z) with the settings of a search (depth and basin are
+// left 0, they belong to the basins). step is the first trust radius, small
+// for a warm start near a known minimum, <= 0 for the default. Returns 0 when
+// it did not converge or ended on the border. Adds its field evaluations to
+// *evaluations.
+int minima_descend(const MinimaSettings *settings, Voices *voices, const DissonancePlan *plan, float x, float z,
+                   float step, DissonanceMinimum *out, long long *evaluations);
+
+#endif
@@ -0,0 +1,156 @@
+#include "paircache.h"
+#include <string.h>
+
+void pair_cache_init(PairCache *cache, DissAmpMode mode) {
+  memset(cache, 0, sizeof(*cache));
+  cache->mode = mode;
+}
+
+void pair_cache_free(PairCache *cache) {
+  free(cache->voicePairs);
+  free(cache->offsets);
+  free(cache->freqs);
+  free(cache->amps);
+  pair_cache_init(cache, cache->mode);
+}
+
+void pair_cache_invalidate(PairCache *cache) { cache->count = 0; }
+
+float pair_cache_at(const PairCache *cache, int a, int b) { return cache->voicePairs[a * cache->capacity + b]; }
+
+// Follows the capacities of the voices. A new layout drops every cached row,
+// they get recomputed by the caller.
+static int fit_layout(PairCache *cache, const Voices *voices) {
+  int total = voices_partial_total(voices);
+  if (voices->capacity <= cache->capacity && total <= cache->partialCapacity)
+    return 1;
+  int capacity = voices->capacity > cache->capacity ? voices->capacity : cache->capacity;
+  int partials = voices->partialCapacity > total ? voices->partialCapacity : total;
+  float *pairs = (float *)calloc((size_t)capacity * capacity, sizeof(float));
+  int *offsets = (int *)calloc(capacity + 1, sizeof(int));
+  float *freqs = (float *)calloc(partials > 0 ? partials : 1, sizeof(float));
+  float *amps = (float *)calloc(partials > 0 ? partials : 1, sizeof(float));
+  if (!pairs || !offsets || !freqs || !amps) {
+    free(pairs);
+    free(offsets);
+    free(freqs);
+    free(amps);
+    return 0;
+  }
+  free(cache->voicePairs);
+  free(cache->offsets);
+  free(cache->freqs);
+  free(cache->amps);
+  cache->voicePairs = pairs;
+  cache->offsets = offsets;
+  cache->freqs = freqs;
+  cache->amps = amps;
+  cache->capacity = capacity;
+  cache->partialCapacity = partials;
+  cache->count = 0;
+  return 1;
+}
+
+static int voice_changed(const PairCache *cache, const Voices *voices, int voice) {
+  int n = voices_partial_count(voices, voice);
+  if (cache->offsets[voice + 1] - cache->offsets[voice] != n)
+    return 1;
+  size_t bytes = n * sizeof(float);
+  return memcmp(cache->freqs + cache->offsets[voice], voices->freqs + voices->offsets[voice], bytes) ||
+         memcmp(cache->amps + cache->offsets[voice], voices->amps + voices->offsets[voice], bytes);
+}
+
+// copy of the spectra the rows were computed from
+static void snapshot(PairCache *cache, const Voices *voices) {
+  int total = voices_partial_total(voices);
+  memcpy(cache->offsets, voices->offsets, (voices->count + 1) * sizeof(int));
+  memcpy(cache->freqs, voices->freqs, total * sizeof(float));
+  memcpy(cache->amps, voices->amps, total * sizeof(float));
+  cache->count = voices->count;
+}
+
+void pair_cache_retune(PairCache *cache, const Voices *voices, int voice) {
+  if (!fit_layout(cache, voices))
+    return;
+  int n = voices_partial_count(voices, voice);
+  const float *freqs = voices->freqs + voices->offsets[voice];
+  const float *amps = voices->amps + voices->offsets[voice];
+
+  for (int other = 0; other < voices->count; other++) {
+    float sum = 0.0f;
+    if (other == voice) {
+      for (int i = 0; i < n; i++)
+        sum += dissonance_row_sum(freqs[i], amps[i], freqs + i + 1, amps + i + 1, n - i - 1, cache->mode);
+    } else {
+      int start = voices->offsets[other];
+      int m = voices_partial_count(voices, other);
+      for (int i = 0; i < n; i++)
+        sum += dissonance_row_sum(freqs[i], amps[i], voices->freqs + start, voices->amps + start, m, cache->mode);
+    }
+    cache->voicePairs[voice * cache->capacity + other] = sum;
+    cache->voicePairs[other * cache->capacity + voice] = sum;
+  }
+}
+
+int pair_cache_sync(PairCache *cache, const Voices *voices) {
+  if (!fit_layout(cache, voices)) {
+    pair_cache_invalidate(cache);
+    return -1;
+  }
+  int updated = 0;
+  for (int v = 0; v < voices->count; v++) {
+    // rows past the old count are new voices
+    if (v >= cache->count || voice_changed(cache, voices, v)) {
+      pair_cache_retune(cache, voices, v);
+      updated++;
+    }
+  }
+  snapshot(cache, voices);
+  return updated;
+}
+
+int pair_cache_add_voice(PairCache *cache, Voices *voices, float baseFreq, float baseAmp, int numPartials) {
+  int before = voices->count;
+  generate_harmonic_series(voices, baseFreq, baseAmp, numPartials);
+  if (voices->count == before)
+    return 0;
+  if (!fit_layout(cache, voices) || cache->count != before) {
+    // the cache was reset, start over; without room for the new voice no
+    // row can be trusted
+    if (pair_cache_sync(cache, voices) < 0)
+      return 0;
+    return 1;
+  }
+  pair_cache_retune(cache, voices, before);
+  snapshot(cache, voices);
+  return 1;
+}
+
+void pair_cache_remove_voice(PairCache *cache, Voices *voices, int voice) {
+  if (voice < 0 || voice >= voices->count)
+    return;
+  int n = cache->count;
+  remove_voice(voices, voice);
+  if (n != voices->count + 1) {
+    // the cache was behind anyway, the next sync rebuilds it
+    pair_cache_invalidate(cache);
+    return;
+  }
+
+  // drop row and column, nothing else changes
+  int cap = cache->capacity;
+  for (int a = voice; a < n - 1; a++)
+    memcpy(cache->voicePairs + a * cap, cache->voicePairs + (a + 1) * cap, n * sizeof(float));
+  for (int a = 0; a < n - 1; a++)
+    memmove(cache->voicePairs + a * cap + voice, cache->voicePairs + a * cap + voice + 1,
+            (n - 1 - voice) * sizeof(float));
+  snapshot(cache, voices);
+}
+
+float pair_cache_sum(const PairCache *cache, int firstVoice) {
+  float sum = 0.0f;
+  for (int a = firstVoice; a < cache->count; a++)
+    for (int b = a; b < cache->count; b++)
+      sum += pair_cache_at(cache, a, b);
+  return sum;
+}
@@ -0,0 +1,45 @@
+#ifndef PAIRCACHE_H
+#define PAIRCACHE_H
+
+#include "dissonance_simd.h"
+
+// Per-voice-pair dissonance sums kept alongside a Voices set. Entry (a, b)
+// holds all partial pairs between voices a and b, (a, a) the pairs within
+// voice a. Retuning one voice recomputes only its row, O(P * N).
+
+typedef struct {
+  int count;
+  int capacity;        // voices the storage has room for
+  int partialCapacity; // packed partial slots of the spectra copy
+  DissAmpMode mode;
+  float *voicePairs; // capacity * capacity
+  // spectra the rows were computed from (same compressed rows as Voices),
+  // to find retuned voices
+  int *offsets;
+  float *freqs;
+  float *amps;
+} PairCache;
+
+void pair_cache_init(PairCache *cache, DissAmpMode mode);
+void pair_cache_free(PairCache *cache);
+// Everything is recomputed on the next sync, e.g. after the eval mode changed.
+void pair_cache_invalidate(PairCache *cache);
+float pair_cache_at(const PairCache *cache, int a, int b);
+
+// Recomputes the rows of voices whose spectrum changed and follows count
+// changes. Returns the number of rows recomputed, -1 when out of memory (the
+// cache is then empty, pair_cache_sum covers no voice).
+int pair_cache_sync(PairCache *cache, const Voices *voices);
+void pair_cache_retune(PairCache *cache, const Voices *voices, int voice);
+
+// Append / remove a voice in both the Voices set and the cache. Adding returns
+// 0 when the voice could not be generated, or when the cache has no room for
+// it: the voice is in the set then but the cache is empty, like a failed sync.
+int pair_cache_add_voice(PairCache *cache, Voices *voices, float baseFreq, float baseAmp, int numPartials);
+void pair_cache_remove_voice(PairCache *cache, Voices *voices, int voice);
+
+// All pairs among voices [firstVoice, count), including pairs within a voice.
+// pair_cache_sum(cache, 2) is the exact fixed-voice term of the XZ field.
+float pair_cache_sum(const PairCache *cache, int firstVoice);
+
+#endif
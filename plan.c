@@ -0,0 +1,243 @@
+#include "plan.h"
+#include "pruned.h"
+#include <math.h>
+#include <string.h>
+
+typedef struct {
+  float freq;
+  float amp;
+} Partial;
+
+static int compare_freq(const void *a, const void *b) {
+  float fa = ((const Partial *)a)->freq;
+  float fb = ((const Partial *)b)->freq;
+  return (fa > fb) - (fa < fb);
+}
+
+static float pair_weight(float a1, float a2, DissAmpMode mode) {
+  return mode == DISS_AMP_MIN ? fminf(a1, a2) : a1 * a2;
+}
+
+void dissonance_plan_init(DissonancePlan *plan, DissAmpMode mode, float ampThreshold) {
+  memset(plan, 0, sizeof(*plan));
+  plan->mode = mode;
+  plan->ampThreshold = ampThreshold;
+}
+
+void dissonance_plan_free(DissonancePlan *plan) {
+  free(plan->freqs);
+  free(plan->weights);
+  free(plan->rowStart);
+  free(plan->srcFreqs);
+  free(plan->srcAmps);
+  float cutoff = plan->cutoff;
+  dissonance_plan_init(plan, plan->mode, plan->ampThreshold);
+  plan->cutoff = cutoff;
+}
+
+// Sorts the kept partials of [start, end) into members and merges equal
+// frequencies into entries. Entry e owns members [entryStart[e],
+// entryStart[e + 1]). Returns the entry count.
+static int merge_group(const Voices *voices, int start, int end, float threshold, Partial *members, int *memberCount,
+                       float *entryFreqs, int *entryStart, int entryCount) {
+  Partial *first = members + *memberCount;
+  int kept = 0;
+  for (int i = start; i < end; i++) {
+    if (voices->amps[i] <= 0.0f || voices->amps[i] < threshold)
+      continue;
+    first[kept].freq = voices->freqs[i];
+    first[kept].amp = voices->amps[i];
+    kept++;
+  }
+  qsort(first, kept, sizeof(Partial), compare_freq);
+
+  int entries = 0;
+  for (int i = 0; i < kept; i++) {
+    if (i > 0 && first[i].freq == first[i - 1].freq)
+      continue;
+    entryFreqs[entryCount + entries] = first[i].freq;
+    entryStart[entryCount + entries] = *memberCount + i;
+    entries++;
+  }
+  *memberCount += kept;
+  return entries;
+}
+
+// all member pairs between two entries
+static float entry_weight(const Partial *members, const int *entryStart, int e1, int e2, DissAmpMode mode) {
+  float sum = 0.0f;
+  for (int p = entryStart[e1]; p < entryStart[e1 + 1]; p++)
+    for (int q = entryStart[e2]; q < entryStart[e2 + 1]; q++)
+      sum += pair_weight(members[p].amp, members[q].amp, mode);
+  return sum;
+}
+
+// weight of every pair a dropped partial takes part in
+static double dropped_weight(const Voices *voices, float threshold, DissAmpMode mode) {
+  int total = voices_partial_total(voices);
+  double sum = 0.0;
+  for (int i = 0; i < total; i++) {
+    float a = voices->amps[i];
+    if (a <= 0.0f || a >= threshold)
+      continue;
+    for (int j = 0; j < total; j++) {
+      float b = voices->amps[j];
+      // pairs of two dropped partials are counted once, from the lower index
+      if (j == i || b <= 0.0f || (b < threshold && j < i))
+        continue;
+      sum += pair_weight(a, b, mode);
+    }
+  }
+  return sum;
+}
+
+// Row sum of the partners of f among ascending freqs[0, n), weights w in the
+// same order; only the cutoff window when there is a cutoff
+static float window_sum(float f, const float *freqs, const float *w, int n, float cutoff) {
+  int first = 0, end = n;
+  if (cutoff > 0.0f)
+    pruned_window(freqs, n, f, cutoff, &first, &end);
+  return dissonance_row_sum(f, 1.0f, freqs + first, w + first, end - first, DISS_AMP_PRODUCT);
+}
+
+static int keep_source(DissonancePlan *plan, const Voices *voices) {
+  int total = voices_partial_total(voices);
+  float *freqs = (float *)malloc((total > 0 ? total : 1) * sizeof(float));
+  float *amps = (float *)malloc((total > 0 ? total : 1) * sizeof(float));
+  if (!freqs || !amps) {
+    free(freqs);
+    free(amps);
+    return 0;
+  }
+  memcpy(freqs, voices->freqs, total * sizeof(float));
+  memcpy(amps, voices->amps, total * sizeof(float));
+  plan->srcFreqs = freqs;
+  plan->srcAmps = amps;
+  plan->srcTotal = total;
+  plan->srcSplit = voices->offsets[voices->count < 1 ? 0 : 1];
+  plan->srcAxisEnd = voices_axis_end(voices);
+  return 1;
+}
+
+int dissonance_plan_compile(DissonancePlan *plan, const Voices *voices) {
+  dissonance_plan_free(plan);
+  int total = voices_partial_total(voices);
+  int split = voices->offsets[voices->count < 1 ? 0 : 1];
+  int axisEnd = voices_axis_end(voices);
+  int slots = total > 0 ? total : 1;
+
+  Partial *members = (Partial *)malloc(slots * sizeof(Partial));
+  int *entryStart = (int *)malloc((slots + 1) * sizeof(int));
+  plan->freqs = (float *)malloc(slots * sizeof(float));
+  if (!members || !entryStart || !plan->freqs || !keep_source(plan, voices)) {
+    free(members);
+    free(entryStart);
+    dissonance_plan_free(plan);
+    return 0;
+  }
+
+  int memberCount = 0;
+  int entries = 0;
+  plan->xCount = merge_group(voices, 0, split, plan->ampThreshold, members, &memberCount, plan->freqs, entryStart, 0);
+  entries += plan->xCount;
+  plan->zCount =
+      merge_group(voices, split, axisEnd, plan->ampThreshold, members, &memberCount, plan->freqs, entryStart, entries);
+  entries += plan->zCount;
+  plan->fixedCount =
+      merge_group(voices, axisEnd, total, plan->ampThreshold, members, &memberCount, plan->freqs, entryStart, entries);
+  entries += plan->fixedCount;
+  entryStart[entries] = memberCount;
+
+  // flat pair table: every axis entry against every later entry
+  int axisEntries = plan->xCount + plan->zCount;
+  plan->rowStart = (int *)malloc((axisEntries + 1) * sizeof(int));
+  long long tableSize = 0;
+  for (int r = 0; r < axisEntries; r++)
+    tableSize += entries - r - 1;
+  plan->weights = (float *)malloc((tableSize > 0 ? tableSize : 1) * sizeof(float));
+  float *fixedRow = (float *)malloc((plan->fixedCount > 0 ? plan->fixedCount : 1) * sizeof(float));
+  if (!plan->rowStart || !plan->weights || !fixedRow) {
+    free(members);
+    free(entryStart);
+    free(fixedRow);
+    dissonance_plan_free(plan);
+    return 0;
+  }
+  int offset = 0;
+  for (int r = 0; r < axisEntries; r++) {
+    plan->rowStart[r] = offset;
+    for (int e = r + 1; e < entries; e++)
+      plan->weights[offset++] = entry_weight(members, entryStart, r, e, plan->mode);
+  }
+  plan->rowStart[axisEntries] = offset;
+
+  // the fixed entries never move, their pairs are evaluated once; weights go
+  // through the product mode with a unit first amplitude
+  plan->evalMode = dissonance_eval_mode();
+  plan->fixedDissonance = 0.0f;
+  const float *fixedFreqs = plan->freqs + axisEntries;
+  double keptWeight = 0.0;
+  for (int i = 0; i < plan->fixedCount; i++) {
+    int n = plan->fixedCount - i - 1;
+    for (int j = 0; j < n; j++) {
+      fixedRow[j] = entry_weight(members, entryStart, axisEntries + i, axisEntries + i + 1 + j, plan->mode);
+      keptWeight += fixedRow[j];
+    }
+    plan->fixedDissonance += window_sum(fixedFreqs[i], fixedFreqs + i + 1, fixedRow, n, plan->cutoff);
+  }
+  for (long long k = 0; k < tableSize; k++)
+    keptWeight += plan->weights[k];
+
+  plan->errorBound = (float)(dropped_weight(voices, plan->ampThreshold, plan->mode) * pruned_cutoff_error(0.0f));
+  if (plan->cutoff > 0.0f)
+    plan->errorBound += (float)(keptWeight * pruned_cutoff_error(plan->cutoff));
+  plan->partialsIn = total;
+  plan->pairsIn = 0;
+  for (int i = 0; i < axisEnd; i++)
+    plan->pairsIn += total - i - 1;
+  plan->pairsPlan = tableSize;
+
+  free(members);
+  free(entryStart);
+  free(fixedRow);
+  return 1;
+}
+
+int dissonance_plan_update(DissonancePlan *plan, const Voices *voices) {
+  int total = voices_partial_total(voices);
+  size_t bytes = total * sizeof(float);
+  if (plan->srcFreqs && plan->evalMode == dissonance_eval_mode() && plan->srcTotal == total &&
+      plan->srcSplit == voices->offsets[voices->count < 1 ? 0 : 1] && plan->srcAxisEnd == voices_axis_end(voices) &&
+      !memcmp(plan->srcFreqs, voices->freqs, bytes) && !memcmp(plan->srcAmps, voices->amps, bytes))
+    return 0;
+  return dissonance_plan_compile(plan, voices) ? 1 : -1;
+}
+
+float dissonance_plan_xz(const DissonancePlan *plan, float coeff_x, float coeff_z) {
+  int axisEntries = plan->xCount + plan->zCount;
+  int entries = axisEntries + plan->fixedCount;
+  // every entry in table order: the axis entries scaled, the fixed in place
+  float scaled[entries > 0 ? entries : 1];
+  for (int i = 0; i < axisEntries; i++)
+    scaled[i] = plan->freqs[i] * (i < plan->xCount ? coeff_x : coeff_z);
+  memcpy(scaled + axisEntries, plan->freqs + axisEntries, plan->fixedCount * sizeof(float));
+
+  float xz_dissonance = 0.0f;
+  for (int r = 0; r < axisEntries; r++) {
+    const float *w = plan->weights + plan->rowStart[r];
+    if (plan->cutoff <= 0.0f) {
+      // row r is every later entry, one run of the table: a single row sum
+      xz_dissonance += dissonance_row_sum(scaled[r], 1.0f, scaled + r + 1, w, entries - r - 1, DISS_AMP_PRODUCT);
+      continue;
+    }
+    // the windows need each group ascending on its own: the rest of r's
+    // group, the z group after an x row, the fixed entries
+    int axisPartners = axisEntries - r - 1;
+    int groupEnd = r < plan->xCount ? plan->xCount : axisEntries;
+    xz_dissonance += window_sum(scaled[r], scaled + r + 1, w, groupEnd - r - 1, plan->cutoff);
+    if (r < plan->xCount)
+      xz_dissonance += window_sum(scaled[r], scaled + plan->xCount, w + plan->xCount - r - 1, plan->zCount, plan->cutoff);
+    xz_dissonance += window_sum(scaled[r], scaled + axisEntries, w + axisPartners, plan->fixedCount, plan->cutoff);
+  }
+  return plan->fixedDissonance + xz_dissonance;
+}
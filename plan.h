@@ -0,0 +1,64 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "dissonance_simd.h"
+
+// A Voices configuration compiled for repeated XZ evaluations, FFTW style:
+// compile once, evaluate every sample of every frame until the spectra change.
+//
+// Partials sharing a frequency within the x voice, the z voice or the fixed
+// voices are merged into one entry (three identical 220 Hz voices collapse
+// to one), their pairs had distance zero and contributed nothing. Partials
+// below ampThreshold are dropped; every pair they took part in is worth at
+// most its weight times the peak of the curve, which gives errorBound.
+//
+// The pair weights (min or product of the member amplitudes, summed over
+// merged members) do not depend on x or z and are stored in a flat table,
+// one row per axis entry against every later entry; without a cutoff a
+// sample is one row sum per axis entry over its run of the table. The pairs
+// among the fixed entries are evaluated once at compile time into
+// fixedDissonance.
+//
+// With a cutoff (pruned.h) every group of entries stays sorted after scaling,
+// so each row only visits the window of partners within cutoff critical
+// bandwidths and large spectra cost about O(N log N) per sample. The skipped
+// pairs add at most their weight times pruned_cutoff_error(cutoff) to
+// errorBound.
+
+typedef struct {
+  DissAmpMode mode;
+  float ampThreshold;
+  float cutoff;          // critical bandwidths, 0 visits every pair
+  DissEvalMode evalMode; // mode the constant part was evaluated in
+  int xCount, zCount, fixedCount; // merged entries, in that order in freqs
+  float *freqs;                   // base frequencies, before the x / z scale
+  float *weights;                 // flat pair table, see rowStart
+  int *rowStart;                  // xCount + zCount + 1 offsets into weights
+  float fixedDissonance;          // pairs among the fixed entries
+  float errorBound;               // |plan - unplanned| for the dropped partials and skipped pairs
+  int partialsIn;
+  long long pairsIn;   // pairs get_xz_dissonance visits per sample
+  long long pairsPlan; // pairs the plan visits per sample
+  // configuration the plan was compiled from, to decide reuse
+  int srcTotal, srcSplit, srcAxisEnd;
+  float *srcFreqs;
+  float *srcAmps;
+} DissonancePlan;
+
+void dissonance_plan_init(DissonancePlan *plan, DissAmpMode mode, float ampThreshold);
+void dissonance_plan_free(DissonancePlan *plan);
+
+// Recompiles when the spectra or the eval mode changed since the last
+// compile (call dissonance_plan_compile after changing ampThreshold or
+// cutoff).
+// Returns 1 after a recompile, 0 when the plan was reused, -1 when out of
+// memory (the plan is left empty).
+int dissonance_plan_update(DissonancePlan *plan, const Voices *voices);
+int dissonance_plan_compile(DissonancePlan *plan, const Voices *voices);
+
+// Same value as get_xz_dissonance(voices, coeff_x, coeff_z, otherVoicesDissonance)
+// within errorBound plus the eval mode error; the fixed-voice term is the
+// plan's own fixedDissonance.
+float dissonance_plan_xz(const DissonancePlan *plan, float coeff_x, float coeff_z);
+
+#endif
@@ -0,0 +1,36 @@
+#include "pruned.h"
+#include "dissonance_lut.h"
+#include <math.h>
+
+float pruned_cutoff_error(float cutoff) {
+  float peak = logf(PLOMP_B / PLOMP_A) / (PLOMP_B - PLOMP_A);
+  float d = cutoff > peak ? cutoff : peak;
+  return expf(-PLOMP_A * d) - expf(-PLOMP_B * d);
+}
+
+void pruned_window(const float *freqs, int n, float f, float cutoff, int *first, int *end) {
+  // g + cutoff * cbw(g) grows with g: the first partner below f is the first
+  // whose window reaches it
+  int lo = 0, hi = n;
+  // partners that all lie above f, e.g. the rest of f's own group
+  if (n > 0 && freqs[0] >= f)
+    hi = 0;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (freqs[mid] + cutoff * critical_bandwidth(freqs[mid]) < f)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *first = lo;
+  float limit = f + cutoff * critical_bandwidth(f);
+  hi = n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (freqs[mid] <= limit)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *end = lo;
+}
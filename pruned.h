@@ -0,0 +1,25 @@
+#ifndef PRUNED_H
+#define PRUNED_H
+
+#include "dissonance_simd.h"
+
+// Cutoff windows for large spectra (hundreds of partials), about
+// O(N log N) per evaluation instead of O(N^2). Over frequencies sorted
+// ascending, a partial is only paired with the ones within cutoff critical
+// bandwidths of it, measured with the cbw of the lower partial of each pair
+// like the pair term:
+//   f_j <= f_i + cutoff * cbw(f_i)   above it,
+//   f_j + cutoff * cbw(f_j) >= f_i   below it.
+// Both sides are contiguous, found by binary search. Past the peak of the
+// curve (d = 0.22) the pair term only falls, so every skipped pair is worth
+// at most its amplitude weight times pruned_cutoff_error(cutoff).
+// DissonancePlan evaluates through these windows when given a cutoff.
+
+#define PRUNED_DEFAULT_CUTOFF 4.0f // 8.3e-7 per unit weight
+
+float pruned_cutoff_error(float cutoff);
+
+// Partners of a partial at f among the ascending freqs[0, n): [*first, *end).
+void pruned_window(const float *freqs, int n, float f, float cutoff, int *first, int *end);
+
+#endif
@@ -0,0 +1,208 @@
+#include "separable.h"
+#include "dissonance_simd.h"
+#include <string.h>
+
+int separable_init(SeparableField *field, int resolution, float extent, int keepCross) {
+  memset(field, 0, sizeof(*field));
+  field->resolution = resolution;
+  field->extent = extent;
+  field->curveX = (float *)malloc(resolution * sizeof(float));
+  field->curveZ = (float *)malloc(resolution * sizeof(float));
+  field->curveXSlope = (float *)malloc(resolution * sizeof(float));
+  field->curveZSlope = (float *)malloc(resolution * sizeof(float));
+  if (keepCross)
+    field->cross = (float *)malloc((size_t)resolution * resolution * sizeof(float));
+  if (!field->curveX || !field->curveZ || !field->curveXSlope || !field->curveZSlope || (keepCross && !field->cross)) {
+    separable_free(field);
+    return 0;
+  }
+  return 1;
+}
+
+void separable_free(SeparableField *field) {
+  free(field->cross);
+  free(field->curveX);
+  free(field->curveZ);
+  free(field->curveXSlope);
+  free(field->curveZSlope);
+  free(field->freqs);
+  free(field->amps);
+  field->cross = NULL;
+  field->curveX = NULL;
+  field->curveZ = NULL;
+  field->curveXSlope = NULL;
+  field->curveZSlope = NULL;
+  field->freqs = NULL;
+  field->amps = NULL;
+  field->cachedCapacity = 0;
+  field->valid = 0;
+}
+
+void separable_invalidate(SeparableField *field) { field->valid = 0; }
+
+static float sample_coeff(const SeparableField *field, int i) {
+  return (i + 0.5f) / field->resolution * field->extent;
+}
+
+// pairs of axis voice `axis` with its own later partials (both scaled) and
+// with every fixed partial
+static float axis_curve_at(const Voices *voices, int axis, float coeff) {
+  int n = voices_partial_count(voices, axis);
+  const float *freqs = voices->freqs + voices->offsets[axis];
+  const float *amps = voices->amps + voices->offsets[axis];
+  int fixedStart = voices_axis_end(voices);
+  int fixedCount = voices_partial_total(voices) - fixedStart;
+  float scaled[n > 0 ? n : 1];
+  for (int i = 0; i < n; i++)
+    scaled[i] = freqs[i] * coeff;
+
+  float sum = 0.0f;
+  for (int i = 0; i < n; i++) {
+    sum += dissonance_row_sum(scaled[i], amps[i], scaled + i + 1, amps + i + 1, n - i - 1, DISS_AMP_MIN);
+    if (fixedCount > 0)
+      sum += dissonance_row_sum(scaled[i], amps[i], voices->freqs + fixedStart, voices->amps + fixedStart, fixedCount,
+                                DISS_AMP_MIN);
+  }
+  return sum;
+}
+
+// derivative of axis_curve_at with respect to coeff, in one derivative pass
+static float axis_curve_slope(const Voices *voices, int axis, float coeff) {
+  int n = voices_partial_count(voices, axis);
+  const float *freqs = voices->freqs + voices->offsets[axis];
+  const float *amps = voices->amps + voices->offsets[axis];
+  int fixedStart = voices_axis_end(voices);
+  int fixedCount = voices_partial_total(voices) - fixedStart;
+  float scaled[n > 0 ? n : 1];
+  for (int i = 0; i < n; i++)
+    scaled[i] = freqs[i] * coeff;
+
+  float acc[6] = {0};
+  for (int i = 0; i < n; i++) {
+    dissonance_row_derivs(scaled[i], amps[i], freqs[i], 0.0f, scaled + i + 1, amps + i + 1, freqs + i + 1, 1.0f, 0.0f,
+                          n - i - 1, 0, acc);
+    dissonance_row_derivs(scaled[i], amps[i], freqs[i], 0.0f, voices->freqs + fixedStart, voices->amps + fixedStart,
+                          voices->freqs + fixedStart, 0.0f, 0.0f, fixedCount, 0, acc);
+  }
+  return acc[1];
+}
+
+float separable_cross_at(const Voices *voices, float coeff_x, float coeff_z) {
+  int xCount = voices_partial_count(voices, 0);
+  int zStart = voices->offsets[1];
+  int zCount = voices_partial_count(voices, 1);
+  float zFreqs[zCount > 0 ? zCount : 1];
+  for (int i = 0; i < zCount; i++)
+    zFreqs[i] = voices->freqs[zStart + i] * coeff_z;
+  float sum = 0.0f;
+  for (int i = 0; i < xCount; i++)
+    sum += dissonance_row_sum(voices->freqs[i] * coeff_x, voices->amps[i], zFreqs, voices->amps + zStart, zCount,
+                              DISS_AMP_MIN);
+  return sum;
+}
+
+#define CANCEL_POLL 16 // samples of a curve between two polls
+
+static int cancelled(const SeparableField *field) { return field->cancelled && field->cancelled(field->cancelCtx); }
+
+// with the same spectrum on both axes cross(x, z) = cross(z, x): the lower
+// triangle is evaluated and mirrored. Returns 0 when cancelled.
+static int build_cross(SeparableField *field, const Voices *voices) {
+  int n = field->resolution;
+  int symmetric = voices_axis_symmetric(voices);
+  for (int j = 0; j < n; j++) {
+    if (cancelled(field))
+      return 0;
+    float z = sample_coeff(field, j);
+    for (int i = 0; i < (symmetric ? j + 1 : n); i++)
+      field->cross[(size_t)j * n + i] = separable_cross_at(voices, sample_coeff(field, i), z);
+  }
+  if (symmetric)
+    for (int j = 0; j < n; j++)
+      for (int i = j + 1; i < n; i++)
+        field->cross[(size_t)j * n + i] = field->cross[(size_t)i * n + j];
+  return 1;
+}
+
+static int build_curves(SeparableField *field, const Voices *voices) {
+  int symmetric = voices_axis_symmetric(voices);
+  for (int i = 0; i < field->resolution; i++) {
+    if (i % CANCEL_POLL == 0 && cancelled(field))
+      return 0;
+    float c = sample_coeff(field, i);
+    field->curveX[i] = axis_curve_at(voices, 0, c);
+    field->curveXSlope[i] = axis_curve_slope(voices, 0, c);
+    if (symmetric)
+      continue;
+    field->curveZ[i] = axis_curve_at(voices, 1, c);
+    field->curveZSlope[i] = axis_curve_slope(voices, 1, c);
+  }
+  if (symmetric) {
+    memcpy(field->curveZ, field->curveX, field->resolution * sizeof(float));
+    memcpy(field->curveZSlope, field->curveXSlope, field->resolution * sizeof(float));
+  }
+  return 1;
+}
+
+// keeps a copy of the spectra to diff against, returns 0 when out of memory
+static int reserve_cache(SeparableField *field, int partials) {
+  if (partials <= field->cachedCapacity)
+    return 1;
+  float *freqs = (float *)realloc(field->freqs, partials * sizeof(float));
+  if (freqs)
+    field->freqs = freqs;
+  float *amps = (float *)realloc(field->amps, partials * sizeof(float));
+  if (amps)
+    field->amps = amps;
+  if (!freqs || !amps)
+    return 0;
+  field->cachedCapacity = partials;
+  return 1;
+}
+
+int separable_update(SeparableField *field, Voices *voices, float otherVoicesDissonance) {
+  int total = voices_partial_total(voices);
+  int axisPartials = voices_axis_end(voices);
+  size_t axisBytes = axisPartials * sizeof(float);
+  size_t allBytes = total * sizeof(float);
+  int dirty = 0;
+
+  if (!reserve_cache(field, total))
+    field->valid = 0;
+  if (!field->valid || field->axisSplit != voices->offsets[1] || field->axisEnd != axisPartials ||
+      memcmp(field->freqs, voices->freqs, axisBytes) || memcmp(field->amps, voices->amps, axisBytes))
+    dirty = SEPARABLE_CROSS_DIRTY | SEPARABLE_CURVES_DIRTY;
+  else if (field->total != total || memcmp(field->freqs, voices->freqs, allBytes) ||
+           memcmp(field->amps, voices->amps, allBytes))
+    dirty = SEPARABLE_CURVES_DIRTY;
+
+  if ((dirty & SEPARABLE_CROSS_DIRTY) && field->cross && !build_cross(field, voices))
+    return SEPARABLE_CANCELLED;
+  if ((dirty & SEPARABLE_CURVES_DIRTY) && !build_curves(field, voices))
+    return SEPARABLE_CANCELLED;
+
+  if (dirty && field->cachedCapacity >= total) {
+    memcpy(field->freqs, voices->freqs, allBytes);
+    memcpy(field->amps, voices->amps, allBytes);
+    field->total = total;
+    field->axisSplit = voices->offsets[1];
+    field->axisEnd = axisPartials;
+    field->valid = 1;
+  }
+  if (dirty || field->offset != otherVoicesDissonance)
+    dirty |= SEPARABLE_OFFSET_DIRTY;
+  field->offset = otherVoicesDissonance;
+  return dirty;
+}
+
+float separable_value(const SeparableField *field, int i, int j) {
+  float cross = field->cross ? field->cross[(size_t)j * field->resolution + i] : 0.0f;
+  return cross + field->curveX[i] + field->curveZ[j] + field->offset;
+}
+
+void separable_compose(const SeparableField *field, float maxHeight, float *out) {
+  int n = field->resolution;
+  for (int j = 0; j < n; j++)
+    for (int i = 0; i < n; i++)
+      out[(size_t)j * n + i] = separable_value(field, i, j) / maxHeight;
+}
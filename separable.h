@@ -0,0 +1,64 @@
+#ifndef SEPARABLE_H
+#define SEPARABLE_H
+
+#include "dissonance.h"
+
+// The XZ field splits into
+//   F(x, z) = cross(x, z) + curveX(x) + curveZ(z) + offset
+// where cross holds the x voice vs z voice pairs, curveX/curveZ the pairs of
+// an axis voice with itself and with the fixed voices, and offset the pairs
+// among the fixed voices (otherVoicesDissonance). Only cross is 2D and it
+// depends on the axis spectra alone, so retuning a fixed voice rebuilds two
+// curves of length resolution.
+//
+// Sample (i, j) sits at the texel center x = (i + 0.5) / resolution * extent,
+// z = (j + 0.5) / resolution * extent, like gl_FragCoord in baking.fs.
+
+#define SEPARABLE_CROSS_DIRTY 1
+#define SEPARABLE_CURVES_DIRTY 2
+#define SEPARABLE_OFFSET_DIRTY 4
+#define SEPARABLE_CANCELLED 8 // the rebuild was abandoned, see cancelled below
+
+// polled during a rebuild, nonzero abandons it
+typedef int (*SeparableCancelFn)(void *ctx);
+
+typedef struct {
+  int resolution;
+  float extent;
+  float *cross; // resolution * resolution, row j = z; NULL when the GPU keeps it
+  float *curveX;
+  float *curveZ;
+  float *curveXSlope; // d curveX / dx, closed form, for normals
+  float *curveZSlope;
+  float offset;
+  int valid;
+  // configuration the terms were built from
+  int total;     // packed partials
+  int axisSplit; // first z partial
+  int axisEnd;   // first fixed partial
+  int cachedCapacity; // partial slots in freqs / amps
+  float *freqs;
+  float *amps;
+  // Optional. A cancelled rebuild leaves the cached configuration alone, so
+  // the next update rebuilds from there; the terms are left half written.
+  SeparableCancelFn cancelled;
+  void *cancelCtx;
+} SeparableField;
+
+int separable_init(SeparableField *field, int resolution, float extent, int keepCross);
+void separable_free(SeparableField *field);
+
+// Compares the voices with the cached configuration and rebuilds what
+// changed. Returns a mask of SEPARABLE_*_DIRTY flags, or SEPARABLE_CANCELLED.
+int separable_update(SeparableField *field, Voices *voices, float otherVoicesDissonance);
+
+// Forces a full rebuild on the next update, e.g. after the eval mode changed.
+void separable_invalidate(SeparableField *field);
+
+float separable_cross_at(const Voices *voices, float coeff_x, float coeff_z);
+float separable_value(const SeparableField *field, int i, int j);
+
+// Writes height / maxHeight for every sample, the layout of the baked texture.
+void separable_compose(const SeparableField *field, float maxHeight, float *out);
+
+#endif
@@ -4,11 +4,28 @@ out vec4 FragColor;
 in vec2 TexCoords;
 in vec3 ViewFragPos;
 in vec3 ModelFragPos;
-in vec3 Normal;
 
 uniform vec3 lightPos;
 uniform float heightMultiplier;
 uniform vec3 lightColor;
+uniform mat3 normalMatrix;
+uniform sampler2D heightMap;
+uniform float worldPlaneSize;
+
+// Surface normal from the analytic gradient the bake stores in .g / .b
+// (d height / d coefficient, already divided by maxHeight). The coefficients
+// span SURFACE_EXTENT over worldPlaneSize world units. Taken per fragment, so
+// the shading keeps the heightmap's detail however coarse the triangles are.
+const float SURFACE_EXTENT = 4.0;
+
+vec3 calculateNormal(vec2 texCoords) {
+    vec2 slope = texture(heightMap, texCoords).gb * (SURFACE_EXTENT / worldPlaneSize) * heightMultiplier;
+
+    // Create normal vector (negate dz for correct orientation)
+    vec3 normal = normalize(vec3(-slope.x, 1.0, -slope.y));
+
+    return normal;
+}
 
 void main()
 {
@@ -29,7 +46,7 @@ void main()
 
     // --- Lighting Calculations in VIEW space ---
 
-    vec3 norm = normalize(Normal);
+    vec3 norm = normalize(normalMatrix * calculateNormal(TexCoords));
 
     // fragment to light
     vec3 lightDir = normalize(lightPos - ViewFragPos);
@@ -1,55 +1,47 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec2 aTexCoords;
+
+// One CDLOD node per instance (see cdlod.h), no vertex attributes: set_up_grid
+// draws a patch of (patchQuads + 1)^2 vertices numbered row by row, stretched
+// over the node. Within the last part of its level's range each vertex slides
+// onto the grid of the level above, odd rows and columns onto their even
+// neighbours, so the node meets a coarser one without cracks.
+layout (location = 0) in vec4 node; // x, z of the min corner, side, level
 
 out vec2 TexCoords;
 out vec3 ViewFragPos;
 out vec3 ModelFragPos;
-out vec3 Normal;
 
 uniform mat4 mvp;
 uniform mat4 modelView;
-uniform mat3 normalMatrix;
 
 uniform sampler2D heightMap;
-uniform float heightMultiplier;
-uniform float textureSize;
 uniform float worldPlaneSize;
+uniform int patchQuads;
+uniform vec3 cameraPos;
+uniform vec2 morphRanges[12]; // start, end per level, CDLOD_MAX_LEVELS
 
-// Calculates the surface normal using the gradient of the heightmap.
-// This method is independent of the mesh resolution.
-vec3 calculateNormal(vec2 texCoords) {
-    float texelSize = 1.0 / textureSize; // The size of onfe pixel in texture coordinates
-    float worldTexelSize = worldPlaneSize / textureSize; // The size of one pixel in world coordinates
-
-    // Sample the height at the current point and its neighbors
-    float h = texture(heightMap, texCoords).r;
-    float hR = texture(heightMap, vec2(texCoords.x + texelSize, texCoords.y)).r;
-    float hL = texture(heightMap, vec2(texCoords.x - texelSize, texCoords.y)).r;
-    float hU = texture(heightMap, vec2(texCoords.x, texCoords.y + texelSize)).r;
-    float hD = texture(heightMap, vec2(texCoords.x, texCoords.y - texelSize)).r;
-
-    // Use central differences for better normal calculation
-    float dx = (hR - hL) * heightMultiplier / (2.0 * worldTexelSize);
-    float dz = (hU - hD) * heightMultiplier / (2.0 * worldTexelSize);
-
-    // Create normal vector (negate dz for correct orientation)
-    vec3 normal = normalize(vec3(-dx, 1.0, -dz));
-
-    return normal;
+vec2 to_texcoords(vec2 xz) {
+    return xz / worldPlaneSize + 0.5;
 }
 
 void main()
 {
-    TexCoords = aTexCoords;
+    int row = patchQuads + 1;
+    vec2 vertex = vec2(gl_VertexID % row, gl_VertexID / row);
+    float quad = node.z / float(patchQuads);
+
+    vec2 xz = node.xy + vertex * quad;
+    float height = texture(heightMap, to_texcoords(xz)).r;
+    vec2 range = morphRanges[int(node.w)];
+    float morph = clamp((distance(cameraPos, vec3(xz.x, height, xz.y)) - range.x) / (range.y - range.x), 0.0, 1.0);
+    vertex -= fract(vertex * 0.5) * 2.0 * morph;
+
+    xz = node.xy + vertex * quad;
+    TexCoords = to_texcoords(xz);
+    vec3 displacedPos = vec3(xz.x, texture(heightMap, TexCoords).r, xz.y);
 
-    float height = texture(heightMap, aTexCoords).r;
-    vec3 displacedPos = aPos + vec3(0.0, height, 0.0);
-    
     ViewFragPos = vec3(modelView * vec4(displacedPos, 1.0));
     ModelFragPos = displacedPos;
 
-    Normal = normalMatrix * calculateNormal(aTexCoords);
-
     gl_Position = mvp * vec4(displacedPos, 1.0);
 }
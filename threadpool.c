@@ -0,0 +1,424 @@
+#define _GNU_SOURCE
+#define _DARWIN_C_SOURCE
+#include "threadpool.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+
+#define DEQUE_INITIAL 64
+#define SPLITS_PER_THREAD 8 // a loop is cut into about this many ranges per thread
+
+typedef struct {
+  TaskGroup *group;
+  ParallelForFn fn;
+  void *ctx;
+  int begin, end;
+  int grain; // ranges up to this long run without splitting
+} Task;
+
+// The owner pushes and pops at the tail, thieves take from the head.
+typedef struct {
+  pthread_mutex_t lock;
+  Task *tasks;
+  int head, tail, capacity;
+} TaskDeque;
+
+struct ThreadPool {
+  int size;
+  int pin;
+  pthread_t *threads;
+  char *started; // per slot, the worker thread is running
+  TaskDeque *deques; // one per slot
+  int dequeCount;
+  pthread_mutex_t lock;
+  pthread_cond_t wake; // tasks pushed, a group done or quit
+  unsigned int epoch;  // bumped on every push
+  int sleeping;
+  int quit;
+};
+
+typedef struct {
+  ThreadPool *pool;
+  int thread;
+} WorkerArg;
+
+// slot of the current thread in currentPool, for nested loops
+static __thread ThreadPool *currentPool;
+static __thread int currentSlot;
+
+static pthread_mutex_t sharedLock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadPool *sharedPool;
+static ThreadPoolSettings sharedSettings;
+static int sharedConfigured;
+
+static int push_task(ThreadPool *pool, int slot, const Task *task) {
+  TaskDeque *deque = &pool->deques[slot];
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail == deque->capacity && deque->head > 0) {
+    memmove(deque->tasks, deque->tasks + deque->head, (deque->tail - deque->head) * sizeof(Task));
+    deque->tail -= deque->head;
+    deque->head = 0;
+  }
+  if (deque->tail == deque->capacity) {
+    Task *tasks = (Task *)realloc(deque->tasks, 2 * deque->capacity * sizeof(Task));
+    if (!tasks) {
+      pthread_mutex_unlock(&deque->lock);
+      return 0;
+    }
+    deque->tasks = tasks;
+    deque->capacity *= 2;
+  }
+  deque->tasks[deque->tail++] = *task;
+  pthread_mutex_unlock(&deque->lock);
+
+  __atomic_add_fetch(&pool->epoch, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return 1;
+}
+
+// takes a task of group (any group for NULL), newest first from the tail or
+// oldest first from the head
+static int take_task(TaskDeque *deque, const TaskGroup *group, int fromTail, Task *out) {
+  pthread_mutex_lock(&deque->lock);
+  int found = -1;
+  if (fromTail) {
+    for (int k = deque->tail - 1; k >= deque->head && found < 0; k--)
+      if (!group || deque->tasks[k].group == group)
+        found = k;
+  } else {
+    for (int k = deque->head; k < deque->tail && found < 0; k++)
+      if (!group || deque->tasks[k].group == group)
+        found = k;
+  }
+  if (found >= 0) {
+    *out = deque->tasks[found];
+    if (fromTail) {
+      memmove(deque->tasks + found, deque->tasks + found + 1, (deque->tail - found - 1) * sizeof(Task));
+      deque->tail--;
+    } else {
+      memmove(deque->tasks + deque->head + 1, deque->tasks + deque->head, (found - deque->head) * sizeof(Task));
+      deque->head++;
+    }
+    if (deque->head == deque->tail)
+      deque->head = deque->tail = 0;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found >= 0;
+}
+
+// own deque first, then steal round the others
+static int find_task(ThreadPool *pool, int slot, const TaskGroup *group, Task *out) {
+  if (take_task(&pool->deques[slot], group, 1, out))
+    return 1;
+  for (int k = 1; k < pool->size; k++)
+    if (take_task(&pool->deques[(slot + k) % pool->size], group, 0, out))
+      return 1;
+  return 0;
+}
+
+static void finish(ThreadPool *pool, TaskGroup *group, int count) {
+  // the group may be gone once pending reaches zero, only the pool is touched
+  if (__atomic_sub_fetch(&group->pending, count, __ATOMIC_ACQ_REL) == 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+static void run_task(ThreadPool *pool, int slot, Task task) {
+  while (task.end - task.begin > task.grain) {
+    Task half = task;
+    half.begin = task.begin + (task.end - task.begin) / 2;
+    if (!push_task(pool, slot, &half))
+      break;
+    task.end = half.begin;
+  }
+  for (int i = task.begin; i < task.end; i++)
+    if (!threadpool_group_cancelled(task.group))
+      task.fn(task.ctx, i, slot);
+  finish(pool, task.group, task.end - task.begin);
+}
+
+// sleeps until something was pushed since epoch, or until done() holds
+static void sleep_until(ThreadPool *pool, unsigned int epoch, const TaskGroup *group) {
+  pthread_mutex_lock(&pool->lock);
+  __atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+  while (!pool->quit && __atomic_load_n(&pool->epoch, __ATOMIC_SEQ_CST) == epoch &&
+         (!group || __atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0))
+    pthread_cond_wait(&pool->wake, &pool->lock);
+  __atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void pin_thread(int thread) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int core = cores > 0 ? thread % (int)cores : 0;
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(__APPLE__)
+  // threads with different tags are spread over cores, a hint only
+  thread_affinity_policy_data_t policy = {core + 1};
+  thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY, (thread_policy_t)&policy,
+                    THREAD_AFFINITY_POLICY_COUNT);
+#else
+  (void)core;
+#endif
+}
+
+static void *worker_main(void *p) {
+  WorkerArg *arg = (WorkerArg *)p;
+  ThreadPool *pool = arg->pool;
+  int thread = arg->thread;
+  free(arg);
+  if (pool->pin)
+    pin_thread(thread);
+  currentPool = pool;
+  currentSlot = thread;
+
+  while (!__atomic_load_n(&pool->quit, __ATOMIC_ACQUIRE)) {
+    unsigned int epoch = __atomic_load_n(&pool->epoch, __ATOMIC_SEQ_CST);
+    Task task;
+    if (find_task(pool, thread, NULL, &task))
+      run_task(pool, thread, task);
+    else
+      sleep_until(pool, epoch, NULL);
+  }
+  return NULL;
+}
+
+ThreadPoolSettings threadpool_default_settings(void) {
+  ThreadPoolSettings settings = {0, 0};
+  return settings;
+}
+
+int threadpool_default_threads(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+ThreadPool *threadpool_create(int threads) {
+  ThreadPoolSettings settings = threadpool_default_settings();
+  settings.threads = threads;
+  return threadpool_create_with(&settings);
+}
+
+ThreadPool *threadpool_create_with(const ThreadPoolSettings *settings) {
+  ThreadPool *pool = (ThreadPool *)calloc(1, sizeof(ThreadPool));
+  if (!pool)
+    return NULL;
+  int size = settings->threads > 0 ? settings->threads : threadpool_default_threads();
+  pool->pin = settings->pin;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pool->threads = (pthread_t *)calloc(size, sizeof(pthread_t));
+  pool->started = (char *)calloc(size, 1);
+  pool->deques = (TaskDeque *)calloc(size, sizeof(TaskDeque));
+  for (; pool->threads && pool->started && pool->deques && pool->dequeCount < size; pool->dequeCount++) {
+    TaskDeque *deque = &pool->deques[pool->dequeCount];
+    deque->tasks = (Task *)malloc(DEQUE_INITIAL * sizeof(Task));
+    if (!deque->tasks)
+      break;
+    deque->capacity = DEQUE_INITIAL;
+    pthread_mutex_init(&deque->lock, NULL);
+  }
+
+  // no deque at all: size 1, every loop runs on the caller. A worker that
+  // fails to start leaves its slot empty, the others steal around it.
+  pool->size = pool->dequeCount > 0 ? pool->dequeCount : 1;
+  for (int t = 1; t < pool->size; t++) {
+    WorkerArg *arg = (WorkerArg *)malloc(sizeof(WorkerArg));
+    if (!arg)
+      continue;
+    arg->pool = pool;
+    arg->thread = t;
+    if (pthread_create(&pool->threads[t], NULL, worker_main, arg) != 0) {
+      free(arg);
+      continue;
+    }
+    pool->started[t] = 1;
+  }
+  return pool;
+}
+
+void threadpool_destroy(ThreadPool *pool) {
+  if (!pool)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  __atomic_store_n(&pool->quit, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for (int t = 1; t < pool->size; t++)
+    if (pool->started[t])
+      pthread_join(pool->threads[t], NULL);
+  for (int d = 0; d < pool->dequeCount; d++) {
+    pthread_mutex_destroy(&pool->deques[d].lock);
+    free(pool->deques[d].tasks);
+  }
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->deques);
+  free(pool->threads);
+  free(pool->started);
+  pthread_mutex_lock(&sharedLock);
+  if (pool == sharedPool)
+    sharedPool = NULL;
+  pthread_mutex_unlock(&sharedLock);
+  free(pool);
+}
+
+int threadpool_size(const ThreadPool *pool) { return pool ? pool->size : 1; }
+
+ThreadPool *threadpool_shared(void) {
+  pthread_mutex_lock(&sharedLock);
+  if (!sharedPool) {
+    ThreadPoolSettings settings = sharedConfigured ? sharedSettings : threadpool_default_settings();
+    sharedPool = threadpool_create_with(&settings);
+  }
+  ThreadPool *pool = sharedPool;
+  pthread_mutex_unlock(&sharedLock);
+  return pool;
+}
+
+int threadpool_configure_shared(const ThreadPoolSettings *settings) {
+  pthread_mutex_lock(&sharedLock);
+  int ok = sharedPool == NULL;
+  if (ok) {
+    sharedSettings = *settings;
+    sharedConfigured = 1;
+  }
+  pthread_mutex_unlock(&sharedLock);
+  return ok;
+}
+
+void threadpool_group_init(ThreadPool *pool, TaskGroup *group) {
+  group->pool = pool;
+  group->pending = 0;
+  group->cancelled = 0;
+}
+
+// slot of the calling thread: its own inside the pool, else slot 0, which
+// every thread outside it shares. Each of those only runs tasks of the group
+// it waits for, so no loop sees two of them.
+static int enter_slot(ThreadPool *pool) {
+  if (currentPool != pool) {
+    currentPool = pool;
+    currentSlot = 0;
+  }
+  return currentSlot;
+}
+
+void threadpool_group_run(TaskGroup *group, int count, ParallelForFn fn, void *ctx) {
+  if (count <= 0)
+    return;
+  ThreadPool *pool = group->pool;
+  if (!pool || pool->size == 1 || count == 1) {
+    // serial, on whatever slot the caller has (0 outside a pool)
+    int thread = pool && currentPool == pool ? currentSlot : 0;
+    for (int i = 0; i < count && !threadpool_group_cancelled(group); i++)
+      fn(ctx, i, thread);
+    return;
+  }
+  __atomic_add_fetch(&group->pending, count, __ATOMIC_ACQ_REL);
+  int grain = count / (SPLITS_PER_THREAD * pool->size);
+  Task task = {group, fn, ctx, 0, count, grain > 0 ? grain : 1};
+  // outside the pool the task goes to slot 0, whose deque everybody steals from
+  int slot = currentPool == pool ? currentSlot : 0;
+  if (!push_task(pool, slot, &task)) {
+    for (int i = 0; i < count && !threadpool_group_cancelled(group); i++)
+      fn(ctx, i, slot);
+    finish(pool, group, count);
+  }
+}
+
+void threadpool_group_wait(TaskGroup *group) {
+  ThreadPool *pool = group->pool;
+  if (!pool)
+    return;
+  ThreadPool *outerPool = currentPool;
+  int outerSlot = currentSlot;
+  int slot = enter_slot(pool);
+  while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+    unsigned int epoch = __atomic_load_n(&pool->epoch, __ATOMIC_SEQ_CST);
+    Task task;
+    if (find_task(pool, slot, group, &task))
+      run_task(pool, slot, task);
+    else
+      sleep_until(pool, epoch, group);
+  }
+  currentPool = outerPool;
+  currentSlot = outerSlot;
+}
+
+void threadpool_group_cancel(TaskGroup *group) { __atomic_store_n(&group->cancelled, 1, __ATOMIC_RELAXED); }
+
+int threadpool_group_cancelled(const TaskGroup *group) {
+  return __atomic_load_n(&group->cancelled, __ATOMIC_RELAXED);
+}
+
+void threadpool_parallel_for(ThreadPool *pool, int count, ParallelForFn fn, void *ctx) {
+  TaskGroup group;
+  threadpool_group_init(pool, &group);
+  threadpool_group_run(&group, count, fn, ctx);
+  threadpool_group_wait(&group);
+}
+
+typedef struct {
+  ReduceFn fn;
+  void *ctx;
+  int count;
+  double *blocks;
+} ReduceJob;
+
+static double block_sum(const ReduceJob *job, int block) {
+  int end = (block + 1) * THREADPOOL_REDUCE_BLOCK < job->count ? (block + 1) * THREADPOOL_REDUCE_BLOCK : job->count;
+  double sum = 0.0;
+  for (int i = block * THREADPOOL_REDUCE_BLOCK; i < end; i++)
+    sum += job->fn(job->ctx, i);
+  return sum;
+}
+
+static void reduce_block(void *ctx, int block, int thread) {
+  ReduceJob *job = (ReduceJob *)ctx;
+  job->blocks[block] = block_sum(job, block);
+}
+
+// pairwise over blocks [lo, hi); without the array the blocks are summed on
+// the spot, in the same tree
+static double tree_sum(const ReduceJob *job, int lo, int hi) {
+  if (hi - lo == 1)
+    return job->blocks ? job->blocks[lo] : block_sum(job, lo);
+  int mid = lo + (hi - lo) / 2;
+  return tree_sum(job, lo, mid) + tree_sum(job, mid, hi);
+}
+
+double threadpool_reduce_sum(ThreadPool *pool, int count, ReduceFn fn, void *ctx) {
+  if (count <= 0)
+    return 0.0;
+  int blocks = (count + THREADPOOL_REDUCE_BLOCK - 1) / THREADPOOL_REDUCE_BLOCK;
+  ReduceJob job = {fn, ctx, count, (double *)malloc(blocks * sizeof(double))};
+  if (job.blocks)
+    threadpool_parallel_for(pool, blocks, reduce_block, &job);
+  double sum = tree_sum(&job, 0, blocks);
+  free(job.blocks);
+  return sum;
+}
+
+double threadpool_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1.0e6;
+}
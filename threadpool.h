@@ -0,0 +1,68 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// Persistent worker threads with work stealing. A loop is one range task
+// that whoever runs it splits in halves on demand, leaving one half on its
+// own deque for idle threads to steal. The thread waiting for a loop helps
+// running it, so a pool of n threads spawns n - 1 workers and slot 0 goes to
+// the calling threads: every thread outside the pool runs its loops' tasks as
+// thread 0, however many of them wait at once. Loops nest (a task may run its
+// own loop) and may be started from several threads at once; a waiting
+// thread only picks up tasks of the group it waits for, so a task's
+// per-thread state is never reentered and no loop sees two threads as 0 (a
+// group is waited for by one thread at a time).
+
+typedef void (*ParallelForFn)(void *ctx, int index, int thread);
+typedef double (*ReduceFn)(void *ctx, int index);
+
+typedef struct ThreadPool ThreadPool;
+
+typedef struct {
+  int threads; // <= 0: one per core
+  int pin;     // worker t stays on core t (Linux; an affinity hint on macOS)
+} ThreadPoolSettings;
+
+// A set of loops to wait for together. Cancelling skips the indices not
+// started yet, the running ones finish.
+typedef struct {
+  ThreadPool *pool;
+  int pending;   // indices not done yet
+  int cancelled;
+} TaskGroup;
+
+ThreadPoolSettings threadpool_default_settings(void);
+int threadpool_default_threads(void);
+ThreadPool *threadpool_create(int threads); // threads <= 0: one per core
+ThreadPool *threadpool_create_with(const ThreadPoolSettings *settings);
+void threadpool_destroy(ThreadPool *pool);
+int threadpool_size(const ThreadPool *pool);
+
+// The process-wide pool every subsystem shares, so they never oversubscribe
+// the cores. Created on first use with the settings given to
+// threadpool_configure_shared (which fails once it exists), or the defaults.
+// The owner destroys it at exit.
+ThreadPool *threadpool_shared(void);
+int threadpool_configure_shared(const ThreadPoolSettings *settings);
+
+// Calls fn(ctx, i, thread) for every i in [0, count) and returns when all are
+// done. thread is in [0, size) and no two calls of one loop running at the
+// same time share it.
+void threadpool_parallel_for(ThreadPool *pool, int count, ParallelForFn fn, void *ctx);
+
+void threadpool_group_init(ThreadPool *pool, TaskGroup *group);
+// Starts a loop in the group and returns at once; with a NULL or
+// single-thread pool it runs right here instead.
+void threadpool_group_run(TaskGroup *group, int count, ParallelForFn fn, void *ctx);
+void threadpool_group_wait(TaskGroup *group);
+void threadpool_group_cancel(TaskGroup *group);
+int threadpool_group_cancelled(const TaskGroup *group);
+
+// Sum of fn(ctx, i) over [0, count), bit-identical for every pool size:
+// blocks of THREADPOOL_REDUCE_BLOCK terms are summed in index order and the
+// block sums pairwise in a fixed tree.
+#define THREADPOOL_REDUCE_BLOCK 64
+double threadpool_reduce_sum(ThreadPool *pool, int count, ReduceFn fn, void *ctx);
+
+double threadpool_now_ms(void);
+
+#endif
@@ -0,0 +1,199 @@
+#include "valleys.h"
+#include <math.h>
+#include <string.h>
+
+#define VALLEY_WARM_STEP 0.02f   // first trust radius of a tracked valley
+#define VALLEY_SEED_TEXELS 2.0f // first trust radius of a birth seed, in texels
+
+void valley_tracker_init(ValleyTracker *tracker, const MinimaSettings *settings) {
+  memset(tracker, 0, sizeof(*tracker));
+  tracker->settings = *settings;
+}
+
+void valley_tracker_free(ValleyTracker *tracker) {
+  free(tracker->valleys);
+  free(tracker->events);
+  valley_tracker_init(tracker, &tracker->settings);
+}
+
+void valley_tracker_reset(ValleyTracker *tracker) {
+  tracker->count = 0;
+  tracker->eventCount = 0;
+  tracker->started = 0;
+}
+
+static int reserve(void **items, int *capacity, int needed, size_t size) {
+  if (needed <= *capacity)
+    return 1;
+  int grown = *capacity > 0 ? *capacity : 16;
+  while (grown < needed)
+    grown *= 2;
+  void *moved = realloc(*items, grown * size);
+  if (!moved)
+    return 0;
+  *items = moved;
+  *capacity = grown;
+  return 1;
+}
+
+static int add_event(ValleyTracker *tracker, ValleyEventType type, int id, int into, float x, float z) {
+  if (!reserve((void **)&tracker->events, &tracker->eventCapacity, tracker->eventCount + 1, sizeof(ValleyEvent)))
+    return 0;
+  ValleyEvent event = {type, id, into, x, z};
+  tracker->events[tracker->eventCount++] = event;
+  return 1;
+}
+
+// survivors [0, count) of this update, -1 when nothing is within the radius
+static int find_near(const Valley *valleys, int count, float x, float z, float radius) {
+  for (int i = 0; i < count; i++)
+    if (fabsf(valleys[i].minimum.x - x) <= radius && fabsf(valleys[i].minimum.z - z) <= radius)
+      return i;
+  return -1;
+}
+
+typedef struct {
+  const ValleyTracker *tracker;
+  Voices *voices;
+  const DissonancePlan *plan;
+  const MinimaBasins *basins;
+  const int *seeds; // basins seeding a birth
+  DissonanceMinimum *found;
+  int *ok;
+  long long *evaluations; // per task
+} TrackJob;
+
+static void track_task(void *ctx, int index, int thread) {
+  TrackJob *job = (TrackJob *)ctx;
+  const ValleyTracker *tracker = job->tracker;
+  const MinimaSettings *s = &tracker->settings;
+  float x, z, step = 0.0f;
+  if (index < tracker->count) {
+    // a warm start, the valley moved a little since the last update
+    step = VALLEY_WARM_STEP;
+    x = tracker->valleys[index].minimum.x;
+    z = tracker->valleys[index].minimum.z;
+  } else {
+    const MinimaBasins *basins = job->basins;
+    int texel = basins->basins[job->seeds[index - tracker->count]].texel;
+    float size = basins->extent / basins->resolution;
+    x = (texel % basins->resolution + 0.5f) * size;
+    z = (texel / basins->resolution + 0.5f) * size;
+    step = VALLEY_SEED_TEXELS * size;
+  }
+  job->evaluations[index] = 0;
+  job->ok[index] =
+      minima_descend(s, job->voices, job->plan, x, z, step, &job->found[index], &job->evaluations[index]);
+}
+
+static int full_search(ThreadPool *pool, ValleyTracker *tracker, Voices *voices, const DissonancePlan *plan,
+                       const MinimaBasins *basins) {
+  MinimaResult result;
+  if (!find_minima(pool, &tracker->settings, voices, plan, basins, &result))
+    return 0;
+  int ok = reserve((void **)&tracker->valleys, &tracker->capacity, result.count, sizeof(Valley));
+  for (int i = 0; ok && i < result.count; i++) {
+    Valley valley = {tracker->nextId++, result.minima[i], 0};
+    tracker->valleys[tracker->count++] = valley;
+    ok = add_event(tracker, VALLEY_BORN, valley.id, valley.id, valley.minimum.x, valley.minimum.z);
+  }
+  tracker->evaluations = result.evaluations;
+  minima_result_free(&result);
+  tracker->started = ok;
+  return ok;
+}
+
+int valley_tracker_update(ThreadPool *pool, ValleyTracker *tracker, Voices *voices, const DissonancePlan *plan,
+                          const MinimaBasins *basins) {
+  const MinimaSettings *s = &tracker->settings;
+  double start = threadpool_now_ms();
+  tracker->eventCount = 0;
+  tracker->evaluations = 0;
+  if (!tracker->started) {
+    tracker->count = 0;
+    int ok = full_search(pool, tracker, voices, plan, basins);
+    tracker->ms = threadpool_now_ms() - start;
+    if (!ok)
+      valley_tracker_reset(tracker);
+    return ok;
+  }
+
+  size_t slots = tracker->count + s->maxSeeds;
+  int *seeds = (int *)malloc(s->maxSeeds * sizeof(int));
+  DissonanceMinimum *found = (DissonanceMinimum *)malloc(slots * sizeof(DissonanceMinimum));
+  int *ok = (int *)malloc(slots * sizeof(int));
+  long long *evaluations = (long long *)malloc(slots * sizeof(long long));
+  if (!seeds || !found || !ok || !evaluations) {
+    free(seeds);
+    free(found);
+    free(ok);
+    free(evaluations);
+    valley_tracker_reset(tracker);
+    return 0;
+  }
+  // birth seeds: the deepest basins no valley sits in
+  int deepest = minima_deepest_basins(basins, s->maxSeeds, seeds);
+  int seedCount = 0;
+  for (int b = 0; b < deepest; b++) {
+    int claimed = 0;
+    for (int i = 0; i < tracker->count && !claimed; i++)
+      claimed = minima_basin_at(basins, tracker->valleys[i].minimum.x, tracker->valleys[i].minimum.z) == seeds[b];
+    if (!claimed)
+      seeds[seedCount++] = seeds[b];
+  }
+  int tasks = tracker->count + seedCount;
+  TrackJob job = {tracker, voices, plan, basins, seeds, found, ok, evaluations};
+  threadpool_parallel_for(pool, tasks, track_task, &job);
+
+  // corrections, oldest first: the older valley keeps its id on a merge.
+  // Survivors are compacted in place and stay in ascending id.
+  int alive = 0;
+  int result = 1;
+  int tracked = tracker->count;
+  for (int i = 0; i < tracked && result; i++) {
+    Valley valley = tracker->valleys[i];
+    DissonanceMinimum *at = &found[i];
+    if (!ok[i]) {
+      result = add_event(tracker, VALLEY_DIED, valley.id, valley.id, valley.minimum.x, valley.minimum.z);
+      continue;
+    }
+    int near = find_near(tracker->valleys, alive, at->x, at->z, s->mergeRadius);
+    if (near >= 0) {
+      result = add_event(tracker, VALLEY_MERGED, valley.id, tracker->valleys[near].id, at->x, at->z);
+      continue;
+    }
+    // depth and basin from the heightmap under its new position, the
+    // newest one handed in
+    valley.minimum = *at;
+    int basin = minima_basin_at(basins, at->x, at->z);
+    if (basin >= 0)
+      minima_basin_measure(basins, basin, &valley.minimum);
+    valley.age++;
+    tracker->valleys[alive++] = valley;
+  }
+  tracker->count = alive;
+
+  // births: seeds that settled away from every valley
+  for (int i = tracked; i < tasks && result; i++) {
+    if (!ok[i] || find_near(tracker->valleys, tracker->count, found[i].x, found[i].z, s->mergeRadius) >= 0)
+      continue;
+    result = reserve((void **)&tracker->valleys, &tracker->capacity, tracker->count + 1, sizeof(Valley));
+    if (!result)
+      break;
+    Valley valley = {tracker->nextId++, found[i], 0};
+    minima_basin_measure(basins, seeds[i - tracked], &valley.minimum);
+    tracker->valleys[tracker->count++] = valley;
+    result = add_event(tracker, VALLEY_BORN, valley.id, valley.id, found[i].x, found[i].z);
+  }
+
+  for (int i = 0; i < tasks; i++)
+    tracker->evaluations += evaluations[i];
+  tracker->ms = threadpool_now_ms() - start;
+  free(seeds);
+  free(found);
+  free(ok);
+  free(evaluations);
+  if (!result)
+    valley_tracker_reset(tracker);
+  return result;
+}
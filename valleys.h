@@ -0,0 +1,56 @@
+#ifndef VALLEYS_H
+#define VALLEYS_H
+
+#include "minima.h"
+
+// Follows the minima of the field while the spectra change (the voice 4 / 5
+// sliders): every update warm-starts a descent from each valley's last
+// position, so a valley keeps its id while it slides, and measures its depth
+// and basin again in the basin it landed in. Two valleys that end up
+// within mergeRadius merge into the older one, a valley whose descent no
+// longer converges inside the range dies.
+//
+// New valleys can appear anywhere: each update also seeds a descent in every
+// one of the deepest basins of the heightmap (minima.h) that holds no tracked
+// valley, and a seed that settles away from all of them is a birth. The
+// first update after init / reset is a full find_minima.
+
+typedef struct {
+  int id;
+  DissonanceMinimum minimum; // depth and basin from the basin it sits in at the last update
+  int age;                   // updates survived
+} Valley;
+
+typedef enum { VALLEY_BORN, VALLEY_MERGED, VALLEY_DIED } ValleyEventType;
+
+typedef struct {
+  ValleyEventType type;
+  int id;
+  int into;   // surviving id, for VALLEY_MERGED
+  float x, z; // where it happened
+} ValleyEvent;
+
+typedef struct {
+  MinimaSettings settings;
+  int nextId;
+  int started;
+  int count, capacity;
+  Valley *valleys; // alive, ascending id
+  int eventCount, eventCapacity;
+  ValleyEvent *events; // from the last update
+  long long evaluations;
+  double ms;
+} ValleyTracker;
+
+void valley_tracker_init(ValleyTracker *tracker, const MinimaSettings *settings);
+void valley_tracker_free(ValleyTracker *tracker);
+// forget every valley, the next update searches from scratch
+void valley_tracker_reset(ValleyTracker *tracker);
+
+// Returns 0 when out of memory (the tracker is reset).
+// plan: compiled from voices, basins: of a heightmap of the field, see
+// find_minima.
+int valley_tracker_update(ThreadPool *pool, ValleyTracker *tracker, Voices *voices, const DissonancePlan *plan,
+                          const MinimaBasins *basins);
+
+#endif
@@ -0,0 +1,255 @@
+#include "valleyworker.h"
+#include <pthread.h>
+#include <string.h>
+
+typedef struct {
+  Valley *valleys;
+  int capacity;
+  ValleyEvent *events;
+  int eventCapacity;
+  ValleySnapshot snapshot;
+} ValleyBuffer;
+
+struct ValleyWorker {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake; // a new request, a released buffer or quit
+  int quit;
+  ThreadPool *pool;
+  int resolution;
+
+  // newest request, under the lock
+  Arena requestArena;
+  Voices request;
+  int hasVoices;
+  float *requestHeights;
+  float requestScale;
+  int heightsFresh; // requestHeights not taken by the worker yet
+  int hasHeights;
+  int active;
+  int restart; // forget the valleys before the next update
+  unsigned int requested;
+
+  // worker thread only
+  Arena buildArena;
+  Voices build;
+  float *heights;
+  DissonancePlan plan;
+  MinimaBasins basins;
+  ValleyTracker tracker;
+
+  // published, under the lock
+  ValleyBuffer buffers[2];
+  int front;    // newest snapshot, -1 before the first
+  int acquired; // buffer the renderer holds, -1 for none
+  int fresh;    // front not acquired yet
+};
+
+static int reserve(void **items, int *capacity, int needed, size_t size) {
+  if (needed <= *capacity)
+    return 1;
+  int grown = *capacity > 0 ? *capacity : 16;
+  while (grown < needed)
+    grown *= 2;
+  void *moved = realloc(*items, grown * size);
+  if (!moved)
+    return 0;
+  *items = moved;
+  *capacity = grown;
+  return 1;
+}
+
+// under the lock, waits until the renderer does not hold the back buffer
+static void publish(ValleyWorker *worker, unsigned int generation, double ms) {
+  int back = worker->front < 0 ? 0 : 1 - worker->front;
+  while (worker->acquired == back && !worker->quit)
+    pthread_cond_wait(&worker->wake, &worker->lock);
+  if (worker->quit)
+    return;
+  const ValleyTracker *tracker = &worker->tracker;
+  ValleyBuffer *buffer = &worker->buffers[back];
+  // a front nobody acquired is skipped, its events carry over
+  const ValleySnapshot *skipped = worker->fresh ? &worker->buffers[worker->front].snapshot : NULL;
+  int carried = skipped ? skipped->eventCount : 0;
+  if (!reserve((void **)&buffer->valleys, &buffer->capacity, tracker->count, sizeof(Valley)) ||
+      !reserve((void **)&buffer->events, &buffer->eventCapacity, carried + tracker->eventCount, sizeof(ValleyEvent)))
+    return;
+  ValleySnapshot *snapshot = &buffer->snapshot;
+  memcpy(buffer->valleys, tracker->valleys, tracker->count * sizeof(Valley));
+  if (carried)
+    memcpy(buffer->events, skipped->events, carried * sizeof(ValleyEvent));
+  memcpy(buffer->events + carried, tracker->events, tracker->eventCount * sizeof(ValleyEvent));
+  snapshot->generation = generation;
+  snapshot->count = tracker->count;
+  snapshot->valleys = buffer->valleys;
+  snapshot->eventCount = carried + tracker->eventCount;
+  snapshot->events = buffer->events;
+  snapshot->evaluations = tracker->evaluations;
+  snapshot->ms = ms;
+  worker->front = back;
+  worker->fresh = 1;
+}
+
+static void *worker_main(void *arg) {
+  ValleyWorker *worker = (ValleyWorker *)arg;
+  unsigned int built = 0;
+  pthread_mutex_lock(&worker->lock);
+  while (!worker->quit) {
+    if (!worker->active || !worker->hasVoices || !worker->hasHeights || worker->requested == built) {
+      pthread_cond_wait(&worker->wake, &worker->lock);
+      continue;
+    }
+    unsigned int building = worker->requested;
+    int restart = worker->restart;
+    worker->restart = 0;
+    int newHeights = worker->heightsFresh;
+    if (newHeights) {
+      float *taken = worker->requestHeights;
+      worker->requestHeights = worker->heights;
+      worker->heights = taken;
+      worker->heightsFresh = 0;
+    }
+    float scale = worker->requestScale;
+    int ok = voices_copy(&worker->build, &worker->buildArena, &worker->request);
+    pthread_mutex_unlock(&worker->lock);
+
+    double start = threadpool_now_ms();
+    if (restart)
+      valley_tracker_reset(&worker->tracker);
+    if (ok && newHeights)
+      ok = minima_basins_build(&worker->basins, worker->heights, worker->resolution, worker->tracker.settings.extent,
+                               scale);
+    ok = ok && dissonance_plan_update(&worker->plan, &worker->build) >= 0;
+    ok = ok && worker->basins.count > 0 &&
+         valley_tracker_update(worker->pool, &worker->tracker, &worker->build, &worker->plan, &worker->basins);
+
+    pthread_mutex_lock(&worker->lock);
+    // out of memory drops the request, the next one retries; a basin build
+    // that failed is redone with the next heights. An update that finished
+    // after its tracker was hidden or told to start over is not shown.
+    built = building;
+    if (ok && worker->active && !worker->restart)
+      publish(worker, building, threadpool_now_ms() - start);
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return NULL;
+}
+
+static void free_buffers(ValleyWorker *worker) {
+  for (int b = 0; b < 2; b++) {
+    free(worker->buffers[b].valleys);
+    free(worker->buffers[b].events);
+  }
+  free(worker->requestHeights);
+  free(worker->heights);
+  arena_free(&worker->requestArena);
+  arena_free(&worker->buildArena);
+  dissonance_plan_free(&worker->plan);
+  minima_basins_free(&worker->basins);
+  valley_tracker_free(&worker->tracker);
+}
+
+ValleyWorker *valley_worker_create(ThreadPool *pool, const MinimaSettings *settings, int resolution) {
+  ValleyWorker *worker = (ValleyWorker *)calloc(1, sizeof(ValleyWorker));
+  if (!worker)
+    return NULL;
+  worker->pool = pool;
+  worker->resolution = resolution;
+  worker->front = -1;
+  worker->acquired = -1;
+  arena_init(&worker->requestArena, ARENA_DEFAULT_BLOCK);
+  arena_init(&worker->buildArena, ARENA_DEFAULT_BLOCK);
+  dissonance_plan_init(&worker->plan, DISS_AMP_MIN, 0.0f);
+  minima_basins_init(&worker->basins);
+  valley_tracker_init(&worker->tracker, settings);
+  size_t texels = (size_t)resolution * resolution;
+  worker->requestHeights = (float *)malloc(texels * sizeof(float));
+  worker->heights = (float *)malloc(texels * sizeof(float));
+  if (!worker->requestHeights || !worker->heights) {
+    free_buffers(worker);
+    free(worker);
+    return NULL;
+  }
+  pthread_mutex_init(&worker->lock, NULL);
+  pthread_cond_init(&worker->wake, NULL);
+  if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->wake);
+    free_buffers(worker);
+    free(worker);
+    return NULL;
+  }
+  return worker;
+}
+
+void valley_worker_destroy(ValleyWorker *worker) {
+  if (!worker)
+    return;
+  pthread_mutex_lock(&worker->lock);
+  worker->quit = 1;
+  pthread_cond_broadcast(&worker->wake);
+  pthread_mutex_unlock(&worker->lock);
+  pthread_join(worker->thread, NULL);
+  pthread_mutex_destroy(&worker->lock);
+  pthread_cond_destroy(&worker->wake);
+  free_buffers(worker);
+  free(worker);
+}
+
+void valley_worker_set_active(ValleyWorker *worker, int active) {
+  pthread_mutex_lock(&worker->lock);
+  if (active && !worker->active) {
+    worker->restart = 1;
+    worker->requested++;
+  }
+  worker->active = active;
+  pthread_cond_broadcast(&worker->wake);
+  pthread_mutex_unlock(&worker->lock);
+}
+
+unsigned int valley_worker_submit(ValleyWorker *worker, const Voices *voices) {
+  pthread_mutex_lock(&worker->lock);
+  int unchanged = worker->hasVoices && voices_equal(&worker->request, voices);
+  if (!unchanged) {
+    worker->hasVoices = voices_copy(&worker->request, &worker->requestArena, voices);
+    worker->requested++;
+    pthread_cond_broadcast(&worker->wake);
+  }
+  unsigned int generation = worker->requested;
+  pthread_mutex_unlock(&worker->lock);
+  return generation;
+}
+
+unsigned int valley_worker_submit_heights(ValleyWorker *worker, const float *heights, float scale) {
+  pthread_mutex_lock(&worker->lock);
+  memcpy(worker->requestHeights, heights, (size_t)worker->resolution * worker->resolution * sizeof(float));
+  worker->requestScale = scale;
+  worker->heightsFresh = 1;
+  worker->hasHeights = 1;
+  worker->requested++;
+  pthread_cond_broadcast(&worker->wake);
+  unsigned int generation = worker->requested;
+  pthread_mutex_unlock(&worker->lock);
+  return generation;
+}
+
+const ValleySnapshot *valley_worker_acquire(ValleyWorker *worker) {
+  pthread_mutex_lock(&worker->lock);
+  const ValleySnapshot *snapshot = NULL;
+  if (worker->fresh) {
+    worker->fresh = 0;
+    worker->acquired = worker->front;
+    snapshot = &worker->buffers[worker->front].snapshot;
+    // the buffer held before is the back buffer now
+    pthread_cond_broadcast(&worker->wake);
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return snapshot;
+}
+
+void valley_worker_release(ValleyWorker *worker) {
+  pthread_mutex_lock(&worker->lock);
+  worker->acquired = -1;
+  pthread_cond_broadcast(&worker->wake);
+  pthread_mutex_unlock(&worker->lock);
+}
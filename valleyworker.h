@@ -0,0 +1,51 @@
+#ifndef VALLEYWORKER_H
+#define VALLEYWORKER_H
+
+#include "valleys.h"
+
+// Runs the valley tracker on a background thread, so neither the search for
+// new minima nor the basins of a freshly read back heightmap cost a frame.
+//
+// Requests work like the field worker's: the voices and the heights are
+// copied, a change of either is a new request, and requests coalesce, the
+// worker always updates the tracker for the newest one. The worker compiles
+// its own plan of the voices and rebuilds the basins only when new heights
+// came in. Every update is published double buffered; the renderer draws the
+// newest snapshot it acquired until it acquires the next one.
+
+typedef struct {
+  unsigned int generation; // request the snapshot was built from
+  int count;
+  const Valley *valleys; // ascending id
+  int eventCount;
+  const ValleyEvent *events; // since the previously acquired snapshot
+  long long evaluations;
+  double ms; // tracker update, with the basins when they were rebuilt
+} ValleySnapshot;
+
+typedef struct ValleyWorker ValleyWorker;
+
+// resolution: of the heights to come. The tracker's loops run on pool. NULL
+// when out of memory or when the thread cannot start.
+ValleyWorker *valley_worker_create(ThreadPool *pool, const MinimaSettings *settings, int resolution);
+void valley_worker_destroy(ValleyWorker *worker);
+
+// An inactive worker keeps the newest requests but runs nothing; activating
+// it forgets every valley, the next update searches from scratch.
+void valley_worker_set_active(ValleyWorker *worker, int active);
+
+// Requests an update for voices, copied. An unchanged configuration is not a
+// new request. Returns the generation of the newest request.
+unsigned int valley_worker_submit(ValleyWorker *worker, const Voices *voices);
+// Requests an update on a new heightmap of the field: resolution^2 texels,
+// row j = z, copied, times scale in field units. Nothing runs before the
+// first one.
+unsigned int valley_worker_submit_heights(ValleyWorker *worker, const float *heights, float scale);
+
+// The newest snapshot when one landed since the last call, else NULL. It
+// stays valid until the next call that returns one, or until
+// valley_worker_release.
+const ValleySnapshot *valley_worker_acquire(ValleyWorker *worker);
+void valley_worker_release(ValleyWorker *worker);
+
+#endif
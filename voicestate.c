@@ -0,0 +1,40 @@
+#include "voicestate.h"
+#include <string.h>
+
+#define VOICE_STATE_FRESH 4 // set in middle next to the buffer index
+
+void voice_state_init(VoiceState *state) {
+  memset(state, 0, sizeof(*state));
+  state->front = 0;
+  state->middle = 1;
+  state->back = 2;
+}
+
+VoiceSnapshot *voice_state_edit(VoiceState *state) { return &state->buffers[state->back]; }
+
+void voice_state_set_voices(VoiceSnapshot *snapshot, const Voices *voices) {
+  int count = voices->count < VOICE_STATE_MAX_VOICES ? voices->count : VOICE_STATE_MAX_VOICES;
+  // whole voices only
+  while (count > 0 && voices->offsets[count] > VOICE_STATE_MAX_PARTIALS)
+    count--;
+  snapshot->count = count;
+  snapshot->truncated = count < voices->count;
+  memcpy(snapshot->offsets, voices->offsets, (count + 1) * sizeof(int));
+  memcpy(snapshot->freqs, voices->freqs, voices->offsets[count] * sizeof(float));
+  memcpy(snapshot->amps, voices->amps, voices->offsets[count] * sizeof(float));
+}
+
+void voice_state_publish(VoiceState *state) {
+  state->buffers[state->back].generation = ++state->generation;
+  // release: the reader that takes the buffer sees everything written to it
+  int old = __atomic_exchange_n(&state->middle, state->back | VOICE_STATE_FRESH, __ATOMIC_ACQ_REL);
+  state->back = old & ~VOICE_STATE_FRESH;
+}
+
+const VoiceSnapshot *voice_state_read(VoiceState *state) {
+  if (__atomic_load_n(&state->middle, __ATOMIC_RELAXED) & VOICE_STATE_FRESH) {
+    int old = __atomic_exchange_n(&state->middle, state->front, __ATOMIC_ACQ_REL);
+    state->front = old & ~VOICE_STATE_FRESH;
+  }
+  return &state->buffers[state->front];
+}
@@ -0,0 +1,47 @@
+#ifndef VOICESTATE_H
+#define VOICESTATE_H
+
+#include "dissonance.h"
+
+// Wait-free hand-over of the voices and playback parameters from the main
+// loop to one reader thread, e.g. the audio callback: a triple buffer. The
+// writer fills its back buffer and swaps it with the middle one, the reader
+// swaps its front buffer with the middle one when a newer snapshot sits
+// there. Neither side ever blocks, allocates or sees a half-written
+// snapshot, and a snapshot stays immutable while the reader holds it. One
+// VoiceState per reader thread.
+
+#define VOICE_STATE_MAX_VOICES 64
+#define VOICE_STATE_MAX_PARTIALS 1024
+
+typedef struct {
+  unsigned int generation; // 0 until the first publish
+  int playing;             // the test tone is on
+  float toneFreq;          // Hz
+  int count;
+  int truncated; // voices or partials past the capacity were dropped
+  int offsets[VOICE_STATE_MAX_VOICES + 1];
+  float freqs[VOICE_STATE_MAX_PARTIALS];
+  float amps[VOICE_STATE_MAX_PARTIALS];
+} VoiceSnapshot;
+
+typedef struct {
+  VoiceSnapshot buffers[3];
+  int back;   // writer only
+  int front;  // reader only
+  int middle; // swapped atomically, VOICE_STATE_FRESH when newer than front
+  unsigned int generation;
+} VoiceState;
+
+void voice_state_init(VoiceState *state);
+
+// Writer. The back buffer holds an old snapshot, every field has to be set
+// before voice_state_publish.
+VoiceSnapshot *voice_state_edit(VoiceState *state);
+void voice_state_set_voices(VoiceSnapshot *snapshot, const Voices *voices);
+void voice_state_publish(VoiceState *state);
+
+// Reader. The newest published snapshot, valid until the next call.
+const VoiceSnapshot *voice_state_read(VoiceState *state);
+
+#endif